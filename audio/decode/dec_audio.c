@@ -28,6 +28,7 @@
 #include "common/codecs.h"
 #include "common/msg.h"
 #include "misc/bstr.h"
+#include "misc/dec_queue.h"
 
 #include "stream/stream.h"
 #include "demux/demux.h"
@@ -51,6 +52,8 @@ static const struct ad_functions * const ad_drivers[] = {
     NULL
 };
 
+static void start_thread(struct dec_audio *d_audio);
+
 static void uninit_decoder(struct dec_audio *d_audio)
 {
     audio_reset_decoding(d_audio);
@@ -113,6 +116,8 @@ static const struct ad_functions *find_driver(const char *name)
 
 int audio_init_best_codec(struct dec_audio *d_audio)
 {
+    dec_queue_destroy(d_audio->queue);
+    d_audio->queue = NULL;
     uninit_decoder(d_audio);
     assert(!d_audio->ad_driver);
 
@@ -148,6 +153,10 @@ int audio_init_best_codec(struct dec_audio *d_audio)
     }
 
     talloc_free(list);
+
+    if (d_audio->ad_driver && d_audio->opts->ad_queue_secs > 0)
+        start_thread(d_audio);
+
     return !!d_audio->ad_driver;
 }
 
@@ -155,12 +164,19 @@ void audio_uninit(struct dec_audio *d_audio)
 {
     if (!d_audio)
         return;
+    dec_queue_destroy(d_audio->queue);
+    d_audio->queue = NULL;
     uninit_decoder(d_audio);
     talloc_free(d_audio);
 }
 
 void audio_reset_decoding(struct dec_audio *d_audio)
 {
+    struct dec_queue *q = d_audio->queue;
+    if (q) {
+        dec_queue_lock_decoder(q);
+        dec_queue_reset(q);
+    }
     if (d_audio->ad_driver)
         d_audio->ad_driver->control(d_audio, ADCTRL_RESET, NULL);
     d_audio->pts = MP_NOPTS_VALUE;
@@ -168,6 +184,8 @@ void audio_reset_decoding(struct dec_audio *d_audio)
     d_audio->current_frame = NULL;
     talloc_free(d_audio->packet);
     d_audio->packet = NULL;
+    if (q)
+        dec_queue_unlock_decoder(q);
 }
 
 static void fix_audio_pts(struct dec_audio *da)
@@ -192,7 +210,7 @@ static void fix_audio_pts(struct dec_audio *da)
         da->pts += da->current_frame->samples / (double)da->current_frame->rate;
 }
 
-void audio_work(struct dec_audio *da)
+static void decode_step(struct dec_audio *da)
 {
     if (da->current_frame)
         return;
@@ -225,14 +243,60 @@ void audio_work(struct dec_audio *da)
     fix_audio_pts(da);
 }
 
+static double frame_secs(void *ptr)
+{
+    struct mp_audio *frame = ptr;
+    return frame->rate > 0 ? frame->samples / (double)frame->rate : 0;
+}
+
+static int thread_decode(void *ctx, void **out_frame)
+{
+    struct dec_audio *da = ctx;
+    decode_step(da);
+    *out_frame = da->current_frame;
+    da->current_frame = NULL;
+    return da->current_state;
+}
+
+static void start_thread(struct dec_audio *d_audio)
+{
+    double max_secs = d_audio->opts->ad_queue_secs;
+    d_audio->queue = dec_queue_create(&(struct dec_queue_params){
+        .name = "ad",
+        .max_size = max_secs,
+        .decode = thread_decode,
+        .frame_size = frame_secs,
+        .ctx = d_audio,
+        .wakeup = d_audio->wakeup,
+        .wakeup_ctx = d_audio->wakeup_ctx,
+    });
+    if (!d_audio->queue) {
+        MP_WARN(d_audio, "Could not start decoder thread.\n");
+        return;
+    }
+    MP_VERBOSE(d_audio, "Decoding on a separate thread (queue: %f secs).\n",
+               max_secs);
+}
+
+void audio_work(struct dec_audio *da)
+{
+    if (da->queue) {
+        dec_queue_work(da->queue);
+    } else {
+        decode_step(da);
+    }
+}
+
 // Fetch an audio frame decoded with audio_work(). Returns one of:
 //  DATA_OK:    *out_frame is set to a new image
-//  DATA_WAIT:  waiting for demuxer; will receive a wakeup signal
+//  DATA_WAIT:  waiting for demuxer or decoder thread; will receive a wakeup
 //  DATA_EOF:   end of file, no more frames to be expected
 //  DATA_AGAIN: dropped frame or something similar
 int audio_get_frame(struct dec_audio *da, struct mp_audio **out_frame)
 {
     *out_frame = NULL;
+    if (da->queue)
+        return dec_queue_get_frame(da->queue, (void **)out_frame);
     if (da->current_frame) {
         *out_frame = da->current_frame;
         da->current_frame = NULL;
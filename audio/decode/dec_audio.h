@@ -36,6 +36,11 @@ struct dec_audio {
 
     bool try_spdif;
 
+    // Called (from any thread) when the decoder thread has a new frame or
+    // reached EOF. Must be set before audio_init_best_codec().
+    void (*wakeup)(void *ctx);
+    void *wakeup_ctx;
+
     // For free use by the ad_driver
     void *priv;
 
@@ -45,6 +50,9 @@ struct dec_audio {
     struct demux_packet *packet;
     struct mp_audio *current_frame;
     int current_state;
+
+    // Decoder thread and its output queue (NULL if decoding synchronously).
+    struct dec_queue *queue;
 };
 
 struct mp_decoder_list *audio_decoder_list(void);
@@ -32,12 +32,14 @@
 #include "mpv_talloc.h"
 #include "common/msg.h"
 #include "common/global.h"
+#include "osdep/atomics.h"
 #include "osdep/threads.h"
 
 #include "stream/stream.h"
 #include "demux.h"
 #include "stheader.h"
 #include "cue.h"
+#include "probe_cache.h"
 
 // Demuxer list
 extern const struct demuxer_desc demuxer_desc_edl;
@@ -94,6 +96,10 @@ struct demux_internal {
     pthread_cond_t wakeup;
     pthread_t thread;
 
+    // Byte position of the last packet returned to the user, or -1. Updated
+    // by the threads reading packets, without holding the lock.
+    atomic_llong filepos;
+
     // -- All the following fields are protected by lock.
 
     bool thread_paused;
@@ -116,6 +122,9 @@ struct demux_internal {
     double min_secs;
     int max_packs;
     int max_bytes;
+    int64_t max_bytes_passive;  // per-stream budget for passive streams
+    bool seekable_cache;        // keep already read packets for seeking
+    int64_t max_bytes_bw;       // byte budget for already read packets
 
     bool tracks_switched;       // thread needs to inform demuxer of this
 
@@ -140,6 +149,9 @@ struct demux_internal {
     char *stream_base_filename;
 };
 
+// Number of packets the lock-free handoff queue can hold (power of 2).
+#define FAST_QUEUE_SIZE 32
+
 struct demux_stream {
     struct demux_internal *in;
     enum stream_type type;
@@ -150,20 +162,44 @@ struct demux_stream {
                             // read (like subtitles)
     bool eof;               // end of demuxed stream? (true if all buffer empty)
     bool refreshing;
-    size_t packs;           // number of packets in buffer
-    size_t bytes;           // total bytes of packets in buffer
+    size_t packs;           // number of packets in buffer (after reader_head)
+    size_t bytes;           // total memory of packets in buffer (same; as
+                            // estimated by demux_packet_estimate_total_size)
+    size_t bw_bytes;        // total memory of already read packets (before
+                            // reader_head; only with seekable_cache)
     double base_ts;         // timestamp of the last packet returned to decoder
     double last_ts;         // timestamp of the last packet added to queue
     double last_br_ts;      // timestamp of last packet bitrate was calculated
     size_t last_br_bytes;   // summed packet sizes since last bitrate calculation
     double bitrate;
     int64_t last_pos;
+    // The queue contains all packets from head to tail. Packets before
+    // reader_head were already returned to the decoder, and are kept only
+    // if the seekable cache is enabled.
     struct demux_packet *head;
     struct demux_packet *tail;
+    struct demux_packet *reader_head;   // next packet to return to decoder
+    // Time range covered by the queue that can be seeked to, i.e. starting
+    // with the first keyframe (NOPTS if the range is empty).
+    double seek_start, seek_end;
 
     // for closed captions (demuxer_feed_caption)
     struct sh_stream *cc;
 
+    // Lock-free handoff of the next packets to the user thread. Filled from
+    // reader_head by whoever holds in->lock (single producer). Packets are
+    // removed without any lock, either by the thread reading packets, or on
+    // flushes and seeks; concurrent removals are resolved by the CAS on
+    // fast_rd. Packets in it were already dequeued, and come before
+    // reader_head. fast_ts/fast_size are written only by the producer, and
+    // describe the packet in the same slot. fast_bytes is the sum of
+    // fast_size over the queued packets.
+    struct demux_packet *fast[FAST_QUEUE_SIZE];
+    double fast_ts[FAST_QUEUE_SIZE];
+    size_t fast_size[FAST_QUEUE_SIZE];
+    atomic_uint fast_wr, fast_rd;
+    atomic_ullong fast_bytes;
+
 };
 
 // Return "a", or if that is NOPTS, return "def".
@@ -177,19 +213,55 @@ struct demux_stream {
 static void demuxer_sort_chapters(demuxer_t *demuxer);
 static void *demux_thread(void *pctx);
 static void update_cache(struct demux_internal *in);
+static void evict_passive_packets(struct demux_stream *ds);
+static void fill_fast_queue(struct demux_stream *ds);
+static struct demux_packet *pop_fast_queue(struct demux_stream *ds);
+
+static unsigned int fast_queue_count(struct demux_stream *ds)
+{
+    return atomic_load(&ds->fast_wr) - atomic_load(&ds->fast_rd);
+}
+
+// Packets in the fast queue were already dequeued (which updates base_ts and
+// the byte counts), but not returned to the user yet. Return the base_ts that
+// counts them as still queued, i.e. the timestamp of the oldest one, and add
+// their total size to *bytes (if not NULL). Must be called locked. The result
+// can be slightly outdated if the user thread removes packets concurrently.
+static double fast_queue_base_ts(struct demux_stream *ds, size_t *bytes)
+{
+    double base_ts = MP_NOPTS_VALUE;
+    unsigned int rd = atomic_load(&ds->fast_rd);
+    if (rd != atomic_load(&ds->fast_wr))
+        base_ts = ds->fast_ts[rd % FAST_QUEUE_SIZE];
+    if (bytes)
+        *bytes += atomic_load(&ds->fast_bytes);
+    return PTS_OR_DEF(base_ts, ds->base_ts);
+}
+
+// Timestamp used to determine the seekable range of a packet queue.
+static double packet_seek_ts(struct demux_packet *dp)
+{
+    return dp->pts == MP_NOPTS_VALUE ? dp->dts : dp->pts;
+}
 
 // called locked
 static void ds_flush(struct demux_stream *ds)
 {
+    struct demux_packet *pkt;
+    while ((pkt = pop_fast_queue(ds)))
+        free_demux_packet(pkt);
+
     demux_packet_t *dp = ds->head;
     while (dp) {
         demux_packet_t *dn = dp->next;
         free_demux_packet(dp);
         dp = dn;
     }
-    ds->head = ds->tail = NULL;
+    ds->head = ds->tail = ds->reader_head = NULL;
     ds->packs = 0;
     ds->bytes = 0;
+    ds->bw_bytes = 0;
+    ds->seek_start = ds->seek_end = MP_NOPTS_VALUE;
     ds->last_ts = ds->base_ts = ds->last_br_ts = MP_NOPTS_VALUE;
     ds->last_br_bytes = 0;
     ds->bitrate = -1;
@@ -287,6 +359,14 @@ int demux_get_num_stream(struct demuxer *demuxer)
     return r;
 }
 
+// Byte position of the last packet returned to the user, or -1 if unknown.
+// Use this instead of accessing demuxer->filepos, which is updated by the
+// threads reading packets.
+int64_t demux_get_filepos(struct demuxer *demuxer)
+{
+    return atomic_load(&demuxer->in->filepos);
+}
+
 void free_demuxer(demuxer_t *demuxer)
 {
     if (!demuxer)
@@ -416,7 +496,7 @@ void demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
 
     ds->last_pos = dp->pos;
     ds->packs++;
-    ds->bytes += dp->len;
+    ds->bytes += demux_packet_estimate_total_size(dp);
     if (ds->tail) {
         // next packet in stream
         ds->tail->next = dp;
@@ -425,6 +505,8 @@ void demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
         // first packet in stream
         ds->head = ds->tail = dp;
     }
+    if (!ds->reader_head)
+        ds->reader_head = dp;
 
     // obviously not true anymore
     ds->eof = false;
@@ -441,13 +523,28 @@ void demux_add_packet(struct sh_stream *stream, demux_packet_t *dp)
     if (ds->base_ts == MP_NOPTS_VALUE)
         ds->base_ts = ds->last_ts;
 
+    double seek_ts = packet_seek_ts(dp);
+    if (dp->keyframe && ds->seek_start == MP_NOPTS_VALUE)
+        ds->seek_start = seek_ts;
+    if (ds->seek_start != MP_NOPTS_VALUE)
+        ds->seek_end = MP_PTS_MAX(ds->seek_end, seek_ts);
+
     MP_DBG(in, "append packet to %s: size=%d pts=%f dts=%f pos=%"PRIi64" "
            "[num=%zd size=%zd]\n", stream_type_name(stream->type),
            dp->len, dp->pts, dp->dts, dp->pos, ds->packs, ds->bytes);
 
-    if (ds->in->wakeup_cb && !ds->head->next)
+    // Only wake up the user if it possibly ran out of packets, not for every
+    // packet added while it still has some to read.
+    bool was_empty = !ds->reader_head->next && !fast_queue_count(ds);
+    if (in->threading && ds->active)
+        fill_fast_queue(ds);
+
+    if (ds->in->wakeup_cb && was_empty)
         ds->in->wakeup_cb(ds->in->wakeup_cb_ctx);
     pthread_cond_signal(&in->wakeup);
+
+    if (!ds->active)
+        evict_passive_packets(ds);
     pthread_mutex_unlock(&in->lock);
 }
 
@@ -465,12 +562,14 @@ static bool read_packet(struct demux_internal *in)
     for (int n = 0; n < in->num_streams; n++) {
         struct demux_stream *ds = in->streams[n]->ds;
         active |= ds->active;
-        read_more |= ds->active && !ds->head;
+        read_more |= ds->active && !ds->reader_head && !fast_queue_count(ds);
         packs += ds->packs;
         bytes += ds->bytes;
-        if (ds->active && ds->last_ts != MP_NOPTS_VALUE && in->min_secs > 0 &&
-            ds->last_ts >= ds->base_ts)
-            read_more |= ds->last_ts - ds->base_ts < in->min_secs;
+        double base_ts = fast_queue_base_ts(ds, &bytes);
+        if (ds->active && ds->last_ts != MP_NOPTS_VALUE && in->min_secs > 0) {
+            if (ds->last_ts >= base_ts)
+                read_more |= ds->last_ts - base_ts < in->min_secs;
+        }
     }
     MP_DBG(in, "packets=%zd, bytes=%zd, active=%d, more=%d\n",
            packs, bytes, active, read_more);
@@ -488,7 +587,7 @@ static bool read_packet(struct demux_internal *in)
         }
         for (int n = 0; n < in->num_streams; n++) {
             struct demux_stream *ds = in->streams[n]->ds;
-            ds->eof |= !ds->head;
+            ds->eof |= !ds->reader_head && !fast_queue_count(ds);
         }
         pthread_cond_signal(&in->wakeup);
         return false;
@@ -529,7 +628,9 @@ static void ds_get_packets(struct demux_stream *ds)
     MP_DBG(in, "reading packet for %s\n", t);
     in->eof = false; // force retry
     ds->eof = false;
-    while (ds->selected && !ds->head && !ds->eof) {
+    while (ds->selected && !ds->reader_head && !fast_queue_count(ds) &&
+           !ds->eof)
+    {
         ds->active = true;
         // Note: the following code marks EOF if it can't continue
         if (in->threading) {
@@ -555,7 +656,7 @@ static void start_refreshing(struct demux_internal *in)
     for (int n = 0; n < in->num_streams; n++) {
         struct demux_stream *ds = in->streams[n]->ds;
         if (ds->type == STREAM_VIDEO || ds->type == STREAM_AUDIO)
-            start_ts = MP_PTS_MIN(start_ts, ds->base_ts);
+            start_ts = MP_PTS_MIN(start_ts, fast_queue_base_ts(ds, NULL));
     }
 
     if (start_ts == MP_NOPTS_VALUE || !demux->desc->seek || !demux->seekable ||
@@ -657,18 +758,134 @@ static void *demux_thread(void *pctx)
     return NULL;
 }
 
+// Remove the oldest already read packets until the back buffer fits into
+// the configured budget. Always prunes the stream with the oldest packet, so
+// that the seekable ranges of all streams shrink roughly in sync.
+static void prune_old_packets(struct demux_internal *in)
+{
+    size_t bw_bytes = 0;
+    for (int n = 0; n < in->num_streams; n++)
+        bw_bytes += in->streams[n]->ds->bw_bytes;
+
+    while (bw_bytes > in->max_bytes_bw) {
+        struct demux_stream *earliest = NULL;
+        double earliest_ts = MP_NOPTS_VALUE;
+        for (int n = 0; n < in->num_streams; n++) {
+            struct demux_stream *ds = in->streams[n]->ds;
+            if (ds->head && ds->head != ds->reader_head) {
+                double ts = packet_seek_ts(ds->head);
+                if (!earliest || ts == MP_NOPTS_VALUE ||
+                    (earliest_ts != MP_NOPTS_VALUE && ts < earliest_ts))
+                {
+                    earliest = ds;
+                    earliest_ts = ts;
+                }
+            }
+        }
+        if (!earliest)
+            break;
+
+        struct demux_stream *ds = earliest;
+        struct demux_packet *dp = ds->head;
+        ds->head = dp->next;
+        if (!ds->head)
+            ds->tail = NULL;
+        size_t size = demux_packet_estimate_total_size(dp);
+        ds->bw_bytes -= size;
+        bw_bytes -= size;
+
+        // The seekable range starts with the first keyframe; if that was
+        // removed, it begins with the next one. (Only the packets up to the
+        // next keyframe are visited, so pruning is linear overall. seek_end
+        // stays, as the maximum is practically never in the dropped GOP.)
+        if (dp->keyframe) {
+            ds->seek_start = MP_NOPTS_VALUE;
+            for (struct demux_packet *p = ds->head; p; p = p->next) {
+                double ts = packet_seek_ts(p);
+                if (p->keyframe && ts != MP_NOPTS_VALUE) {
+                    ds->seek_start = ts;
+                    break;
+                }
+            }
+            if (ds->seek_start == MP_NOPTS_VALUE)
+                ds->seek_end = MP_NOPTS_VALUE;
+        }
+
+        free_demux_packet(dp);
+    }
+}
+
+// Drop the oldest unread packets of a passively read stream (selected, but
+// not requested by a decoder) until it fits into the per-stream budget. The
+// demuxer keeps reading for the active streams' readahead, and nothing else
+// would bound the queues of streams nobody reads from. Subtitle streams are
+// exempt: they are read lazily by design, and dropped subtitle packets would
+// be missing later (they're also tiny).
+// Must be called locked, from any thread.
+static void evict_passive_packets(struct demux_stream *ds)
+{
+    struct demux_internal *in = ds->in;
+    if (in->max_bytes_passive <= 0 || ds->bytes <= in->max_bytes_passive ||
+        ds->type == STREAM_SUB)
+        return;
+
+    size_t dropped = 0;
+    while (ds->reader_head && ds->bytes > in->max_bytes_passive) {
+        struct demux_packet *dp = ds->reader_head;
+        size_t size = demux_packet_estimate_total_size(dp);
+        ds->reader_head = dp->next;
+        ds->bytes -= size;
+        ds->packs--;
+        dropped += size;
+        if (in->seekable_cache) {
+            // Treat it like a read packet; prune_old_packets() takes care of it.
+            ds->bw_bytes += size;
+        } else {
+            assert(ds->head == dp);
+            ds->head = dp->next;
+            if (!ds->head)
+                ds->tail = NULL;
+            free_demux_packet(dp);
+        }
+    }
+    if (in->seekable_cache)
+        prune_old_packets(in);
+
+    MP_DBG(in, "dropped %zd bytes from passive %s stream\n", dropped,
+           stream_type_name(ds->type));
+}
+
 static struct demux_packet *dequeue_packet(struct demux_stream *ds)
 {
-    if (!ds->head)
+again:
+    if (!ds->reader_head)
         return NULL;
-    struct demux_packet *pkt = ds->head;
-    ds->head = pkt->next;
-    pkt->next = NULL;
-    if (!ds->head)
-        ds->tail = NULL;
-    ds->bytes -= pkt->len;
+    struct demux_packet *pkt = ds->reader_head;
+    ds->reader_head = pkt->next;
+    size_t size = demux_packet_estimate_total_size(pkt);
+    ds->bytes -= size;
     ds->packs--;
 
+    if (ds->in->seekable_cache) {
+        // Keep the packet in the queue, and return a new reference instead.
+        ds->bw_bytes += size;
+        struct demux_packet *new = demux_copy_packet(pkt);
+        prune_old_packets(ds->in);
+        pkt = new;
+        if (!pkt) {
+            // The packet was consumed anyway; don't report a bogus EOF.
+            MP_ERR(ds->in, "Out of memory, skipping %s packet.\n",
+                   stream_type_name(ds->type));
+            goto again;
+        }
+    } else {
+        assert(ds->head == pkt);
+        ds->head = pkt->next;
+        if (!ds->head)
+            ds->tail = NULL;
+    }
+    pkt->next = NULL;
+
     double ts = pkt->dts == MP_NOPTS_VALUE ? pkt->pts : pkt->dts;
     if (ts != MP_NOPTS_VALUE)
         ds->base_ts = ts;
@@ -689,13 +906,92 @@ static struct demux_packet *dequeue_packet(struct demux_stream *ds)
     }
     ds->last_br_bytes += pkt->len;
 
-    // This implies this function is actually called from "the" user thread.
-    if (pkt->pos >= ds->in->d_user->filepos)
-        ds->in->d_user->filepos = pkt->pos;
+    return pkt;
+}
+
+// Apply the timestamp offset to a dequeued packet. Must be called locked.
+static struct demux_packet *offset_packet(struct demux_stream *ds,
+                                          struct demux_packet *pkt)
+{
+    if (pkt) {
+        pkt->pts = MP_ADD_PTS(pkt->pts, ds->in->ts_offset);
+        pkt->dts = MP_ADD_PTS(pkt->dts, ds->in->ts_offset);
+    }
+    return pkt;
+}
+
+// Move packets from the locked queue to the fast queue, as far as it has
+// space. Must be called locked.
+static void fill_fast_queue(struct demux_stream *ds)
+{
+    unsigned int wr = atomic_load(&ds->fast_wr);
+    while (ds->reader_head && wr - atomic_load(&ds->fast_rd) < FAST_QUEUE_SIZE) {
+        struct demux_packet *pkt = offset_packet(ds, dequeue_packet(ds));
+        if (!pkt)
+            break;
+        int i = wr % FAST_QUEUE_SIZE;
+        ds->fast[i] = pkt;
+        ds->fast_ts[i] = pkt->dts == MP_NOPTS_VALUE ? pkt->pts : pkt->dts;
+        ds->fast_size[i] = demux_packet_estimate_total_size(pkt);
+        atomic_fetch_add(&ds->fast_bytes, ds->fast_size[i]);
+        // Publishes the slot contents to the threads removing packets.
+        atomic_store(&ds->fast_wr, ++wr);
+    }
+}
+
+// Remove the oldest packet from the fast queue. Doesn't need the lock, and
+// can be called from multiple threads at once.
+static struct demux_packet *pop_fast_queue(struct demux_stream *ds)
+{
+    unsigned int rd = atomic_load(&ds->fast_rd);
+    while (rd != atomic_load(&ds->fast_wr)) {
+        // The slot can be reused by the producer only after fast_rd moved
+        // past it, in which case the CAS fails and the values are discarded.
+        int i = rd % FAST_QUEUE_SIZE;
+        struct demux_packet *pkt = ds->fast[i];
+        size_t size = ds->fast_size[i];
+        if (atomic_compare_exchange_strong(&ds->fast_rd, &rd, rd + 1)) {
+            atomic_fetch_add(&ds->fast_bytes, -(unsigned long long)size);
+            return pkt;
+        }
+    }
+    return NULL;
+}
+
+// Final adjustments to a packet returned to the user. Doesn't need the lock.
+static struct demux_packet *finish_packet(struct demux_stream *ds,
+                                          struct demux_packet *pkt)
+{
+    if (!pkt)
+        return NULL;
+
+    long long pos = atomic_load(&ds->in->filepos);
+    while (pkt->pos >= pos &&
+           !atomic_compare_exchange_strong(&ds->in->filepos, &pos, pkt->pos))
+        ;
+
+    return pkt;
+}
 
-    pkt->pts = MP_ADD_PTS(pkt->pts, ds->in->ts_offset);
-    pkt->dts = MP_ADD_PTS(pkt->dts, ds->in->ts_offset);
+// Return the next packet from the fast queue, or NULL if it's empty. Doesn't
+// need the lock.
+static struct demux_packet *read_fast_queue(struct demux_stream *ds)
+{
+    return finish_packet(ds, pop_fast_queue(ds));
+}
 
+// Return the next packet for the user thread. Packets already in the fast
+// queue come first. Since the lock is held anyway, refill the fast queue, so
+// that the following reads don't need to take it.
+// Must be called locked.
+static struct demux_packet *dequeue_next_packet(struct demux_stream *ds)
+{
+    struct demux_packet *pkt = pop_fast_queue(ds);
+    if (!pkt)
+        pkt = offset_packet(ds, dequeue_packet(ds));
+    pkt = finish_packet(ds, pkt);
+    if (ds->in->threading && ds->active)
+        fill_fast_queue(ds);
     return pkt;
 }
 
@@ -722,10 +1018,13 @@ struct demux_packet *demux_read_packet(struct sh_stream *sh)
     struct demux_stream *ds = sh ? sh->ds : NULL;
     struct demux_packet *pkt = NULL;
     if (ds) {
+        pkt = read_fast_queue(ds);
+        if (pkt)
+            return pkt;
         pthread_mutex_lock(&ds->in->lock);
         if (!use_lazy_subtitle_reading(ds))
             ds_get_packets(ds);
-        pkt = dequeue_packet(ds);
+        pkt = dequeue_next_packet(ds);
         pthread_cond_signal(&ds->in->wakeup); // possibly read more
         pthread_mutex_unlock(&ds->in->lock);
     }
@@ -744,6 +1043,8 @@ struct demux_packet *demux_read_packet(struct sh_stream *sh)
 // Note: when reading interleaved subtitles, the demuxer won't try to forcibly
 // read ahead to get the next subtitle packet (as the next packet could be
 // minutes away). In this situation, this function will just return -1.
+// If packets are available in the fast queue, this doesn't take the lock (the
+// demuxer thread is woken up only once the fast queue runs empty).
 int demux_read_packet_async(struct sh_stream *sh, struct demux_packet **out_pkt)
 {
     struct demux_stream *ds = sh ? sh->ds : NULL;
@@ -751,8 +1052,11 @@ int demux_read_packet_async(struct sh_stream *sh, struct demux_packet **out_pkt)
     *out_pkt = NULL;
     if (ds) {
         if (ds->in->threading) {
+            *out_pkt = read_fast_queue(ds);
+            if (*out_pkt)
+                return 1;
             pthread_mutex_lock(&ds->in->lock);
-            *out_pkt = dequeue_packet(ds);
+            *out_pkt = dequeue_next_packet(ds);
             if (use_lazy_subtitle_reading(ds)) {
                 r = *out_pkt ? 1 : -1;
             } else {
@@ -775,9 +1079,12 @@ bool demux_has_packet(struct sh_stream *sh)
 {
     bool has_packet = false;
     if (sh) {
-        pthread_mutex_lock(&sh->ds->in->lock);
-        has_packet = sh->ds->head;
-        pthread_mutex_unlock(&sh->ds->in->lock);
+        has_packet = fast_queue_count(sh->ds);
+        if (!has_packet) {
+            pthread_mutex_lock(&sh->ds->in->lock);
+            has_packet = sh->ds->reader_head;
+            pthread_mutex_unlock(&sh->ds->in->lock);
+        }
     }
     return has_packet;
 }
@@ -792,7 +1099,7 @@ struct demux_packet *demux_read_any_packet(struct demuxer *demuxer)
         for (int n = 0; n < in->num_streams; n++) {
             struct sh_stream *sh = in->streams[n];
             sh->ds->active = sh->ds->selected; // force read_packet() to read
-            struct demux_packet *pkt = dequeue_packet(sh->ds);
+            struct demux_packet *pkt = dequeue_next_packet(sh->ds);
             if (pkt)
                 return pkt;
         }
@@ -1065,13 +1372,21 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .min_secs = demuxer->opts->demuxer_min_secs,
         .max_packs = demuxer->opts->demuxer_max_packs,
         .max_bytes = demuxer->opts->demuxer_max_bytes,
+        .max_bytes_passive = demuxer->opts->demuxer_max_passive_bytes,
+        .max_bytes_bw = demuxer->opts->demuxer_max_back_bytes,
     };
     pthread_mutex_init(&in->lock, NULL);
+    atomic_store(&in->filepos, -1);
     pthread_cond_init(&in->wakeup, NULL);
 
     if (stream->uncached_stream)
         in->min_secs = MPMAX(in->min_secs, demuxer->opts->demuxer_min_secs_cache);
 
+    int seekable_cache = demuxer->opts->demuxer_seekable_cache;
+    if (seekable_cache < 0)
+        seekable_cache = !!stream->uncached_stream;
+    in->seekable_cache = seekable_cache && in->max_bytes_bw > 0;
+
     *in->d_thread = *demuxer;
     *in->d_buffer = *demuxer;
 
@@ -1121,6 +1436,65 @@ static const int d_normal[]  = {DEMUX_CHECK_NORMAL, DEMUX_CHECK_UNSAFE, -1};
 static const int d_request[] = {DEMUX_CHECK_REQUEST, -1};
 static const int d_force[]   = {DEMUX_CHECK_FORCE, -1};
 
+static void get_stream_layout(struct demuxer *demuxer, char *buf, size_t size)
+{
+    int num = demux_get_num_stream(demuxer);
+    int len = MPMIN(num, (int)size - 1);
+    for (int n = 0; n < len; n++)
+        buf[n] = stream_type_name(demux_get_stream(demuxer, n)->type)[0];
+    buf[len] = '\0';
+}
+
+// Try the demuxer which opened the same file last time, at the normal check
+// levels. If the demuxer supports it, it uses the cached information to skip
+// its own probing.
+static struct demuxer *open_from_probe_cache(struct mpv_global *global,
+                                             struct mp_log *log,
+                                             struct stream *stream,
+                                             struct demuxer_params *params,
+                                             struct demux_probe_info *cached)
+{
+    struct demux_probe_info *info = params->probe_info;
+    if (!demux_probe_cache_lookup(global, stream, info))
+        return NULL;
+    *cached = *info;
+
+    for (int n = 0; demuxer_list[n]; n++) {
+        const struct demuxer_desc *desc = demuxer_list[n];
+        if (strcmp(desc->name, info->demuxer) != 0)
+            continue;
+        mp_verbose(log, "Using cached probe result: %s %s\n", info->demuxer,
+                   info->lavf_format);
+        for (int pass = 0; d_normal[pass] != -1; pass++) {
+            struct demuxer *demuxer =
+                open_given_type(global, log, desc, stream, params, d_normal[pass]);
+            if (!demuxer)
+                continue;
+            get_stream_layout(demuxer, info->layout, sizeof(info->layout));
+            if (cached->probe_bytes &&
+                strcmp(cached->layout, info->layout) != 0)
+            {
+                // The limited probe budget might have missed streams.
+                mp_verbose(log, "Stream layout changed (%s -> %s), reopening "
+                           "without probe limit.\n", cached->layout,
+                           info->layout);
+                free_demuxer(demuxer);
+                info->probe_bytes = 0;
+                demuxer = open_given_type(global, log, desc, stream, params,
+                                          d_normal[pass]);
+                if (!demuxer)
+                    break;
+                get_stream_layout(demuxer, info->layout, sizeof(info->layout));
+            }
+            return demuxer;
+        }
+        break;
+    }
+
+    mp_verbose(log, "Cached probe result didn't work.\n");
+    return NULL;
+}
+
 // params can be NULL
 struct demuxer *demux_open(struct stream *stream, struct demuxer_params *params,
                            struct mpv_global *global)
@@ -1131,6 +1505,13 @@ struct demuxer *demux_open(struct stream *stream, struct demuxer_params *params,
     struct demuxer *demuxer = NULL;
     char *force_format = params ? params->force_format : NULL;
 
+    // Internal copy, so that probe results can be passed to the demuxer.
+    struct demux_probe_info probe_info = {0}, cached_info = {0};
+    struct demuxer_params p = {0};
+    if (params)
+        p = *params;
+    p.probe_info = &probe_info;
+
     if (!force_format)
         force_format = stream->demuxer;
 
@@ -1150,16 +1531,23 @@ struct demuxer *demux_open(struct stream *stream, struct demuxer_params *params,
         }
     }
 
+    if (!check_desc) {
+        demuxer = open_from_probe_cache(global, log, stream, &p, &cached_info);
+        if (demuxer)
+            goto done;
+        probe_info = (struct demux_probe_info){0};
+    }
+
     // Test demuxers from first to last, one pass for each check_levels[] entry
     for (int pass = 0; check_levels[pass] != -1; pass++) {
         enum demux_check level = check_levels[pass];
         for (int n = 0; demuxer_list[n]; n++) {
             const struct demuxer_desc *desc = demuxer_list[n];
             if (!check_desc || desc == check_desc) {
-                demuxer = open_given_type(global, log, desc, stream, params, level);
+                demuxer = open_given_type(global, log, desc, stream, &p, level);
                 if (demuxer) {
-                    talloc_steal(demuxer, log);
-                    log = NULL;
+                    get_stream_layout(demuxer, probe_info.layout,
+                                      sizeof(probe_info.layout));
                     goto done;
                 }
             }
@@ -1167,6 +1555,25 @@ struct demuxer *demux_open(struct stream *stream, struct demuxer_params *params,
     }
 
 done:
+    if (demuxer) {
+        talloc_steal(demuxer, log);
+        log = NULL;
+        if (!check_desc) {
+            snprintf(probe_info.demuxer, sizeof(probe_info.demuxer), "%s",
+                     demuxer->desc->name);
+            // Never shrink the probe budget: a smaller amount of data being
+            // read this time doesn't mean less would be enough next time.
+            if (strcmp(probe_info.demuxer, cached_info.demuxer) == 0)
+                probe_info.probe_bytes = MPMAX(probe_info.probe_bytes,
+                                               cached_info.probe_bytes);
+            bool changed =
+                strcmp(probe_info.demuxer, cached_info.demuxer) ||
+                strcmp(probe_info.lavf_format, cached_info.lavf_format) ||
+                strcmp(probe_info.layout, cached_info.layout) ||
+                probe_info.probe_bytes != cached_info.probe_bytes;
+            demux_probe_cache_store(global, stream, &probe_info, changed);
+        }
+    }
     talloc_free(log);
     return demuxer;
 }
@@ -1207,7 +1614,7 @@ static void flush_locked(demuxer_t *demuxer)
     demuxer->in->eof = false;
     demuxer->in->last_eof = false;
     demuxer->in->idle = true;
-    demuxer->filepos = -1; // implicitly synchronized
+    atomic_store(&demuxer->in->filepos, -1);
 }
 
 // clear the packet queues
@@ -1218,6 +1625,96 @@ void demux_flush(demuxer_t *demuxer)
     pthread_mutex_unlock(&demuxer->in->lock);
 }
 
+// Find the packet a seek to pts within the cached range would start with.
+static struct demux_packet *find_seek_target(struct demux_stream *ds,
+                                             double pts, int flags)
+{
+    struct demux_packet *target = NULL;
+    struct demux_packet *before = NULL; // last keyframe <= pts
+    for (struct demux_packet *dp = ds->head; dp; dp = dp->next) {
+        double ts = packet_seek_ts(dp);
+        if (!dp->keyframe || ts == MP_NOPTS_VALUE)
+            continue;
+        if (ts <= pts) {
+            before = dp;
+        } else {
+            if (!before || (flags & SEEK_FORWARD))
+                target = dp;
+            break;
+        }
+    }
+    if (before && !(target && (flags & SEEK_FORWARD)))
+        target = before;
+    return target;
+}
+
+// Try to execute the seek by moving the reader position within the already
+// demuxed packets, without touching the underlying demuxer. Returns false
+// if the target is outside of the cached range.
+// must be called locked
+static bool try_seek_cache(struct demux_internal *in, double pts, int flags)
+{
+    if (!in->seekable_cache || (flags & SEEK_FACTOR) ||
+        !(flags & SEEK_ABSOLUTE) || in->d_user->ts_resets_possible)
+        return false;
+
+    // Sparse subtitle streams are not used to determine the range.
+    bool any = false;
+    for (int n = 0; n < in->num_streams; n++) {
+        struct demux_stream *ds = in->streams[n]->ds;
+        if (!ds->selected || ds->type == STREAM_SUB)
+            continue;
+        if (ds->seek_start == MP_NOPTS_VALUE || pts < ds->seek_start ||
+            pts > ds->seek_end)
+            return false;
+        any = true;
+    }
+    if (!any)
+        return false;
+
+    MP_VERBOSE(in, "seek to %f served from demuxer cache\n", pts);
+
+    for (int n = 0; n < in->num_streams; n++) {
+        struct demux_stream *ds = in->streams[n]->ds;
+
+        // These are references to packets still in the queue.
+        struct demux_packet *pkt;
+        while ((pkt = pop_fast_queue(ds)))
+            free_demux_packet(pkt);
+
+        if (!ds->selected)
+            continue;
+
+        ds->reader_head = find_seek_target(ds, pts, flags);
+
+        // Recompute forward/backward accounting.
+        ds->packs = ds->bytes = ds->bw_bytes = 0;
+        bool fw = false;
+        for (struct demux_packet *dp = ds->head; dp; dp = dp->next) {
+            fw |= dp == ds->reader_head;
+            size_t size = demux_packet_estimate_total_size(dp);
+            if (fw) {
+                ds->packs++;
+                ds->bytes += size;
+            } else {
+                ds->bw_bytes += size;
+            }
+        }
+
+        ds->base_ts = ds->last_br_ts = MP_NOPTS_VALUE;
+        if (ds->reader_head) {
+            struct demux_packet *dp = ds->reader_head;
+            ds->base_ts = dp->dts == MP_NOPTS_VALUE ? dp->pts : dp->dts;
+            ds->eof = false;
+        }
+        ds->last_br_bytes = 0;
+        ds->bitrate = -1;
+    }
+
+    atomic_store(&in->filepos, -1);
+    return true;
+}
+
 int demux_seek(demuxer_t *demuxer, double rel_seek_secs, int flags)
 {
     struct demux_internal *in = demuxer->in;
@@ -1249,15 +1746,19 @@ int demux_seek(demuxer_t *demuxer, double rel_seek_secs, int flags)
     MP_VERBOSE(in, "queuing seek to %f%s\n", rel_seek_secs,
                in->seeking ? " (cascade)" : "");
 
-    flush_locked(demuxer);
-    in->seeking = true;
-    in->seek_flags = flags;
-    in->seek_pts = rel_seek_secs;
+    double pts = rel_seek_secs;
     if ((flags & SEEK_ABSOLUTE) && !(flags & SEEK_FACTOR))
-        in->seek_pts = MP_ADD_PTS(in->seek_pts, -in->ts_offset);
+        pts = MP_ADD_PTS(pts, -in->ts_offset);
 
-    if (!in->threading)
-        execute_seek(in);
+    if (in->seeking || !try_seek_cache(in, pts, flags)) {
+        flush_locked(demuxer);
+        in->seeking = true;
+        in->seek_flags = flags;
+        in->seek_pts = pts;
+
+        if (!in->threading)
+            execute_seek(in);
+    }
 
     pthread_cond_signal(&in->wakeup);
     pthread_mutex_unlock(&in->lock);
@@ -1500,11 +2001,19 @@ static int cached_demux_control(struct demux_internal *in, int cmd, void *arg)
         int num_packets = 0;
         for (int n = 0; n < in->num_streams; n++) {
             struct demux_stream *ds = in->streams[n]->ds;
+            size_t fast_bytes = 0;
+            double base_ts = fast_queue_base_ts(ds, &fast_bytes);
+            r->fw_bytes += ds->bytes + fast_bytes;
+            r->bw_bytes += ds->bw_bytes;
+            // With the seekable cache, dequeued packets count as already read.
+            if (in->seekable_cache)
+                r->bw_bytes -= MPMIN(ds->bw_bytes, fast_bytes);
             if (ds->active) {
-                r->underrun |= !ds->head && !ds->eof;
-                r->ts_range[0] = MP_PTS_MAX(r->ts_range[0], ds->base_ts);
+                r->underrun |= !ds->reader_head && !fast_queue_count(ds) &&
+                               !ds->eof;
+                r->ts_range[0] = MP_PTS_MAX(r->ts_range[0], base_ts);
                 r->ts_range[1] = MP_PTS_MIN(r->ts_range[1], ds->last_ts);
-                num_packets += ds->packs;
+                num_packets += ds->packs + fast_queue_count(ds);
             }
         }
         r->idle = (in->idle && !r->underrun) || r->eof;
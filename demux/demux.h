@@ -43,12 +43,24 @@ enum demux_ctrl {
     DEMUXER_CTRL_STREAM_CTRL,
     DEMUXER_CTRL_GET_READER_STATE,
     DEMUXER_CTRL_GET_BITRATE_STATS, // double[STREAM_TYPE_COUNT]
+    DEMUXER_CTRL_PLAYLIST_UPDATE,   // struct demux_ctrl_playlist_update*
 };
 
 struct demux_ctrl_reader_state {
     bool eof, underrun, idle;
     double ts_range[2]; // start, end
     double ts_duration;
+    int64_t fw_bytes;       // memory used by queued packets (all streams)
+    int64_t bw_bytes;       // same for already read packets (seekable cache)
+};
+
+// For playlists which are still being read (see demuxer_params.playlist_async).
+struct demux_ctrl_playlist_update {
+    struct playlist *pl;    // newly read entries are appended to this
+    // Called (from a foreign thread) if new entries become available.
+    void (*wakeup_cb)(void *ctx);
+    void *wakeup_ctx;
+    bool done;              // set if all entries were read
 };
 
 struct demux_ctrl_stream_ctrl {
@@ -164,14 +176,19 @@ struct demuxer_params {
     int stream_flags;
     bool allow_capture;
     bool disable_cache;
+    // Allow returning a playlist that is still being read in the background;
+    // the rest is retrieved with DEMUXER_CTRL_PLAYLIST_UPDATE.
+    bool playlist_async;
     // result
     bool demuxer_failed;
+    // -- internal, set by demux_open() during open()
+    struct demux_probe_info *probe_info; // cached hint / new result
 };
 
 typedef struct demuxer {
     const demuxer_desc_t *desc; ///< Demuxer description structure
     const char *filetype; // format name when not identified by demuxer (libavformat)
-    int64_t filepos;  // input stream current pos.
+    int64_t filepos;  // input stream current pos. (see demux_get_filepos())
     char *filename;  // same as stream->url
     bool seekable;
     bool partially_seekable; // implies seekable=true
@@ -247,6 +264,7 @@ struct demux_packet *demux_read_any_packet(struct demuxer *demuxer);
 
 struct sh_stream *demux_get_stream(struct demuxer *demuxer, int index);
 int demux_get_num_stream(struct demuxer *demuxer);
+int64_t demux_get_filepos(struct demuxer *demuxer);
 
 struct sh_stream *demux_alloc_sh_stream(enum stream_type type);
 void demux_add_sh_stream(struct demuxer *demuxer, struct sh_stream *sh);
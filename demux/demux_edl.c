@@ -133,37 +133,136 @@ error:
     return NULL;
 }
 
-static struct demuxer *open_source(struct timeline *tl, char *filename)
+struct source_open {
+    struct timeline *tl;
+    char *filename;
+    bool open;              // open the file to resolve its metadata
+    bool keep;              // leave it open after loading the timeline
+    // Results, set by open_source_job().
+    struct demuxer *demux;  // only set if keep is set
+    bool opened;
+    double start_time;
+    double length;          // with start_time added; -1 if unknown
+    struct demux_chapter *chapters;
+    int num_chapters;
+};
+
+// return length of the source in seconds, or -1 if unknown
+static double source_get_length(struct demuxer *demuxer)
 {
-    for (int n = 0; n < tl->num_sources; n++) {
-        struct demuxer *d = tl->sources[n];
-        if (strcmp(d->stream->url, filename) == 0)
-            return d;
+    double time;
+    // <= 0 means DEMUXER_CTRL_NOTIMPL or DEMUXER_CTRL_DONTKNOW
+    if (demux_control(demuxer, DEMUXER_CTRL_GET_TIME_LENGTH, &time) <= 0)
+        time = -1;
+    return time;
+}
+
+// Open the file, and copy everything the timeline needs from it. If the file
+// doesn't have to stay open, close it right away, so that loading a long EDL
+// doesn't hold all files open at once.
+static void open_source_job(void *ctx)
+{
+    struct source_open *job = ctx;
+    struct timeline *tl = job->tl;
+    if (!job->open || mp_cancel_test(tl->cancel))
+        return;
+    struct demuxer *d = demux_open_url(job->filename, NULL, tl->cancel,
+                                       tl->global);
+    if (!d)
+        return;
+    job->opened = true;
+    job->start_time = d->start_time;
+    job->length = source_get_length(d);
+    if (job->length > 0)
+        job->length += d->start_time;
+    job->chapters = talloc_array(NULL, struct demux_chapter, d->num_chapters);
+    for (int n = 0; n < d->num_chapters; n++) {
+        job->chapters[n] = (struct demux_chapter) {
+            .pts = d->chapters[n].pts,
+            .metadata = mp_tags_dup(job->chapters, d->chapters[n].metadata),
+        };
     }
-    struct demuxer *d = demux_open_url(filename, NULL, tl->cancel, tl->global);
-    if (d) {
-        MP_TARRAY_APPEND(tl, tl->sources, tl->num_sources, d);
+    job->num_chapters = d->num_chapters;
+    if (job->keep) {
+        job->demux = d;
     } else {
-        MP_ERR(tl, "EDL: Could not open source file '%s'.\n", filename);
+        free_demuxer_and_stream(d);
+    }
+}
+
+static int find_source(struct timeline *tl, char *filename)
+{
+    for (int n = 0; n < tl->num_sources; n++) {
+        if (strcmp(tl->source_urls[n], filename) == 0)
+            return n;
     }
-    return d;
+    return -1;
 }
 
-static double demuxer_chapter_time(struct demuxer *demuxer, int n)
+// Open the files referenced by the parts concurrently. Each distinct file is
+// opened only once. If the timeline will use lazy sources, only the sources of
+// the first 2 parts stay open; the others are closed as soon as they were
+// read, and are not opened at all if their parts set start and length.
+// Returns the source info, indexed by source index (the entries for sources
+// which were added before are zeroed).
+static struct source_open *open_sources(struct timeline *tl,
+                                        struct tl_parts *parts)
 {
-    if (n < 0 || n >= demuxer->num_chapters)
+    // All sources can be reopened by URL, which allows closing them while
+    // they're not needed.
+    tl->source_urls = talloc_array(tl, char *, tl->num_sources);
+    for (int n = 0; n < tl->num_sources; n++)
+        tl->source_urls[n] = talloc_strdup(tl, tl->sources[n]->stream->url);
+
+    int base = tl->num_sources;
+    struct source_open *jobs = talloc_zero_array(NULL, struct source_open, base);
+    int num_jobs = base;
+    for (int n = 0; n < parts->num_parts; n++) {
+        char *filename = parts->parts[n].filename;
+        if (find_source(tl, filename) < 0) {
+            struct source_open job = {tl, filename, .length = -1};
+            MP_TARRAY_APPEND(NULL, jobs, num_jobs, job);
+            int num_urls = tl->num_sources;
+            MP_TARRAY_APPEND(tl, tl->source_urls, num_urls,
+                             talloc_strdup(tl, filename));
+            MP_TARRAY_APPEND(tl, tl->sources, tl->num_sources, NULL);
+        }
+    }
+
+    bool lazy = timeline_get_max_open_sources(tl) >= 0;
+    for (int n = 0; n < parts->num_parts; n++) {
+        struct tl_part *part = &parts->parts[n];
+        struct source_open *job = &jobs[find_source(tl, part->filename)];
+        // The first part's source is the track layout.
+        bool keep = !lazy || n < 2;
+        job->keep |= keep;
+        job->open |= keep || part->length < 0 || part->chapter_ts ||
+                     !part->offset_set;
+    }
+
+    timeline_run_parallel(open_source_job, jobs + base, sizeof(jobs[0]),
+                          num_jobs - base);
+
+    for (int n = base; n < num_jobs; n++)
+        tl->sources[n] = jobs[n].demux;
+    return jobs;
+}
+
+static double source_chapter_time(struct source_open *src, int n)
+{
+    if (n < 0 || n >= src->num_chapters)
         return -1;
-    return demuxer->chapters[n].pts;
+    return src->chapters[n].pts;
 }
 
 // Append all chapters from src to the chapters array.
 // Ignore chapters outside of the given time range.
 static void copy_chapters(struct demux_chapter **chapters, int *num_chapters,
-                          struct demuxer *src, double start, double len,
+                          struct source_open *src, double start, double len,
                           double dest_offset)
 {
     for (int n = 0; n < src->num_chapters; n++) {
-        double time = demuxer_chapter_time(src, n);
+        double time = source_chapter_time(src, n);
         if (time >= start && time <= start + len) {
             struct demux_chapter ch = {
                 .pts = dest_offset + time - start,
@@ -174,49 +273,43 @@ static void copy_chapters(struct demux_chapter **chapters, int *num_chapters,
     }
 }
 
-// return length of the source in seconds, or -1 if unknown
-static double source_get_length(struct demuxer *demuxer)
-{
-    double time;
-    // <= 0 means DEMUXER_CTRL_NOTIMPL or DEMUXER_CTRL_DONTKNOW
-    if (demux_control(demuxer, DEMUXER_CTRL_GET_TIME_LENGTH, &time) <= 0)
-        time = -1;
-    return time;
-}
-
-static void resolve_timestamps(struct tl_part *part, struct demuxer *demuxer)
+static void resolve_timestamps(struct tl_part *part, struct source_open *src)
 {
     if (part->chapter_ts) {
-        double start = demuxer_chapter_time(demuxer, part->offset);
+        double start = source_chapter_time(src, part->offset);
         double length = part->length;
         double end = length;
         if (end >= 0)
-            end = demuxer_chapter_time(demuxer, part->offset + part->length);
+            end = source_chapter_time(src, part->offset + part->length);
         if (end >= 0 && start >= 0)
             length = end - start;
         part->offset = start;
         part->length = length;
     }
     if (!part->offset_set)
-        part->offset = demuxer->start_time;
+        part->offset = src->start_time;
 }
 
 static void build_timeline(struct timeline *tl, struct tl_parts *parts)
 {
+    struct source_open *sources = open_sources(tl, parts);
+
     tl->parts = talloc_array_ptrtype(tl, tl->parts, parts->num_parts + 1);
     double starttime = 0;
     for (int n = 0; n < parts->num_parts; n++) {
         struct tl_part *part = &parts->parts[n];
-        struct demuxer *source = open_source(tl, part->filename);
-        if (!source)
+        int source_index = find_source(tl, part->filename);
+        struct source_open *source = &sources[source_index];
+        if (source->open && !source->opened) {
+            MP_ERR(tl, "EDL: Could not open source file '%s'.\n",
+                   part->filename);
             goto error;
+        }
 
         resolve_timestamps(part, source);
 
-        double len = source_get_length(source);
-        if (len > 0) {
-            len += source->start_time;
-        } else {
+        double len = source->length;
+        if (source->opened && len <= 0) {
             MP_WARN(tl, "EDL: source file '%s' has unknown duration.\n",
                     part->filename);
         }
@@ -250,7 +343,8 @@ static void build_timeline(struct timeline *tl, struct tl_parts *parts)
         tl->parts[n] = (struct timeline_part) {
             .start = starttime,
             .source_start = part->offset,
-            .source = source,
+            .source = tl->sources[source_index],
+            .source_index = source_index,
         };
 
         starttime += part->length;
@@ -258,11 +352,16 @@ static void build_timeline(struct timeline *tl, struct tl_parts *parts)
     tl->parts[parts->num_parts] = (struct timeline_part) {.start = starttime};
     tl->num_parts = parts->num_parts;
     tl->track_layout = tl->parts[0].source;
-    return;
+    timeline_enable_lazy_sources(tl);
+    goto done;
 
 error:
     tl->num_parts = 0;
     tl->num_chapters = 0;
+done:
+    for (int n = 0; n < tl->num_sources; n++)
+        talloc_free(sources[n].chapters);
+    talloc_free(sources);
 }
 
 // For security, don't allow relative or absolute paths, only plain filenames.
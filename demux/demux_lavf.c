@@ -44,6 +44,7 @@
 
 #include "stream/stream.h"
 #include "demux.h"
+#include "probe_cache.h"
 #include "stheader.h"
 #include "options/m_option.h"
 #include "options/path.h"
@@ -52,6 +53,10 @@
 #define INITIAL_PROBE_SIZE STREAM_BUFFER_SIZE
 #define PROBE_BUF_SIZE FFMIN(STREAM_MAX_BUFFER_SIZE, 2 * 1024 * 1024)
 
+// Don't limit probesize with cached probe results above this (the default of
+// libavformat).
+#define PROBE_CACHE_MAX_BUDGET (5 * 1000 * 1000)
+
 
 // Should correspond to IO_BUFFER_SIZE in libavformat/aviobuf.c (not public)
 // libavformat (almost) always reads data in blocks of this size.
@@ -170,6 +175,7 @@ typedef struct lavf_priv {
     int cur_program;
     char *mime_type;
     bool merge_track_metadata;
+    struct demux_probe_info *probe_hint; // during open only
 } lavf_priv_t;
 
 // At least mp4 has name="mov,mp4,m4a,3gp,3g2,mj2", so we split the name
@@ -349,6 +355,15 @@ static int lavf_check_file(demuxer_t *demuxer, enum demux_check check)
         }
     }
 
+    // Skip probing if the format is known from a previous open of this file.
+    struct demux_probe_info *hint = priv->probe_hint;
+    if (!forced_format && hint && hint->lavf_format[0]) {
+        forced_format = av_find_input_format(hint->lavf_format);
+        if (forced_format)
+            MP_VERBOSE(demuxer, "Format '%s' from probe cache.\n",
+                       hint->lavf_format);
+    }
+
     AVProbeData avpd = {
         // Disable file-extension matching with normal checks
         .filename = check <= DEMUX_CHECK_REQUEST ? priv->filename : "",
@@ -731,6 +746,8 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
     lavf_priv_t *priv = talloc_zero(NULL, lavf_priv_t);
     demuxer->priv = priv;
     priv->stream = demuxer->stream;
+    if (demuxer->params)
+        priv->probe_hint = demuxer->params->probe_info;
 
     if (lavf_check_file(demuxer, check) < 0)
         return -1;
@@ -757,6 +774,12 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
         if (av_opt_set_int(avfc, "probesize", lavfdopts->probesize, 0) < 0)
             MP_ERR(demuxer, "couldn't set option probesize to %u\n",
                    lavfdopts->probesize);
+    } else if (priv->probe_hint && priv->probe_hint->probe_bytes > 0 &&
+               priv->probe_hint->probe_bytes < PROBE_CACHE_MAX_BUDGET / 2)
+    {
+        // Opening the file needed this much data last time; leave some room.
+        int64_t budget = MPMAX(priv->probe_hint->probe_bytes * 2, 64 * 1024);
+        av_opt_set_int(avfc, "probesize", budget, 0);
     }
 
     if (priv->format_hack.analyzeduration)
@@ -834,6 +857,15 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
     MP_VERBOSE(demuxer, "avformat_find_stream_info() finished after %"PRId64
                " bytes.\n", stream_tell(priv->stream));
 
+    if (priv->probe_hint) {
+        struct demux_probe_info *info = priv->probe_hint;
+        // Only the first of the comma-separated names works for lookups.
+        snprintf(info->lavf_format, sizeof(info->lavf_format), "%.*s",
+                 (int)strcspn(priv->avif->name, ","), priv->avif->name);
+        info->probe_bytes = stream_tell(priv->stream);
+        priv->probe_hint = NULL;
+    }
+
     for (int i = 0; i < avfc->nb_chapters; i++) {
         AVChapter *c = avfc->chapters[i];
         t = av_dict_get(c->metadata, "title", NULL, 0);
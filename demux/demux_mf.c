@@ -16,11 +16,13 @@
  */
 
 #include <stdio.h>
+#include <assert.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "osdep/io.h"
 
@@ -29,6 +31,7 @@
 #include "options/options.h"
 #include "options/path.h"
 #include "misc/ctype.h"
+#include "misc/thread_pool.h"
 
 #include "stream/stream.h"
 #include "demux.h"
@@ -36,15 +39,45 @@
 #include "codec_tags.h"
 
 #define MF_MAX_FILE_SIZE (1024 * 1024 * 256)
+#define MF_MAX_PREFETCH_THREADS 8
+
+enum {
+    SLOT_EMPTY,
+    SLOT_LOADING,       // owned by a worker thread
+    SLOT_READY,
+};
+
+// A file read ahead by the prefetch pool.
+struct mf_slot {
+    struct mf *mf;
+    int state;
+    int index;          // index into mf->names
+    char *filename;
+    bstr data;
+    int64_t reserved;   // bytes accounted in buffered_bytes while loading
+};
 
 typedef struct mf {
     struct mp_log *log;
+    struct mpv_global *global;
     struct sh_stream *sh;
     int curr_frame;
     int nr_of_files;
     char **names;
     // optional
     struct stream **streams;
+
+    // Prefetching (slot for frame N is slots[N % num_slots]).
+    struct mp_thread_pool *pool;
+    struct mf_slot *slots;
+    int num_slots;
+    int64_t max_bytes;
+    struct mp_cancel *cancel;   // aborts prefetching on close
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // --- protected by lock
+    int64_t buffered_bytes;     // includes the estimates for loading slots
+    int64_t last_size;          // size of the last read file
 } mf_t;
 
 
@@ -173,6 +206,113 @@ static void demux_seek_mf(demuxer_t *demuxer, double rel_seek_secs, int flags)
     mf->curr_frame = newpos;
 }
 
+// If slot is set, it's a prefetch job; its reservation is updated to the real
+// file size as soon as it's known.
+static bstr read_file(struct mf *mf, const char *filename, struct mf_slot *slot)
+{
+    bstr data = {0};
+    if (mp_cancel_test(mf->cancel))
+        return data;
+    struct stream *stream = stream_create(filename, STREAM_READ, mf->cancel,
+                                          mf->global);
+    if (stream) {
+        int64_t size = stream_get_size(stream);
+        if (slot && size >= 0 && size <= MF_MAX_FILE_SIZE) {
+            pthread_mutex_lock(&mf->lock);
+            mf->buffered_bytes += size - slot->reserved;
+            slot->reserved = size;
+            pthread_mutex_unlock(&mf->lock);
+        }
+        data = stream_read_complete(stream, NULL, MF_MAX_FILE_SIZE);
+        free_stream(stream);
+    }
+    return data;
+}
+
+static void prefetch_job(void *ctx)
+{
+    struct mf_slot *slot = ctx;
+    struct mf *mf = slot->mf;
+
+    bstr data = read_file(mf, slot->filename, slot);
+
+    pthread_mutex_lock(&mf->lock);
+    slot->data = data;
+    slot->state = SLOT_READY;
+    mf->buffered_bytes += (int64_t)data.len - slot->reserved;
+    slot->reserved = 0;
+    if (data.len)
+        mf->last_size = data.len;
+    pthread_cond_broadcast(&mf->wakeup);
+    pthread_mutex_unlock(&mf->lock);
+}
+
+// Must be called with mf->lock held.
+static void clear_slot(struct mf *mf, struct mf_slot *slot)
+{
+    assert(slot->state != SLOT_LOADING);
+    mf->buffered_bytes -= slot->data.len;
+    talloc_free(slot->data.start);
+    slot->data = (bstr){0};
+    slot->state = SLOT_EMPTY;
+}
+
+// Queue reading the files following the current frame, as far as the slots
+// and the memory budget allow. Files being read count against the budget with
+// the size of the previously read file, until their real size is known. Must
+// be called with mf->lock held.
+static void queue_prefetch(struct mf *mf)
+{
+    int end = MPMIN(mf->curr_frame + mf->num_slots, mf->nr_of_files);
+    for (int i = mf->curr_frame; i < end; i++) {
+        struct mf_slot *slot = &mf->slots[i % mf->num_slots];
+        if (slot->state == SLOT_LOADING || (slot->state == SLOT_READY &&
+                                            slot->index == i))
+            continue;
+        if (slot->state == SLOT_READY)
+            clear_slot(mf, slot); // left over from before a seek
+        if (i > mf->curr_frame + 1 && mf->buffered_bytes >= mf->max_bytes)
+            break;
+        if (!mf->names[i])
+            continue;
+        slot->state = SLOT_LOADING;
+        slot->index = i;
+        slot->filename = mf->names[i];
+        slot->reserved = mf->last_size;
+        mf->buffered_bytes += slot->reserved;
+        mp_thread_pool_queue(mf->pool, prefetch_job, slot);
+    }
+}
+
+// Returns the data of the current frame.
+static bstr get_frame_data(struct mf *mf)
+{
+    int index = mf->curr_frame;
+    if (!mf->pool)
+        return mf->names[index] ? read_file(mf, mf->names[index], NULL)
+                                : (bstr){0};
+
+    pthread_mutex_lock(&mf->lock);
+    queue_prefetch(mf);
+    struct mf_slot *slot = &mf->slots[index % mf->num_slots];
+    while (slot->state == SLOT_LOADING)
+        pthread_cond_wait(&mf->wakeup, &mf->lock);
+    bstr data = {0};
+    bool found = slot->state == SLOT_READY && slot->index == index;
+    if (found) {
+        data = slot->data;
+        mf->buffered_bytes -= data.len;
+        slot->data = (bstr){0};
+        slot->state = SLOT_EMPTY;
+    }
+    pthread_mutex_unlock(&mf->lock);
+
+    // Slot was occupied by a stale prefetch.
+    if (!found && mf->names[index])
+        data = read_file(mf, mf->names[index], NULL);
+    return data;
+}
+
 // return value:
 //     0 = EOF or no stream found
 //     1 = successfully read a packet
@@ -182,33 +322,25 @@ static int demux_mf_fill_buffer(demuxer_t *demuxer)
     if (mf->curr_frame >= mf->nr_of_files)
         return 0;
 
-    struct stream *entry_stream = NULL;
-    if (mf->streams)
-        entry_stream = mf->streams[mf->curr_frame];
-    struct stream *stream = entry_stream;
-    if (!stream) {
-        char *filename = mf->names[mf->curr_frame];
-        if (filename)
-            stream = stream_open(filename, demuxer->global);
+    bstr data = {0};
+    if (mf->streams) {
+        struct stream *stream = mf->streams[mf->curr_frame];
+        stream_seek(stream, 0);
+        data = stream_read_complete(stream, NULL, MF_MAX_FILE_SIZE);
+    } else {
+        data = get_frame_data(mf);
     }
 
-    if (stream) {
-        stream_seek(stream, 0);
-        bstr data = stream_read_complete(stream, NULL, MF_MAX_FILE_SIZE);
-        if (data.len) {
-            demux_packet_t *dp = new_demux_packet(data.len);
-            if (dp) {
-                memcpy(dp->buffer, data.start, data.len);
-                dp->pts = mf->curr_frame / mf->sh->codec->fps;
-                dp->keyframe = true;
-                demux_add_packet(mf->sh, dp);
-            }
+    if (data.len) {
+        demux_packet_t *dp = new_demux_packet(data.len);
+        if (dp) {
+            memcpy(dp->buffer, data.start, data.len);
+            dp->pts = mf->curr_frame / mf->sh->codec->fps;
+            dp->keyframe = true;
+            demux_add_packet(mf->sh, dp);
         }
-        talloc_free(data.start);
     }
-
-    if (stream && stream != entry_stream)
-        free_stream(stream);
+    talloc_free(data.start);
 
     mf->curr_frame++;
     return 1;
@@ -313,6 +445,24 @@ static int demux_open_mf(demuxer_t *demuxer, enum demux_check check)
         goto error;
 
     mf->curr_frame = 0;
+    mf->global = demuxer->global;
+
+    int prefetch = MPMIN(demuxer->opts->mf_prefetch, mf->nr_of_files - 1);
+    if (!mf->streams && prefetch > 0) {
+        mf->pool = mp_thread_pool_create(mf, MPMIN(prefetch,
+                                                   MF_MAX_PREFETCH_THREADS));
+        if (mf->pool) {
+            // One more slot for the frame currently being read.
+            mf->num_slots = prefetch + 1;
+            mf->slots = talloc_zero_array(mf, struct mf_slot, mf->num_slots);
+            for (int n = 0; n < mf->num_slots; n++)
+                mf->slots[n].mf = mf;
+            mf->max_bytes = demuxer->opts->mf_prefetch_max_bytes;
+            mf->cancel = mp_cancel_new(mf);
+            pthread_mutex_init(&mf->lock, NULL);
+            pthread_cond_init(&mf->wakeup, NULL);
+        }
+    }
 
     // create a new video stream header
     struct sh_stream *sh = demux_alloc_sh_stream(STREAM_VIDEO);
@@ -337,6 +487,19 @@ error:
 
 static void demux_close_mf(demuxer_t *demuxer)
 {
+    mf_t *mf = demuxer->priv;
+    if (!mf || !mf->pool)
+        return;
+
+    // Make the running jobs return early, and the queued ones do nothing.
+    mp_cancel_trigger(mf->cancel);
+    // Waits until all prefetch jobs are done.
+    talloc_free(mf->pool);
+    mf->pool = NULL;
+    for (int n = 0; n < mf->num_slots; n++)
+        clear_slot(mf, &mf->slots[n]);
+    pthread_cond_destroy(&mf->wakeup);
+    pthread_mutex_destroy(&mf->lock);
 }
 
 static int demux_control_mf(demuxer_t *demuxer, int cmd, void *arg)
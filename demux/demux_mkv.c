@@ -26,11 +26,15 @@
 #include <stdbool.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavutil/common.h>
+#include <libavutil/buffer.h>
 #include <libavutil/lzo.h>
 #include <libavutil/intreadwrite.h>
 #include <libavutil/avstring.h>
+#include <libavutil/md5.h>
+#include <libavutil/cpu.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavcodec/version.h>
@@ -45,7 +49,9 @@
 #include "common/av_common.h"
 #include "options/options.h"
 #include "options/m_option.h"
+#include "options/path.h"
 #include "misc/bstr.h"
+#include "misc/thread_pool.h"
 #include "stream/stream.h"
 #include "video/csputils.h"
 #include "video/mp_image.h"
@@ -57,6 +63,7 @@
 #include "video/img_fourcc.h"
 
 #include "common/msg.h"
+#include "osdep/io.h"
 
 static const unsigned char sipr_swaps[38][2] = {
     {0,63},{1,22},{2,44},{3,90},{5,81},{7,31},{8,86},{9,58},{10,36},{12,68},
@@ -150,13 +157,31 @@ typedef struct mkv_index {
     uint64_t filepos; // position of the cluster which contains the packet
 } mkv_index_t;
 
+// A lace whose content encoding is undone on a worker thread. Once the work is
+// done (and all preceding jobs are done), the demuxer thread adds the packet.
+struct decode_job {
+    struct mkv_demuxer *mkv_d;
+    struct mp_log *log;
+    mkv_track_t *track;
+    AVBufferRef *buf;       // keeps data alive
+    bstr data;              // encoded lace
+    // Packet properties, determined before decoding.
+    bool keyframe;
+    int64_t pos;
+    double pts, duration;
+    int skip_start, skip_end;
+    // Written by the worker; access only after done is set.
+    struct demux_packet *dp;
+    bool done;              // protected by mkv_demuxer.decode_lock
+};
+
 struct block_info {
     uint64_t duration, discardpadding;
     bool simple, keyframe;
     int64_t timecode;
     mkv_track_t *track;
     bstr data;
-    void *alloc;
+    AVBufferRef *buf;   // contains data (possibly referencing cache memory)
     int64_t filepos;
 };
 
@@ -175,6 +200,12 @@ typedef struct mkv_demuxer {
     uint64_t cluster_start;
     uint64_t cluster_end;
 
+    // If the current cluster was read into memory at once, this contains its
+    // contents, and cluster_data is the part not parsed yet. The stream
+    // position is at cluster_end.
+    AVBufferRef *cluster_buf;
+    bstr cluster_data;
+
     mkv_index_t *indexes;
     size_t num_indexes;
     bool index_complete;
@@ -192,10 +223,30 @@ typedef struct mkv_demuxer {
     int subtitle_preroll;
 
     bool index_has_durations;
+    // The incremental index was built until the end of the file.
+    bool index_scanned;
+    // The last read_next_block() failure was a real EOF (not an error or
+    // cancellation).
+    bool reached_eof;
+    // The duration was determined by probe_last_timestamp().
+    bool duration_probed;
+
+    // State when the index file was loaded (to check whether to update it).
+    size_t index_file_entries;
+    bool index_file_scanned, index_file_probed;
 
     bool eof_warning;
 
     struct block_info tmp_block;
+
+    // Decoding of compressed tracks on worker threads. The jobs are in read
+    // order, and are added as packets in this order.
+    struct mp_thread_pool *decode_pool;
+    pthread_mutex_t decode_lock;
+    pthread_cond_t decode_wakeup;
+    struct decode_job **decode_jobs;
+    int num_decode_jobs;
+    bool decode_pool_failed;
 } mkv_demuxer_t;
 
 #define OPT_BASE_STRUCT struct demux_mkv_opts
@@ -205,6 +256,8 @@ struct demux_mkv_opts {
     double subtitle_preroll_secs_index;
     int probe_duration;
     int probe_start_time;
+    char *index_dir;
+    int decode_threads;
 };
 
 const struct m_sub_options demux_mkv_conf = {
@@ -218,6 +271,9 @@ const struct m_sub_options demux_mkv_conf = {
         OPT_CHOICE("probe-video-duration", probe_duration, 0,
                    ({"no", 0}, {"yes", 1}, {"full", 2})),
         OPT_FLAG("probe-start-time", probe_start_time, 0),
+        OPT_STRING("index-dir", index_dir, M_OPT_FILE),
+        OPT_CHOICE_OR_INT("decode-threads", decode_threads, 0, 0, 16,
+                          ({"auto", -1})),
         {0}
     },
     .size = sizeof(struct demux_mkv_opts),
@@ -226,6 +282,7 @@ const struct m_sub_options demux_mkv_conf = {
         .subtitle_preroll_secs = 1.0,
         .subtitle_preroll_secs_index = 10.0,
         .probe_start_time = 1,
+        .decode_threads = -1,
     },
 };
 
@@ -234,12 +291,22 @@ const struct m_sub_options demux_mkv_conf = {
 #define RAPROPERTIES4_SIZE 56
 #define RAPROPERTIES5_SIZE 70
 
+// Clusters up to this size are read into memory with a single read, and then
+// parsed from memory, instead of reading each element from the stream.
+#define MAX_CLUSTER_BUF_SIZE (16 * 1024 * 1024)
+
+// Maximum number of laces that are being decoded on worker threads at once.
+#define MAX_DECODE_JOBS 64
+
 // Maximum number of subtitle packets that are accepted for pre-roll.
 // (Subtitle packets added before first A/V keyframe packet is found with seek.)
 #define NUM_SUB_PREROLL_PACKETS 500
 
 static void probe_last_timestamp(struct demuxer *demuxer, int64_t start_pos);
 static void probe_first_timestamp(struct demuxer *demuxer);
+static void load_index_file(struct demuxer *demuxer);
+static void save_index_file(struct demuxer *demuxer);
+static void discard_decode_jobs(demuxer_t *demuxer);
 static void free_block(struct block_info *block);
 
 #define AAC_SYNC_EXTENSION_TYPE 0x02b7
@@ -255,8 +322,10 @@ static int aac_get_sample_rate_index(uint32_t sample_rate)
     return i;
 }
 
-static bstr demux_mkv_decode(struct mp_log *log, mkv_track_t *track,
-                             bstr data, uint32_t type)
+// Undo the content encodings of the given scope type. If the result is not
+// data itself, it's allocated as child of ta_parent.
+static bstr demux_mkv_decode(struct mp_log *log, void *ta_parent,
+                             mkv_track_t *track, bstr data, uint32_t type)
 {
     uint8_t *src = data.start;
     uint8_t *orig_src = src;
@@ -302,7 +371,7 @@ static bstr demux_mkv_decode(struct mp_log *log, mkv_track_t *track,
                     goto error;
                 }
                 size += 4000;
-                dest = talloc_realloc_size(track->parser_tmp, dest, size);
+                dest = talloc_realloc_size(ta_parent, dest, size);
                 zstream.next_out = (Bytef *) (dest + zstream.total_out);
                 result = inflate(&zstream, Z_NO_FLUSH);
                 if (result != Z_OK && result != Z_STREAM_END) {
@@ -330,7 +399,7 @@ static bstr demux_mkv_decode(struct mp_log *log, mkv_track_t *track,
             dest = NULL;
             while (1) {
                 int srclen = size;
-                dest = talloc_realloc_size(track->parser_tmp, dest,
+                dest = talloc_realloc_size(ta_parent, dest,
                                            dstlen + AV_LZO_OUTPUT_PADDING);
                 out_avail = dstlen;
                 int result = av_lzo1x_decode(dest, &out_avail, src, &srclen);
@@ -352,7 +421,7 @@ static bstr demux_mkv_decode(struct mp_log *log, mkv_track_t *track,
             }
             size = dstlen - out_avail;
         } else if (enc->comp_algo == 3) {
-            dest = talloc_size(track->parser_tmp, size + enc->comp_settings_len);
+            dest = talloc_size(ta_parent, size + enc->comp_settings_len);
             memcpy(dest, enc->comp_settings, enc->comp_settings_len);
             memcpy(dest + enc->comp_settings_len, src, size);
             size += enc->comp_settings_len;
@@ -1729,7 +1798,8 @@ static int demux_mkv_open_sub(demuxer_t *demuxer, mkv_track_t *track)
 
     sh->codec->codec = subtitle_type;
     bstr in = (bstr){track->private_data, track->private_size};
-    bstr buffer = demux_mkv_decode(demuxer->log, track, in, 2);
+    bstr buffer = demux_mkv_decode(demuxer->log, track->parser_tmp, track,
+                                   in, 2);
     if (buffer.start && buffer.start != track->private_data) {
         talloc_free(track->private_data);
         talloc_steal(track, buffer.start);
@@ -1855,6 +1925,8 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
     mkv_d->segment_end = end_pos;
     mkv_d->a_skip_preroll = 1;
     mkv_d->skip_to_timecode = INT64_MIN;
+    pthread_mutex_init(&mkv_d->decode_lock, NULL);
+    pthread_cond_init(&mkv_d->decode_wakeup, NULL);
 
     if (demuxer->params && demuxer->params->matroska_was_valid)
         *demuxer->params->matroska_was_valid = true;
@@ -1916,7 +1988,8 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
     demuxer->allow_refresh_seeks = true;
 
     probe_first_timestamp(demuxer);
-    if (opts->demux_mkv->probe_duration)
+    load_index_file(demuxer);
+    if (opts->demux_mkv->probe_duration && !mkv_d->duration_probed)
         probe_last_timestamp(demuxer, start_pos);
 
     return 0;
@@ -2112,6 +2185,103 @@ error:
     return true;
 }
 
+// Discard the in-memory cluster. If sync is set, the stream is positioned at
+// the first unparsed byte, so that reading can continue from the stream.
+static void drop_cluster_buf(demuxer_t *demuxer, bool sync)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (!mkv_d->cluster_buf)
+        return;
+    int64_t pos = mkv_d->cluster_end - mkv_d->cluster_data.len;
+    av_buffer_unref(&mkv_d->cluster_buf);
+    mkv_d->cluster_data = (bstr){0};
+    if (sync && stream_tell(demuxer->stream) != pos)
+        stream_seek(demuxer->stream, pos);
+}
+
+// Read the rest of the current cluster into memory, if possible.
+static void read_cluster_buf(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    stream_t *s = demuxer->stream;
+    int64_t pos = stream_tell(s);
+    if (mkv_d->cluster_end == EBML_UINT_INVALID || mkv_d->cluster_end <= pos ||
+        mkv_d->cluster_end - pos > MAX_CLUSTER_BUF_SIZE)
+        return;
+    int len = mkv_d->cluster_end - pos;
+    AVBufferRef *buf = stream_read_ref(s, len);
+    if (!buf || buf->size != len) {
+        // Truncated file; let the normal code deal with it.
+        av_buffer_unref(&buf);
+        stream_seek(s, pos);
+        return;
+    }
+    mkv_d->cluster_buf = buf;
+    mkv_d->cluster_data = (bstr){buf->data, len};
+}
+
+// The following functions read from the in-memory cluster if it's present,
+// and from the stream otherwise.
+
+static int64_t cluster_tell(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->cluster_buf)
+        return mkv_d->cluster_end - mkv_d->cluster_data.len;
+    return stream_tell(demuxer->stream);
+}
+
+static uint32_t cluster_read_id(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->cluster_buf)
+        return ebml_read_id_buf(&mkv_d->cluster_data);
+    return ebml_read_id(demuxer->stream);
+}
+
+static uint64_t cluster_read_length(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->cluster_buf)
+        return ebml_read_vlen_uint(&mkv_d->cluster_data);
+    return ebml_read_length(demuxer->stream);
+}
+
+static uint64_t cluster_read_uint(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->cluster_buf)
+        return ebml_read_uint_buf(&mkv_d->cluster_data);
+    return ebml_read_uint(demuxer->stream);
+}
+
+static int64_t cluster_read_int(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->cluster_buf)
+        return ebml_read_int_buf(&mkv_d->cluster_data);
+    return ebml_read_int(demuxer->stream);
+}
+
+static int cluster_read_skip(demuxer_t *demuxer, int64_t end)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (!mkv_d->cluster_buf)
+        return ebml_read_skip(demuxer->log, end, demuxer->stream);
+    int64_t pos = cluster_tell(demuxer);
+    bstr data = mkv_d->cluster_data;
+    uint64_t len = ebml_read_vlen_uint(&data);
+    int64_t data_pos = mkv_d->cluster_end - data.len;
+    if (len == EBML_UINT_INVALID || len > data.len ||
+        (end > 0 && data_pos + len > end))
+    {
+        MP_ERR(demuxer, "Invalid EBML length at position %"PRId64"\n", pos);
+        return 1;
+    }
+    mkv_d->cluster_data = bstr_cut(data, len);
+    return 0;
+}
+
 static void mkv_seek_reset(demuxer_t *demuxer)
 {
     mkv_demuxer_t *mkv_d = demuxer->priv;
@@ -2129,6 +2299,8 @@ static void mkv_seek_reset(demuxer_t *demuxer)
     }
 
     free_block(&mkv_d->tmp_block);
+    drop_cluster_buf(demuxer, false);
+    discard_decode_jobs(demuxer);
 
     mkv_d->skip_to_timecode = INT64_MIN;
 }
@@ -2306,8 +2478,7 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
 
 static void free_block(struct block_info *block)
 {
-    free(block->alloc);
-    block->alloc = NULL;
+    av_buffer_unref(&block->buf);
     block->data = (bstr){0};
 }
 
@@ -2331,16 +2502,24 @@ static int read_block(demuxer_t *demuxer, int64_t end, struct block_info *block)
     int res = -1;
 
     free_block(block);
-    length = ebml_read_length(s);
-    if (length > 500000000 || stream_tell(s) + length > (uint64_t)end)
-        goto exit;
-    block->alloc = malloc(length + AV_LZO_INPUT_PADDING);
-    if (!block->alloc)
-        goto exit;
-    block->data = (bstr){block->alloc, length};
-    block->filepos = stream_tell(s);
-    if (stream_read(s, block->data.start, block->data.len) != block->data.len)
+    length = cluster_read_length(demuxer);
+    if (length > 500000000 || cluster_tell(demuxer) + length > (uint64_t)end)
         goto exit;
+    // Note that FF_INPUT_BUFFER_PADDING_SIZE >= AV_LZO_INPUT_PADDING.
+    block->filepos = cluster_tell(demuxer);
+    if (mkv_d->cluster_buf) {
+        // (end is within the cluster, so the data is available)
+        block->buf = av_buffer_ref(mkv_d->cluster_buf);
+        if (!block->buf)
+            goto exit;
+        block->data = bstr_splice(mkv_d->cluster_data, 0, length);
+        mkv_d->cluster_data = bstr_cut(mkv_d->cluster_data, length);
+    } else {
+        block->buf = stream_read_ref(s, length);
+        if (!block->buf || block->buf->size != length)
+            goto exit;
+        block->data = (bstr){block->buf->data, length};
+    }
 
     // Parse header of the Block element
     /* first byte(s): track num */
@@ -2374,6 +2553,163 @@ exit:
     return res;
 }
 
+// Undo content encodings, and create the packet.
+static void decode_lace(struct decode_job *job)
+{
+    void *tmp = talloc_new(NULL);
+    bstr decoded = demux_mkv_decode(job->log, tmp, job->track, job->data, 1);
+
+    // Reference the block memory if the data wasn't transformed. Small
+    // packets are copied out of in-memory clusters, so that they don't keep
+    // the whole cluster alive.
+    struct demux_packet *dp;
+    if (decoded.start == job->data.start && decoded.len == job->data.len &&
+        job->data.len >= job->buf->size / 8)
+    {
+        dp = new_demux_packet_from_buf(job->buf, job->data.start, job->data.len);
+    } else {
+        dp = new_demux_packet_from(decoded.start, decoded.len);
+    }
+    talloc_free(tmp);
+
+    if (dp) {
+        dp->keyframe = job->keyframe;
+        dp->pos = job->pos;
+        dp->pts = job->pts;
+        dp->duration = job->duration;
+        if (job->track->stream->codec->avi_dts)
+            MPSWAP(double, dp->pts, dp->dts);
+        demux_packet_set_padding(dp, job->skip_start, job->skip_end);
+    }
+    job->dp = dp;
+}
+
+static void decode_job_run(void *ctx)
+{
+    struct decode_job *job = ctx;
+    struct mkv_demuxer *mkv_d = job->mkv_d;
+
+    decode_lace(job);
+
+    pthread_mutex_lock(&mkv_d->decode_lock);
+    job->done = true;
+    pthread_cond_broadcast(&mkv_d->decode_wakeup);
+    pthread_mutex_unlock(&mkv_d->decode_lock);
+}
+
+static void free_decode_job(struct decode_job *job)
+{
+    free_demux_packet(job->dp);
+    av_buffer_unref(&job->buf);
+    talloc_free(job);
+}
+
+static bool wait_decode_job(struct mkv_demuxer *mkv_d, struct decode_job *job,
+                            bool block)
+{
+    pthread_mutex_lock(&mkv_d->decode_lock);
+    while (block && !job->done)
+        pthread_cond_wait(&mkv_d->decode_wakeup, &mkv_d->decode_lock);
+    bool done = job->done;
+    pthread_mutex_unlock(&mkv_d->decode_lock);
+    return done;
+}
+
+// Add the packets of finished decode jobs, in read order. Wait for jobs to
+// finish while more than max_pending jobs are queued.
+static void flush_decode_jobs(demuxer_t *demuxer, int max_pending)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+
+    while (mkv_d->num_decode_jobs) {
+        struct decode_job *job = mkv_d->decode_jobs[0];
+        if (!wait_decode_job(mkv_d, job, mkv_d->num_decode_jobs > max_pending))
+            break;
+        MP_TARRAY_REMOVE_AT(mkv_d->decode_jobs, mkv_d->num_decode_jobs, 0);
+        if (job->dp) {
+            mkv_parse_and_add_packet(demuxer, job->track, job->dp);
+            talloc_free_children(job->track->parser_tmp);
+            job->dp = NULL;
+        }
+        free_decode_job(job);
+    }
+}
+
+// Drop all queued decode jobs (e.g. on seeking).
+static void discard_decode_jobs(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+
+    for (int n = 0; n < mkv_d->num_decode_jobs; n++) {
+        struct decode_job *job = mkv_d->decode_jobs[n];
+        wait_decode_job(mkv_d, job, true);
+        free_decode_job(job);
+    }
+    mkv_d->num_decode_jobs = 0;
+}
+
+// Whether to decode the laces of the given track on worker threads. This is
+// done for compressed tracks only (header stripping is cheap).
+static bool use_decode_threads(demuxer_t *demuxer, mkv_track_t *track)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+
+    bool compressed = false;
+    for (int i = 0; i < track->num_encodings; i++) {
+        struct mkv_content_encoding *enc = &track->encodings[i];
+        if ((enc->scope & 1) && (enc->comp_algo == 0 || enc->comp_algo == 2))
+            compressed = true;
+    }
+    if (!compressed)
+        return false;
+
+    if (!mkv_d->decode_pool && !mkv_d->decode_pool_failed) {
+        int threads = demuxer->opts->demux_mkv->decode_threads;
+        if (threads < 0)
+            threads = MPCLAMP(av_cpu_count(), 1, 4);
+        if (threads > 0)
+            mkv_d->decode_pool = mp_thread_pool_create(mkv_d, threads);
+        mkv_d->decode_pool_failed = !mkv_d->decode_pool;
+        if (mkv_d->decode_pool) {
+            MP_VERBOSE(demuxer, "Decompressing with %d threads.\n", threads);
+        }
+    }
+    return !!mkv_d->decode_pool;
+}
+
+static void add_lace(demuxer_t *demuxer, struct decode_job *job, bool threaded)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+
+    if (!threaded && !mkv_d->num_decode_jobs) {
+        decode_lace(job);
+        if (job->dp) {
+            mkv_parse_and_add_packet(demuxer, job->track, job->dp);
+            talloc_free_children(job->track->parser_tmp);
+        }
+        return;
+    }
+
+    // Queue it even if it's not decoded on a worker thread, so that the order
+    // of packets is kept.
+    struct decode_job *new = talloc_dup(NULL, job);
+    new->mkv_d = mkv_d;
+    new->buf = av_buffer_ref(job->buf);
+    if (!new->buf) {
+        talloc_free(new);
+        return;
+    }
+    MP_TARRAY_APPEND(mkv_d, mkv_d->decode_jobs, mkv_d->num_decode_jobs, new);
+    if (threaded) {
+        mp_thread_pool_queue(mkv_d->decode_pool, decode_job_run, new);
+    } else {
+        decode_lace(new);
+        new->done = true;
+    }
+
+    flush_decode_jobs(demuxer, MAX_DECODE_JOBS);
+}
+
 static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
@@ -2433,37 +2769,38 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
         uint64_t filepos = block_info->filepos;
         mkv_d->last_pts = current_pts;
 
+        bool threaded = use_decode_threads(demuxer, track);
         for (int i = 0; i < laces; i++) {
             bstr block = bstr_splice(data, 0, lace_size[i]);
             data = bstr_cut(data, lace_size[i]);
 
-            block = demux_mkv_decode(demuxer->log, track, block, 1);
-
-            demux_packet_t *dp = new_demux_packet_from(block.start, block.len);
-            if (!dp)
-                break;
-            dp->keyframe = keyframe;
-            dp->pos = filepos;
+            struct decode_job job = {
+                .log = demuxer->log,
+                .track = track,
+                .buf = block_info->buf,
+                .data = block,
+                .keyframe = keyframe,
+                .pos = filepos,
+                .pts = MP_NOPTS_VALUE,
+                .duration = -1,
+            };
             /* If default_duration is 0, assume no pts value is known
              * for packets after the first one (rather than all pts
              * values being the same). Also, don't use it for extra
              * packets resulting from parsing. */
             if (i == 0 || track->default_duration)
-                dp->pts = mkv_d->last_pts + i * track->default_duration;
-            if (stream->codec->avi_dts)
-                MPSWAP(double, dp->pts, dp->dts);
+                job.pts = mkv_d->last_pts + i * track->default_duration;
             if (i == 0)
-                dp->duration = block_duration / 1e9;
+                job.duration = block_duration / 1e9;
             if (stream->type == STREAM_AUDIO) {
                 unsigned int srate = track->a_sfreq;
-                demux_packet_set_padding(dp,
-                    mkv_d->a_skip_preroll ? track->codec_delay * srate : 0,
-                    block_info->discardpadding / 1e9 * srate);
+                job.skip_start =
+                    mkv_d->a_skip_preroll ? track->codec_delay * srate : 0;
+                job.skip_end = block_info->discardpadding / 1e9 * srate;
                 mkv_d->a_skip_preroll = 0;
             }
 
-            mkv_parse_and_add_packet(demuxer, track, dp);
-            talloc_free_children(track->parser_tmp);
+            add_lace(demuxer, &job, threaded);
             filepos += block.len;
         }
 
@@ -2485,20 +2822,19 @@ static int read_block_group(demuxer_t *demuxer, int64_t end,
                             struct block_info *block)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
-    stream_t *s = demuxer->stream;
     *block = (struct block_info){ .keyframe = true };
 
-    while (stream_tell(s) < end) {
-        switch (ebml_read_id(s)) {
+    while (cluster_tell(demuxer) < end) {
+        switch (cluster_read_id(demuxer)) {
         case MATROSKA_ID_BLOCKDURATION:
-            block->duration = ebml_read_uint(s);
+            block->duration = cluster_read_uint(demuxer);
             if (block->duration == EBML_UINT_INVALID)
                 goto error;
             block->duration *= mkv_d->tc_scale;
             break;
 
         case MATROSKA_ID_DISCARDPADDING:
-            block->discardpadding = ebml_read_uint(s);
+            block->discardpadding = cluster_read_uint(demuxer);
             if (block->discardpadding == EBML_UINT_INVALID)
                 goto error;
             break;
@@ -2509,7 +2845,7 @@ static int read_block_group(demuxer_t *demuxer, int64_t end,
             break;
 
         case MATROSKA_ID_REFERENCEBLOCK:;
-            int64_t num = ebml_read_int(s);
+            int64_t num = cluster_read_int(demuxer);
             if (num == EBML_INT_INVALID)
                 goto error;
             if (num)
@@ -2521,7 +2857,7 @@ static int read_block_group(demuxer_t *demuxer, int64_t end,
             goto error;
 
         default:
-            if (ebml_read_skip(demuxer->log, end, s) != 0)
+            if (cluster_read_skip(demuxer, end) != 0)
                 goto error;
             break;
         }
@@ -2539,18 +2875,20 @@ static int read_next_block(demuxer_t *demuxer, struct block_info *block)
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
     stream_t *s = demuxer->stream;
 
-    if (mkv_d->tmp_block.alloc) {
+    if (mkv_d->tmp_block.buf) {
         *block = mkv_d->tmp_block;
         mkv_d->tmp_block = (struct block_info){0};
         return 1;
     }
 
+    mkv_d->reached_eof = false;
+
     while (1) {
-        while (stream_tell(s) < mkv_d->cluster_end) {
-            int64_t start_filepos = stream_tell(s);
-            switch (ebml_read_id(s)) {
+        while (cluster_tell(demuxer) < mkv_d->cluster_end) {
+            int64_t start_filepos = cluster_tell(demuxer);
+            switch (cluster_read_id(demuxer)) {
             case MATROSKA_ID_TIMECODE: {
-                uint64_t num = ebml_read_uint(s);
+                uint64_t num = cluster_read_uint(demuxer);
                 if (num == EBML_UINT_INVALID)
                     goto find_next_cluster;
                 mkv_d->cluster_tc = num * mkv_d->tc_scale;
@@ -2558,8 +2896,8 @@ static int read_next_block(demuxer_t *demuxer, struct block_info *block)
             }
 
             case MATROSKA_ID_BLOCKGROUP: {
-                int64_t end = ebml_read_length(s);
-                end += stream_tell(s);
+                int64_t end = cluster_read_length(demuxer);
+                end += cluster_tell(demuxer);
                 if (end > mkv_d->cluster_end)
                     goto find_next_cluster;
                 int res = read_block_group(demuxer, end, block);
@@ -2581,6 +2919,7 @@ static int read_next_block(demuxer_t *demuxer, struct block_info *block)
             }
 
             case MATROSKA_ID_CLUSTER:
+                drop_cluster_buf(demuxer, true);
                 mkv_d->cluster_start = start_filepos;
                 goto next_cluster;
 
@@ -2588,26 +2927,34 @@ static int read_next_block(demuxer_t *demuxer, struct block_info *block)
                 goto find_next_cluster;
 
             default: ;
-                if (ebml_read_skip(demuxer->log, mkv_d->cluster_end, s) != 0)
+                if (cluster_read_skip(demuxer, mkv_d->cluster_end) != 0)
                     goto find_next_cluster;
                 break;
             }
         }
 
     find_next_cluster:
+        drop_cluster_buf(demuxer, true);
         mkv_d->cluster_end = 0;
         for (;;) {
             mkv_d->cluster_start = stream_tell(s);
             uint32_t id = ebml_read_id(s);
             if (id == MATROSKA_ID_CLUSTER)
                 break;
-            if (s->eof)
+            if (s->eof) {
+                // A read error also sets the EOF flag; only trust it if the
+                // end of the file was actually reached.
+                int64_t size = stream_get_size(s);
+                mkv_d->reached_eof = !demux_cancel_test(demuxer) &&
+                                     size >= 0 && stream_tell(s) >= size;
                 return -1;
+            }
             if (demux_cancel_test(demuxer))
                 return -1;
             if (id == EBML_ID_EBML && stream_tell(s) >= mkv_d->segment_end) {
                 // Appended segment - don't use its clusters, consider this EOF.
                 stream_seek(s, stream_tell(s) - 4);
+                mkv_d->reached_eof = true;
                 return -1;
             }
             // For the sake of robustness, consider even unknown level 1
@@ -2623,17 +2970,23 @@ static int read_next_block(demuxer_t *demuxer, struct block_info *block)
         // mkv files for "streaming" can have this legally
         if (mkv_d->cluster_end != EBML_UINT_INVALID)
             mkv_d->cluster_end += stream_tell(s);
+        read_cluster_buf(demuxer);
     }
 }
 
 static int demux_mkv_fill_buffer(demuxer_t *demuxer)
 {
+    mkv_demuxer_t *mkv_d = demuxer->priv;
     for (;;) {
         int res;
         struct block_info block;
         res = read_next_block(demuxer, &block);
-        if (res < 0)
-            return 0;
+        if (res < 0) {
+            if (!mkv_d->num_decode_jobs)
+                return 0;
+            flush_decode_jobs(demuxer, 0);
+            return 1;
+        }
         if (res > 0) {
             index_block(demuxer, &block);
             res = handle_block(demuxer, &block);
@@ -2674,14 +3027,17 @@ static int create_index_until(struct demuxer *demuxer, int64_t timecode)
     mkv_index_t *index = get_highest_index_entry(demuxer);
 
     if (!index || index->timecode * mkv_d->tc_scale < timecode) {
+        drop_cluster_buf(demuxer, false);
         stream_seek(s, index ? index->filepos : mkv_d->cluster_start);
         MP_VERBOSE(demuxer, "creating index until TC %" PRId64 "\n", timecode);
         for (;;) {
             int res;
             struct block_info block;
             res = read_next_block(demuxer, &block);
-            if (res < 0)
+            if (res < 0) {
+                mkv_d->index_scanned |= mkv_d->reached_eof;
                 break;
+            }
             if (res > 0) {
                 index_block(demuxer, &block);
                 free_block(&block);
@@ -2768,6 +3124,7 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
                 seek_pos = prev_target;
         }
 
+        drop_cluster_buf(demuxer, false);
         mkv_d->cluster_end = 0;
         stream_seek(demuxer->stream, seek_pos);
     }
@@ -2777,7 +3134,7 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
 static void demux_mkv_seek(demuxer_t *demuxer, double rel_seek_secs, int flags)
 {
     mkv_demuxer_t *mkv_d = demuxer->priv;
-    int64_t old_pos = stream_tell(demuxer->stream);
+    int64_t old_pos = cluster_tell(demuxer);
     uint64_t v_tnum = -1;
     uint64_t a_tnum = -1;
     bool st_active[STREAM_TYPE_COUNT] = {0};
@@ -2821,8 +3178,10 @@ static void demux_mkv_seek(demuxer_t *demuxer, double rel_seek_secs, int flags)
                 index = seek_with_cues(demuxer, -1, target_timecode, cueflags);
         }
 
-        if (!index)
+        if (!index) {
+            drop_cluster_buf(demuxer, false);
             stream_seek(demuxer->stream, old_pos);
+        }
 
         if (flags & SEEK_FORWARD) {
             mkv_d->skip_to_timecode = target_timecode;
@@ -2893,6 +3252,7 @@ static void probe_last_timestamp(struct demuxer *demuxer, int64_t start_pos)
     // In full mode, we start reading data from the current file position,
     // which works because this function is called after headers are parsed.
     if (demuxer->opts->demux_mkv->probe_duration != 2) {
+        drop_cluster_buf(demuxer, false);
         read_deferred_cues(demuxer);
         if (mkv_d->index_complete) {
             // Find last cluster that still has video packets
@@ -2916,15 +3276,25 @@ static void probe_last_timestamp(struct demuxer *demuxer, int64_t start_pos)
         }
     }
 
+    // Reading the entire file anyway, so build the index as a side effect.
+    bool full = demuxer->opts->demux_mkv->probe_duration == 2 &&
+                !mkv_d->index_complete && !mkv_d->num_indexes;
+    if (full && mkv_d->tmp_block.buf)
+        index_block(demuxer, &mkv_d->tmp_block);
+
     free_block(&mkv_d->tmp_block);
 
     int64_t last_ts[STREAM_TYPE_COUNT] = {0};
     while (1) {
         struct block_info block;
         int res = read_next_block(demuxer, &block);
-        if (res < 0)
+        if (res < 0) {
+            mkv_d->index_scanned |= full && mkv_d->reached_eof;
             break;
+        }
         if (res > 0) {
+            if (full)
+                index_block(demuxer, &block);
             if (block.track && block.track->stream) {
                 enum stream_type type = block.track->stream->type;
                 uint64_t endtime = block.timecode + block.duration;
@@ -2938,9 +3308,12 @@ static void probe_last_timestamp(struct demuxer *demuxer, int64_t start_pos)
     if (!last_ts[STREAM_VIDEO])
         last_ts[STREAM_VIDEO] = mkv_d->cluster_tc;
 
-    if (last_ts[STREAM_VIDEO])
+    if (last_ts[STREAM_VIDEO]) {
         mkv_d->duration = last_ts[STREAM_VIDEO] / 1e9 - demuxer->start_time;
+        mkv_d->duration_probed = true;
+    }
 
+    drop_cluster_buf(demuxer, false);
     stream_seek(demuxer->stream, start_pos);
     mkv_d->cluster_start = mkv_d->cluster_end = 0;
 }
@@ -2962,6 +3335,190 @@ static void probe_first_timestamp(struct demuxer *demuxer)
         MP_VERBOSE(demuxer, "Start PTS: %f\n", demuxer->start_time);
 }
 
+// The index file (see --demuxer-mkv-index-dir) stores the seek index and the
+// probed duration, so that opening and seeking in files without (or with
+// slow to read) cues doesn't need to scan the file again. All numbers are
+// stored little endian.
+#define INDEX_FILE_MAGIC "mpvmkvx1"
+#define INDEX_FILE_HEADER_SIZE 64
+#define INDEX_FILE_ENTRY_SIZE 28
+
+#define INDEX_FLAG_COMPLETE 1       // index_complete or index_scanned
+#define INDEX_FLAG_DURATIONS 2      // index_has_durations
+#define INDEX_FLAG_PROBED 4         // duration_probed
+
+// Return the path of the index file, or NULL if disabled. The name is derived
+// from the URL, the file size, and the segment UID.
+static char *get_index_file_path(void *ta_parent, struct demuxer *demuxer)
+{
+    char *dir = demuxer->opts->demux_mkv->index_dir;
+    stream_t *s = demuxer->stream;
+    if (!dir || !dir[0] || !s->url || !demuxer->seekable ||
+        stream_get_size(s) < 0)
+        return NULL;
+
+    uint8_t hash[16];
+    struct AVMD5 *md5 = av_md5_alloc();
+    if (!md5)
+        return NULL;
+    uint8_t size[8];
+    AV_WL64(size, stream_get_size(s));
+    av_md5_init(md5);
+    av_md5_update(md5, s->url, strlen(s->url));
+    av_md5_update(md5, size, sizeof(size));
+    av_md5_update(md5, demuxer->matroska_data.uid.segment, 16);
+    av_md5_final(md5, hash);
+    av_free(md5);
+
+    char *path = mp_get_user_path(ta_parent, demuxer->global, dir);
+    char *name = talloc_strdup(ta_parent, "");
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02X", hash[i]);
+    return mp_path_join(ta_parent, path, name);
+}
+
+static void write_index_header(struct demuxer *demuxer, uint8_t *h, int flags,
+                               uint32_t num_entries)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    memset(h, 0, INDEX_FILE_HEADER_SIZE);
+    memcpy(h, INDEX_FILE_MAGIC, 8);
+    AV_WL64(h + 8, stream_get_size(demuxer->stream));
+    memcpy(h + 16, demuxer->matroska_data.uid.segment, 16);
+    AV_WL64(h + 32, mkv_d->segment_start);
+    AV_WL64(h + 40, mkv_d->tc_scale);
+    AV_WL32(h + 48, flags);
+    AV_WL32(h + 52, num_entries);
+    AV_WL64(h + 56, llrint(mkv_d->duration * 1e9));
+}
+
+static void load_index_file(struct demuxer *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    void *tmp = talloc_new(NULL);
+    FILE *f = NULL;
+
+    char *path = get_index_file_path(tmp, demuxer);
+    if (!path || !(f = fopen(path, "rb")))
+        goto done;
+
+    uint8_t h[INDEX_FILE_HEADER_SIZE], ref[INDEX_FILE_HEADER_SIZE];
+    if (fread(h, sizeof(h), 1, f) != 1)
+        goto done;
+    int flags = AV_RL32(h + 48);
+    uint32_t num_entries = AV_RL32(h + 52);
+    write_index_header(demuxer, ref, flags, num_entries);
+    // Compare everything but the duration.
+    if (memcmp(h, ref, 56) != 0 || num_entries > INT_MAX / 2) {
+        MP_WARN(demuxer, "Index file '%s' doesn't match, ignoring it.\n", path);
+        goto done;
+    }
+
+    // Replace the index read so far; it can't contain more than the file.
+    mkv_d->num_indexes = 0;
+    for (int n = 0; n < mkv_d->num_tracks; n++)
+        mkv_d->tracks[n]->last_index_entry = (size_t)-1;
+    MP_TARRAY_GROW(mkv_d, mkv_d->indexes, num_entries);
+    for (uint32_t i = 0; i < num_entries; i++) {
+        uint8_t e[INDEX_FILE_ENTRY_SIZE];
+        if (fread(e, sizeof(e), 1, f) != 1) {
+            MP_WARN(demuxer, "Index file '%s' is truncated.\n", path);
+            mkv_d->num_indexes = 0;
+            goto done;
+        }
+        int tnum = AV_RL32(e);
+        cue_index_add(demuxer, tnum, AV_RL64(e + 20), AV_RL64(e + 4),
+                      AV_RL64(e + 12));
+        for (int n = 0; n < mkv_d->num_tracks; n++) {
+            if (mkv_d->tracks[n]->tnum == tnum)
+                mkv_d->tracks[n]->last_index_entry = mkv_d->num_indexes - 1;
+        }
+    }
+
+    mkv_d->index_has_durations = flags & INDEX_FLAG_DURATIONS;
+    if (flags & INDEX_FLAG_COMPLETE)
+        mkv_d->index_complete = mkv_d->index_scanned = true;
+    if (flags & INDEX_FLAG_PROBED) {
+        mkv_d->duration = AV_RL64(h + 56) / 1e9;
+        mkv_d->duration_probed = true;
+    }
+    mkv_d->index_file_entries = mkv_d->num_indexes;
+    mkv_d->index_file_scanned = mkv_d->index_scanned;
+    mkv_d->index_file_probed = mkv_d->duration_probed;
+
+    MP_VERBOSE(demuxer, "Loaded %zu index entries from '%s'%s.\n",
+               mkv_d->num_indexes, path,
+               mkv_d->index_complete ? " (complete)" : "");
+
+done:
+    if (f)
+        fclose(f);
+    talloc_free(tmp);
+}
+
+static void save_index_file(struct demuxer *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    bool complete = mkv_d->index_complete || mkv_d->index_scanned;
+
+    // Skip if nothing was added since loading.
+    if (mkv_d->num_indexes == mkv_d->index_file_entries &&
+        complete == mkv_d->index_file_scanned &&
+        mkv_d->duration_probed == mkv_d->index_file_probed)
+        return;
+    if (mkv_d->num_indexes > INT_MAX / 2)
+        return;
+
+    void *tmp = talloc_new(NULL);
+    char *path = get_index_file_path(tmp, demuxer);
+    if (!path)
+        goto done;
+    mp_mkdirp(mp_get_user_path(tmp, demuxer->global,
+                               demuxer->opts->demux_mkv->index_dir));
+
+    // Write to a temporary file first, so that a concurrent reader or an
+    // interrupted write never sees a partial index.
+    char *tmp_path = talloc_asprintf(tmp, "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        MP_WARN(demuxer, "Can't write index file '%s'.\n", path);
+        goto done;
+    }
+
+    int flags = (complete ? INDEX_FLAG_COMPLETE : 0) |
+                (mkv_d->index_has_durations ? INDEX_FLAG_DURATIONS : 0) |
+                (mkv_d->duration_probed ? INDEX_FLAG_PROBED : 0);
+    uint8_t h[INDEX_FILE_HEADER_SIZE];
+    write_index_header(demuxer, h, flags, mkv_d->num_indexes);
+    bool ok = fwrite(h, sizeof(h), 1, f) == 1;
+    for (size_t i = 0; i < mkv_d->num_indexes && ok; i++) {
+        mkv_index_t *index = &mkv_d->indexes[i];
+        uint8_t e[INDEX_FILE_ENTRY_SIZE];
+        AV_WL32(e, index->tnum);
+        AV_WL64(e + 4, index->timecode);
+        AV_WL64(e + 12, index->duration);
+        AV_WL64(e + 20, index->filepos);
+        ok = fwrite(e, sizeof(e), 1, f) == 1;
+    }
+    ok &= fclose(f) == 0;
+#ifdef _WIN32
+    // rename() doesn't replace existing files on win32.
+    if (ok)
+        remove(path);
+#endif
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        MP_WARN(demuxer, "Can't write index file '%s'.\n", path);
+        remove(tmp_path);
+        goto done;
+    }
+    MP_VERBOSE(demuxer, "Wrote %zu index entries to '%s'.\n",
+               mkv_d->num_indexes, path);
+
+done:
+    talloc_free(tmp);
+}
+
 static int demux_mkv_control(demuxer_t *demuxer, int cmd, void *arg)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
@@ -2983,7 +3540,11 @@ static void mkv_free(struct demuxer *demuxer)
     struct mkv_demuxer *mkv_d = demuxer->priv;
     if (!mkv_d)
         return;
+    save_index_file(demuxer);
     mkv_seek_reset(demuxer);
+    talloc_free(mkv_d->decode_pool);
+    pthread_mutex_destroy(&mkv_d->decode_lock);
+    pthread_cond_destroy(&mkv_d->decode_wakeup);
     for (int i = 0; i < mkv_d->num_tracks; i++)
         demux_mkv_free_trackentry(mkv_d->tracks[i]);
 }
@@ -159,23 +159,40 @@ static bool has_source_request(struct tl_ctx *ctx,
     return false;
 }
 
-// segment = get Nth segment of a multi-segment file
-static bool check_file_seg(struct tl_ctx *ctx, char *filename, int segment)
+struct seg_probe {
+    struct tl_ctx *ctx;
+    char *filename;
+    int segment;        // get Nth segment of a multi-segment file
+    bool was_valid;     // result
+    struct demuxer *d;  // result
+};
+
+// Open the given segment if it's one of the wanted ones. This doesn't modify
+// ctx, so it can run concurrently for multiple files.
+static void probe_file_seg(void *p)
 {
-    bool was_valid = false;
+    struct seg_probe *probe = p;
+    struct tl_ctx *ctx = probe->ctx;
     struct demuxer_params params = {
         .force_format = "mkv",
         .matroska_num_wanted_uids = ctx->num_sources,
         .matroska_wanted_uids = ctx->uids,
-        .matroska_wanted_segment = segment,
-        .matroska_was_valid = &was_valid,
+        .matroska_wanted_segment = probe->segment,
+        .matroska_was_valid = &probe->was_valid,
         .disable_cache = true,
     };
     struct mp_cancel *cancel = ctx->tl->cancel;
     if (mp_cancel_test(cancel))
-        return false;
+        return;
 
-    struct demuxer *d = demux_open_url(filename, &params, cancel, ctx->global);
+    probe->d = demux_open_url(probe->filename, &params, cancel, ctx->global);
+}
+
+// Use the probed segment as source if it matches a missing one. Takes
+// ownership of probe->d. Returns whether the next segment should be checked.
+static bool use_file_seg(struct tl_ctx *ctx, struct seg_probe *probe)
+{
+    struct demuxer *d = probe->d;
     if (!d)
         return false;
 
@@ -212,9 +229,16 @@ static bool check_file_seg(struct tl_ctx *ctx, char *filename, int segment)
             if (stream_wants_cache(d->stream, &ctx->global->opts->stream_cache))
             {
                 free_demuxer_and_stream(d);
-                params.disable_cache = false;
-                params.matroska_wanted_uids = ctx->uids; // potentially reallocated, same data
-                d = demux_open_url(filename, &params, cancel, ctx->global);
+                bool was_valid = false;
+                struct demuxer_params params = {
+                    .force_format = "mkv",
+                    .matroska_num_wanted_uids = ctx->num_sources,
+                    .matroska_wanted_uids = ctx->uids,
+                    .matroska_wanted_segment = probe->segment,
+                    .matroska_was_valid = &was_valid,
+                };
+                d = demux_open_url(probe->filename, &params, ctx->tl->cancel,
+                                   ctx->global);
                 if (!d)
                     return false;
             }
@@ -225,7 +249,14 @@ static bool check_file_seg(struct tl_ctx *ctx, char *filename, int segment)
     }
 
     free_demuxer_and_stream(d);
-    return was_valid;
+    return probe->was_valid;
+}
+
+static bool check_file_seg(struct tl_ctx *ctx, char *filename, int segment)
+{
+    struct seg_probe probe = {ctx, filename, segment};
+    probe_file_seg(&probe);
+    return use_file_seg(ctx, &probe);
 }
 
 static void check_file(struct tl_ctx *ctx, char *filename, int first)
@@ -260,8 +291,13 @@ static void find_ordered_chapter_sources(struct tl_ctx *ctx)
             struct playlist *pl =
                 playlist_parse_file(opts->ordered_chapters_files, ctx->global);
             talloc_steal(tmp, pl);
-            for (struct playlist_entry *e = pl->first; e; e = e->next)
-                MP_TARRAY_APPEND(tmp, filenames, num_filenames, e->filename);
+            for (struct playlist_entry *e = pl->first; e; e = e->next) {
+                bool dup = false;
+                for (int i = 0; i < num_filenames; i++)
+                    dup |= strcmp(filenames[i], e->filename) == 0;
+                if (!dup)
+                    MP_TARRAY_APPEND(tmp, filenames, num_filenames, e->filename);
+            }
         } else if (ctx->demuxer->stream->uncached_type != STREAMTYPE_FILE) {
             MP_WARN(ctx, "Playback source is not a "
                     "normal disk file. Will not search for related files.\n");
@@ -276,16 +312,34 @@ static void find_ordered_chapter_sources(struct tl_ctx *ctx)
         check_file(ctx, main_filename, 1);
     }
 
+    // Probe the candidate files concurrently, in batches, and stop as soon as
+    // nothing is missing anymore. Matching them against the missing sources
+    // is done serially and in order, so that the result is the same as when
+    // checking the files one by one.
+    struct seg_probe probes[TIMELINE_MAX_OPEN_THREADS];
     int old_source_count;
     do {
         old_source_count = ctx->num_sources;
-        for (int i = 0; i < num_filenames; i++) {
-            if (!missing(ctx))
-                break;
-            MP_VERBOSE(ctx, "Checking file %s\n", filenames[i]);
-            check_file(ctx, filenames[i], 0);
+        for (int b = 0; b < num_filenames && missing(ctx);
+             b += TIMELINE_MAX_OPEN_THREADS)
+        {
+            int num = MPMIN(num_filenames - b, TIMELINE_MAX_OPEN_THREADS);
+            for (int i = 0; i < num; i++) {
+                MP_VERBOSE(ctx, "Checking file %s\n", filenames[b + i]);
+                probes[i] = (struct seg_probe){ctx, filenames[b + i], 0};
+            }
+            timeline_run_parallel(probe_file_seg, probes, sizeof(probes[0]),
+                                  num);
+            for (int i = 0; i < num; i++) {
+                if (!missing(ctx)) {
+                    free_demuxer_and_stream(probes[i].d);
+                    continue;
+                }
+                if (use_file_seg(ctx, &probes[i]))
+                    check_file(ctx, filenames[b + i], 1);
+            }
         }
-    } while (old_source_count != ctx->num_sources);
+    } while (missing(ctx) && old_source_count != ctx->num_sources);
 
     if (missing(ctx)) {
         MP_ERR(ctx, "Failed to find ordered chapter part!\n");
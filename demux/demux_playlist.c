@@ -19,6 +19,7 @@
 #include <string.h>
 #include <strings.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include "common/common.h"
 #include "options/options.h"
@@ -26,11 +27,20 @@
 #include "common/playlist.h"
 #include "options/path.h"
 #include "stream/stream.h"
+#include "osdep/atomics.h"
 #include "osdep/io.h"
+#include "osdep/threads.h"
 #include "demux.h"
 
 #define PROBE_SIZE (8 * 1024)
 
+// Playlists of at least this size are read in the background, if the caller
+// allows it. Smaller ones are parsed quickly enough anyway.
+#define ASYNC_MIN_SIZE (256 * 1024)
+#define ASYNC_MAX_SIZE (256 * 1024 * 1024)
+// Number of entries handed to the caller at once (after the first entry).
+#define ASYNC_BATCH 4096
+
 static bool check_mimetype(struct stream *s, const char *const *list)
 {
     if (s->mime_type) {
@@ -55,6 +65,25 @@ struct pl_parser {
     enum demux_check check_level;
     struct stream *real_stream;
     char *format;
+    const struct pl_format *fmt;
+
+    // Background reading (see start_async()). The parser thread owns all
+    // fields above, and adds entries to pl, which are moved to pending in
+    // batches.
+    bool async;
+    bstr base_path;
+    int num_entries;            // number of entries in pl
+    bool flushed;
+    atomic_bool abort;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // --- protected by lock
+    struct playlist *pending;
+    char *pending_format;
+    bool done;
+    void (*wakeup_cb)(void *ctx);
+    void *wakeup_ctx;
 };
 
 static char *pl_get_line0(struct pl_parser *p)
@@ -75,16 +104,42 @@ static bstr pl_get_line(struct pl_parser *p)
     return bstr0(pl_get_line0(p));
 }
 
+// Move the entries parsed so far to the pending list.
+static void flush_entries(struct pl_parser *p)
+{
+    if (p->add_base)
+        playlist_add_base_path(p->pl, p->base_path);
+    pthread_mutex_lock(&p->lock);
+    playlist_append_entries(p->pending, p->pl);
+    p->pending_format = p->format;
+    void (*wakeup_cb)(void *ctx) = p->wakeup_cb;
+    void *wakeup_ctx = p->wakeup_ctx;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+    if (wakeup_cb)
+        wakeup_cb(wakeup_ctx);
+    p->num_entries = 0;
+    p->flushed = true;
+}
+
+static void pl_add_entry(struct pl_parser *p, struct playlist_entry *e)
+{
+    playlist_add(p->pl, e);
+    // Hand out the first entry immediately, so playback can start.
+    if (p->async && ++p->num_entries >= (p->flushed ? ASYNC_BATCH : 1))
+        flush_entries(p);
+}
+
 static void pl_add(struct pl_parser *p, bstr entry)
 {
     char *s = bstrto0(NULL, entry);
-    playlist_add_file(p->pl, s);
+    pl_add_entry(p, playlist_entry_new(s));
     talloc_free(s);
 }
 
 static bool pl_eof(struct pl_parser *p)
 {
-    return p->error || p->s->eof;
+    return p->error || p->s->eof || atomic_load(&p->abort);
 }
 
 static bool maybe_text(bstr d)
@@ -129,7 +184,7 @@ ok:
             talloc_free(fn);
             e->title = talloc_steal(e, title);
             title = NULL;
-            playlist_add(p->pl, e);
+            pl_add_entry(p, e);
         }
         line = bstr_strip(pl_get_line(p));
     }
@@ -154,7 +209,8 @@ static int parse_ref_init(struct pl_parser *p)
     bstr burl = bstr0(p->s->url);
     if (bstr_eatstart0(&burl, "http://") && check_mimetype(p->s, mmsh_types)) {
         MP_INFO(p, "Redirecting to mmsh://\n");
-        playlist_add_file(p->pl, talloc_asprintf(p, "mmsh://%.*s", BSTR_P(burl)));
+        pl_add_entry(p, playlist_entry_new(talloc_asprintf(p, "mmsh://%.*s",
+                                                           BSTR_P(burl))));
         return 0;
     }
 
@@ -231,23 +287,41 @@ static int parse_dir(struct pl_parser *p)
         return -1;
     }
 
-    char **files = NULL;
+    // Store all names in a single buffer, instead of allocating each of them
+    // separately (directories can contain a huge number of files).
+    void *tmp = talloc_new(NULL);
+    char *names = NULL;
+    size_t names_size = 0;
+    size_t *offsets = NULL;
     int num_files = 0;
 
     struct dirent *ep;
     while ((ep = readdir(dp))) {
         if (ep->d_name[0] == '.')
             continue;
-        MP_TARRAY_APPEND(p, files, num_files, talloc_strdup(p, ep->d_name));
+        size_t len = strlen(ep->d_name) + 1;
+        MP_TARRAY_GROW(tmp, names, names_size + len);
+        memcpy(names + names_size, ep->d_name, len);
+        MP_TARRAY_APPEND(tmp, offsets, num_files, names_size);
+        names_size += len;
     }
 
-    if (files)
-        qsort(files, num_files, sizeof(files[0]), cmp_filename);
+    closedir(dp);
 
+    char **files = talloc_array(tmp, char *, num_files);
     for (int n = 0; n < num_files; n++)
-        playlist_add_file(p->pl, mp_path_join(p, path, files[n]));
+        files[n] = names + offsets[n];
 
-    closedir(dp);
+    if (num_files)
+        qsort(files, num_files, sizeof(files[0]), cmp_filename);
+
+    for (int n = 0; n < num_files; n++) {
+        char *file = mp_path_join(NULL, path, files[n]);
+        playlist_add_file(p->pl, file);
+        talloc_free(file);
+    }
+
+    talloc_free(tmp);
 
     p->add_base = false;
 
@@ -290,6 +364,59 @@ static const struct pl_format *probe_pl(struct pl_parser *p)
     return NULL;
 }
 
+static void *parse_thread(void *arg)
+{
+    struct pl_parser *p = arg;
+    mpthread_set_name("playlist");
+
+    p->fmt->parse(p);
+    flush_entries(p);
+
+    pthread_mutex_lock(&p->lock);
+    p->done = true;
+    void (*wakeup_cb)(void *ctx) = p->wakeup_cb;
+    void *wakeup_ctx = p->wakeup_ctx;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+    if (wakeup_cb)
+        wakeup_cb(wakeup_ctx);
+    return NULL;
+}
+
+// Read the playlist file into memory, and parse it on a separate thread. This
+// is done only for large line-based playlists. Returns false if the playlist
+// should be parsed synchronously.
+static bool start_async(struct pl_parser *p, struct demuxer *demuxer)
+{
+    if (p->fmt->parse != parse_m3u && p->fmt->parse != parse_pls &&
+        p->fmt->parse != parse_txt)
+        return false;
+
+    int64_t start = stream_tell(p->s);
+    int64_t size = stream_get_size(p->s) - start;
+    if (size < ASYNC_MIN_SIZE || size > ASYNC_MAX_SIZE)
+        return false;
+
+    bstr data = stream_read_complete(p->s, NULL, ASYNC_MAX_SIZE);
+    if (!data.start) {
+        p->error |= !stream_seek(p->s, start);
+        return false;
+    }
+    p->s = open_memory_stream(data.start, data.len);
+    talloc_free(data.start);
+
+    p->async = true;
+    p->base_path = bstrdup(p, mp_dirname(demuxer->filename));
+    p->pending = talloc_zero(p, struct playlist);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
+    if (pthread_create(&p->thread, NULL, parse_thread, p)) {
+        parse_thread(p);
+        p->async = false;
+    }
+    return true;
+}
+
 static int open_file(struct demuxer *demuxer, enum demux_check check)
 {
     bool force = check < DEMUX_CHECK_UNSAFE || check == DEMUX_CHECK_REQUEST;
@@ -317,20 +444,71 @@ static int open_file(struct demuxer *demuxer, enum demux_check check)
 
     p->probing = false;
     p->error = false;
+    p->fmt = fmt;
     p->s = demuxer->stream;
     p->utf16 = stream_skip_bom(p->s);
-    bool ok = fmt->parse(p) >= 0 && !p->error;
+    demuxer->fully_read = true;
+
+    if (demuxer->params && demuxer->params->playlist_async &&
+        start_async(p, demuxer))
+    {
+        // Return as soon as the first entry is available.
+        pthread_mutex_lock(&p->lock);
+        while (!p->pending->first && !p->done)
+            pthread_cond_wait(&p->wakeup, &p->lock);
+        demuxer->playlist = talloc_zero(demuxer, struct playlist);
+        playlist_append_entries(demuxer->playlist, p->pending);
+        demuxer->filetype = p->pending_format ? p->pending_format : fmt->name;
+        pthread_mutex_unlock(&p->lock);
+        demuxer->priv = p;
+        return 0;
+    }
+
+    bool ok = !p->error && fmt->parse(p) >= 0 && !p->error;
     if (p->add_base)
         playlist_add_base_path(p->pl, mp_dirname(demuxer->filename));
     demuxer->playlist = talloc_steal(demuxer, p->pl);
     demuxer->filetype = p->format ? p->format : fmt->name;
-    demuxer->fully_read = true;
     talloc_free(p);
     return ok ? 0 : -1;
 }
 
+static void close_file(struct demuxer *demuxer)
+{
+    struct pl_parser *p = demuxer->priv;
+    if (!p)
+        return;
+    if (p->async) {
+        atomic_store(&p->abort, true);
+        pthread_join(p->thread, NULL);
+    }
+    free_stream(p->s);
+    pthread_cond_destroy(&p->wakeup);
+    pthread_mutex_destroy(&p->lock);
+    talloc_free(p);
+}
+
+static int control(struct demuxer *demuxer, int cmd, void *arg)
+{
+    struct pl_parser *p = demuxer->priv;
+    if (cmd != DEMUXER_CTRL_PLAYLIST_UPDATE || !p)
+        return DEMUXER_CTRL_NOTIMPL;
+
+    struct demux_ctrl_playlist_update *u = arg;
+    pthread_mutex_lock(&p->lock);
+    p->wakeup_cb = u->wakeup_cb;
+    p->wakeup_ctx = u->wakeup_ctx;
+    if (u->pl)
+        playlist_append_entries(u->pl, p->pending);
+    u->done = p->done;
+    pthread_mutex_unlock(&p->lock);
+    return DEMUXER_CTRL_OK;
+}
+
 const struct demuxer_desc demuxer_desc_playlist = {
     .name = "playlist",
     .desc = "Playlist file",
     .open = open_file,
+    .close = close_file,
+    .control = control,
 };
@@ -22,6 +22,8 @@
 #include <unistd.h>
 #include <string.h>
 
+#include <libavutil/buffer.h>
+
 #include "options/m_option.h"
 #include "options/options.h"
 
@@ -247,17 +249,23 @@ static int raw_fill_buffer(demuxer_t *demuxer)
     if (demuxer->stream->eof)
         return 0;
 
-    struct demux_packet *dp = new_demux_packet(p->frame_size * p->read_frames);
+    int64_t pos = stream_tell(demuxer->stream);
+
+    // Possibly references the stream cache memory instead of copying.
+    AVBufferRef *buf = stream_read_ref(demuxer->stream,
+                                       p->frame_size * p->read_frames);
+    if (!buf)
+        return 0;
+    struct demux_packet *dp = new_demux_packet_from_buf(buf, buf->data, buf->size);
+    av_buffer_unref(&buf);
     if (!dp) {
         MP_ERR(demuxer, "Can't read packet.\n");
         return 1;
     }
 
-    dp->pos = stream_tell(demuxer->stream);
+    dp->pos = pos;
     dp->pts = (dp->pos  / p->frame_size) / p->frame_rate;
 
-    int len = stream_read(demuxer->stream, dp->buffer, dp->len);
-    demux_packet_shorten(dp, len);
     demux_add_packet(p->sh, dp);
 
     return 1;
@@ -73,6 +73,28 @@ uint32_t ebml_read_id(stream_t *s)
     return id;
 }
 
+/*
+ * Read: the element content data ID, from memory.
+ * Return: the ID. On error, the buffer is not advanced.
+ */
+uint32_t ebml_read_id_buf(bstr *buffer)
+{
+    int i, len_mask = 0x80;
+    uint32_t id;
+
+    if (buffer->len == 0)
+        return EBML_ID_INVALID;
+    for (i = 0, id = buffer->start[0]; i < 4 && !(id & len_mask); i++)
+        len_mask >>= 1;
+    if (i >= 4 || i + 1 > buffer->len)
+        return EBML_ID_INVALID;
+    for (int n = 0; n < i; n++)
+        id = (id << 8) | buffer->start[n + 1];
+    buffer->start += i + 1;
+    buffer->len -= i + 1;
+    return id;
+}
+
 /*
  * Read a variable length unsigned int.
  */
@@ -193,6 +215,42 @@ int64_t ebml_read_int(stream_t *s)
     return (int64_t)value; // assume complement of 2
 }
 
+/*
+ * Read the next element as an unsigned int, from memory.
+ */
+uint64_t ebml_read_uint_buf(bstr *buffer)
+{
+    bstr b = *buffer;
+    uint64_t len = ebml_read_vlen_uint(&b);
+    if (len == EBML_UINT_INVALID || len > 8 || len > b.len)
+        return EBML_UINT_INVALID;
+
+    uint64_t value = 0;
+    for (int n = 0; n < len; n++)
+        value = (value << 8) | b.start[n];
+    *buffer = bstr_cut(b, len);
+    return value;
+}
+
+/*
+ * Read the next element as a signed int, from memory.
+ */
+int64_t ebml_read_int_buf(bstr *buffer)
+{
+    bstr b = *buffer;
+    uint64_t len = ebml_read_vlen_uint(&b);
+    if (len == EBML_UINT_INVALID || len > 8 || len > b.len)
+        return EBML_INT_INVALID;
+
+    uint64_t value = 0;
+    if (len && (b.start[0] & 0x80))
+        value = -1;
+    for (int n = 0; n < len; n++)
+        value = (value << 8) | b.start[n];
+    *buffer = bstr_cut(b, len);
+    return (int64_t)value; // assume complement of 2
+}
+
 /*
  * Skip the current element.
  * end: the end of the parent element or -1 (for robust error handling)
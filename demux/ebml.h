@@ -80,11 +80,14 @@ struct ebml_parse_ctx {
 
 bool ebml_is_mkv_level1_id(uint32_t id);
 uint32_t ebml_read_id (stream_t *s);
+uint32_t ebml_read_id_buf(bstr *buffer);
 uint64_t ebml_read_vlen_uint (bstr *buffer);
 int64_t ebml_read_vlen_int (bstr *buffer);
 uint64_t ebml_read_length (stream_t *s);
 uint64_t ebml_read_uint (stream_t *s);
 int64_t ebml_read_int (stream_t *s);
+uint64_t ebml_read_uint_buf(bstr *buffer);
+int64_t ebml_read_int_buf(bstr *buffer);
 int ebml_read_skip(struct mp_log *log, int64_t end, stream_t *s);
 int ebml_resync_cluster(struct mp_log *log, stream_t *s);
 
@@ -71,6 +71,21 @@ struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
     return dp;
 }
 
+// Create a packet referencing len bytes at data, which must be within buf (the
+// caller keeps its own reference). Unlike new_demux_packet_from(), this
+// doesn't copy the data. The data must be followed by
+// FF_INPUT_BUFFER_PADDING_SIZE readable bytes.
+struct demux_packet *new_demux_packet_from_buf(struct AVBufferRef *buf,
+                                               void *data, size_t len)
+{
+    if (len > INT_MAX)
+        return NULL;
+    assert((uint8_t *)data >= buf->data &&
+           (uint8_t *)data + len <= buf->data + buf->size);
+    AVPacket pkt = { .buf = buf, .data = data, .size = len };
+    return new_demux_packet_from_avpacket(&pkt);
+}
+
 // Input data doesn't need to be padded.
 struct demux_packet *new_demux_packet_from(void *data, size_t len)
 {
@@ -92,7 +107,12 @@ void demux_packet_shorten(struct demux_packet *dp, size_t len)
 {
     assert(len <= dp->len);
     dp->len = len;
-    memset(dp->buffer + dp->len, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    if (dp->avpacket)
+        dp->avpacket->size = len;
+    // Don't write to memory shared with other packets or the stream cache.
+    if (!dp->avpacket || !dp->avpacket->buf ||
+        av_buffer_is_writable(dp->avpacket->buf))
+        memset(dp->buffer + dp->len, 0, FF_INPUT_BUFFER_PADDING_SIZE);
 }
 
 void free_demux_packet(struct demux_packet *dp)
@@ -100,6 +120,30 @@ void free_demux_packet(struct demux_packet *dp)
     talloc_free(dp);
 }
 
+#define ROUND_ALLOC(s) MP_ALIGN_UP(s, 64)
+
+// Estimate the memory a queued packet occupies: the payload plus input padding,
+// and the allocation overhead of the packet structs and side data. If the
+// payload is part of a larger buffer (like an in-memory mkv cluster), the
+// whole buffer is counted, because the packet keeps it alive. This
+// overestimates if several queued packets share a buffer; demuxers copy
+// packets that are small relative to the buffer, which bounds this.
+size_t demux_packet_estimate_total_size(struct demux_packet *dp)
+{
+    size_t payload = dp->len;
+    if (dp->avpacket && dp->avpacket->buf)
+        payload = MPMAX(payload, dp->avpacket->buf->size);
+    size_t size = ROUND_ALLOC(sizeof(struct demux_packet));
+    size += ROUND_ALLOC(payload + FF_INPUT_BUFFER_PADDING_SIZE);
+    if (dp->avpacket) {
+        size += ROUND_ALLOC(sizeof(AVPacket));
+        size += ROUND_ALLOC(sizeof(AVBufferRef)) * 2; // ref + underlying buffer
+        for (int n = 0; n < dp->avpacket->side_data_elems; n++)
+            size += ROUND_ALLOC(dp->avpacket->side_data[n].size);
+    }
+    return size;
+}
+
 void demux_packet_copy_attribs(struct demux_packet *dst, struct demux_packet *src)
 {
     dst->pts = src->pts;
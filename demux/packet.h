@@ -22,6 +22,8 @@
 #include <stddef.h>
 #include <inttypes.h>
 
+struct AVBufferRef;
+
 // Holds one packet/frame/whatever
 typedef struct demux_packet {
     int len;
@@ -39,8 +41,11 @@ typedef struct demux_packet {
 struct demux_packet *new_demux_packet(size_t len);
 struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt);
 struct demux_packet *new_demux_packet_from(void *data, size_t len);
+struct demux_packet *new_demux_packet_from_buf(struct AVBufferRef *buf,
+                                               void *data, size_t len);
 void demux_packet_shorten(struct demux_packet *dp, size_t len);
 void free_demux_packet(struct demux_packet *dp);
+size_t demux_packet_estimate_total_size(struct demux_packet *dp);
 struct demux_packet *demux_copy_packet(struct demux_packet *dp);
 
 void demux_packet_copy_attribs(struct demux_packet *dst, struct demux_packet *src);
@@ -0,0 +1,219 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <libavutil/md5.h>
+#include <libavutil/intreadwrite.h>
+
+#include "osdep/io.h"
+
+#include "common/common.h"
+#include "common/global.h"
+#include "common/msg.h"
+#include "options/options.h"
+#include "options/path.h"
+#include "stream/stream.h"
+
+#include "probe_cache.h"
+
+#define PROBE_FILE_MAGIC "mpvprobe1"
+
+// Number of entries kept in memory. The cache only provides hints, so it's
+// fine to forget entries (the persistent files are never pruned by mpv).
+#define MAX_ENTRIES 256
+
+struct probe_entry {
+    bool valid;
+    uint8_t key[16];
+    struct demux_probe_info info;
+};
+
+// Shared by all mpv instances in the process; harmless, because entries are
+// keyed by file identity and only used as hints.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct probe_entry cache_entries[MAX_ENTRIES];
+static int cache_next_replace;
+
+static bool probe_cache_enabled(struct mpv_global *global)
+{
+    struct MPOpts *opts = global->opts;
+    return opts->demuxer_probe_cache ||
+           (opts->demuxer_probe_cache_dir && opts->demuxer_probe_cache_dir[0]);
+}
+
+// The file identity is the URL plus the file size, and for local files the
+// modification time. Returns false if the stream can't be identified (e.g.
+// unknown size).
+static bool get_key(struct stream *stream, uint8_t key[16])
+{
+    int64_t size = stream_get_size(stream);
+    if (!stream->url || size <= 0)
+        return false;
+    int64_t mtime = 0;
+    struct stat st;
+    if (stream->uncached_type == STREAMTYPE_FILE && stream->path &&
+        stat(stream->path, &st) == 0)
+        mtime = st.st_mtime;
+    struct AVMD5 *md5 = av_md5_alloc();
+    if (!md5)
+        return false;
+    uint8_t size_le[8], mtime_le[8];
+    AV_WL64(size_le, size);
+    AV_WL64(mtime_le, mtime);
+    av_md5_init(md5);
+    av_md5_update(md5, stream->url, strlen(stream->url));
+    av_md5_update(md5, size_le, sizeof(size_le));
+    av_md5_update(md5, mtime_le, sizeof(mtime_le));
+    av_md5_final(md5, key);
+    av_free(md5);
+    return true;
+}
+
+static char *get_file_path(void *ta_parent, struct mpv_global *global,
+                           uint8_t key[16])
+{
+    char *dir = global->opts->demuxer_probe_cache_dir;
+    if (!dir || !dir[0])
+        return NULL;
+    char *path = mp_get_user_path(ta_parent, global, dir);
+    char *name = talloc_strdup(ta_parent, "");
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02X", key[i]);
+    return mp_path_join(ta_parent, path, name);
+}
+
+// Read one line into buf (without newline). Returns false on error.
+static bool read_line(FILE *f, char *buf, size_t size)
+{
+    if (!fgets(buf, size, f))
+        return false;
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return true;
+}
+
+static bool load_file(struct mpv_global *global, uint8_t key[16],
+                      struct demux_probe_info *info)
+{
+    void *tmp = talloc_new(NULL);
+    bool ok = false;
+    char *path = get_file_path(tmp, global, key);
+    FILE *f = path ? fopen(path, "rb") : NULL;
+    if (f) {
+        char magic[16], bytes[32];
+        ok = read_line(f, magic, sizeof(magic)) &&
+             strcmp(magic, PROBE_FILE_MAGIC) == 0 &&
+             read_line(f, info->demuxer, sizeof(info->demuxer)) &&
+             read_line(f, info->lavf_format, sizeof(info->lavf_format)) &&
+             read_line(f, info->layout, sizeof(info->layout)) &&
+             read_line(f, bytes, sizeof(bytes)) &&
+             sscanf(bytes, "%"SCNd64, &info->probe_bytes) == 1 &&
+             info->demuxer[0];
+        fclose(f);
+    }
+    talloc_free(tmp);
+    return ok;
+}
+
+static void save_file(struct mpv_global *global, uint8_t key[16],
+                      struct demux_probe_info *info)
+{
+    void *tmp = talloc_new(NULL);
+    char *path = get_file_path(tmp, global, key);
+    if (path) {
+        mp_mkdirp(mp_get_user_path(tmp, global,
+                                   global->opts->demuxer_probe_cache_dir));
+        // Write to a temporary file first, so that concurrent readers never
+        // see a partial entry.
+        char *tmp_path = talloc_asprintf(tmp, "%s.tmp", path);
+        FILE *f = fopen(tmp_path, "wb");
+        if (f) {
+            bool ok = fprintf(f, "%s\n%s\n%s\n%s\n%"PRId64"\n",
+                              PROBE_FILE_MAGIC, info->demuxer,
+                              info->lavf_format, info->layout,
+                              info->probe_bytes) > 0;
+            ok &= fclose(f) == 0;
+#ifdef _WIN32
+            // rename() doesn't replace existing files on win32.
+            if (ok)
+                remove(path);
+#endif
+            if (!ok || rename(tmp_path, path) != 0)
+                remove(tmp_path);
+        }
+    }
+    talloc_free(tmp);
+}
+
+// Look up the probe result of a previous open of the same file. Returns false
+// if there is none, or if the cache is disabled.
+bool demux_probe_cache_lookup(struct mpv_global *global, struct stream *stream,
+                              struct demux_probe_info *info)
+{
+    uint8_t key[16];
+    if (!probe_cache_enabled(global) || !get_key(stream, key))
+        return false;
+
+    bool found = false;
+    pthread_mutex_lock(&cache_lock);
+    for (int n = 0; n < MAX_ENTRIES; n++) {
+        struct probe_entry *e = &cache_entries[n];
+        if (e->valid && memcmp(e->key, key, 16) == 0) {
+            *info = e->info;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (!found && load_file(global, key, info)) {
+        demux_probe_cache_store(global, stream, info, false);
+        found = true;
+    }
+    return found;
+}
+
+// Remember the probe result for the stream. If persist is set, also write it
+// to the cache directory (if configured).
+void demux_probe_cache_store(struct mpv_global *global, struct stream *stream,
+                             struct demux_probe_info *info, bool persist)
+{
+    uint8_t key[16];
+    if (!probe_cache_enabled(global) || !get_key(stream, key))
+        return;
+
+    pthread_mutex_lock(&cache_lock);
+    struct probe_entry *e = NULL;
+    for (int n = 0; n < MAX_ENTRIES; n++) {
+        if (cache_entries[n].valid && memcmp(cache_entries[n].key, key, 16) == 0)
+            e = &cache_entries[n];
+    }
+    if (!e) {
+        e = &cache_entries[cache_next_replace];
+        cache_next_replace = (cache_next_replace + 1) % MAX_ENTRIES;
+    }
+    *e = (struct probe_entry){ .valid = true, .info = *info };
+    memcpy(e->key, key, 16);
+    pthread_mutex_unlock(&cache_lock);
+
+    if (persist)
+        save_file(global, key, info);
+}
@@ -0,0 +1,23 @@
+#ifndef MP_DEMUX_PROBE_CACHE_H
+#define MP_DEMUX_PROBE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mpv_global;
+struct stream;
+
+// Result of a successful demux_open() on a file.
+struct demux_probe_info {
+    char demuxer[32];       // demuxer_desc.name
+    char lavf_format[32];   // libavformat format name (demux_lavf only)
+    char layout[64];        // stream types, one letter per stream
+    int64_t probe_bytes;    // bytes read until the demuxer was opened
+};
+
+bool demux_probe_cache_lookup(struct mpv_global *global, struct stream *stream,
+                              struct demux_probe_info *info);
+void demux_probe_cache_store(struct mpv_global *global, struct stream *stream,
+                             struct demux_probe_info *info, bool persist);
+
+#endif
@@ -1,4 +1,11 @@
+#include <assert.h>
+#include <pthread.h>
+
 #include "common/common.h"
+#include "common/global.h"
+#include "common/msg.h"
+#include "misc/thread_pool.h"
+#include "options/options.h"
 #include "stream/stream.h"
 #include "demux.h"
 
@@ -27,10 +34,35 @@ struct timeline *timeline_load(struct mpv_global *global, struct mp_log *log,
     return NULL;
 }
 
+struct timeline_lazy {
+    int max_open;
+    uint64_t *last_used;    // per source; for picking the LRU source
+    uint64_t use_counter;
+
+    // Background open of the source of the next part.
+    struct mp_cancel *cancel;
+    pthread_t thread;
+    bool opening;
+    int open_source;
+    struct demuxer *open_result;
+
+    // Result of timeline_open_part() (part_source is -1 if not called).
+    int part_source;
+    struct demuxer *part_result;
+};
+
+static void lazy_join(struct timeline *tl);
+static void lazy_install(struct timeline *tl);
+
 void timeline_destroy(struct timeline *tl)
 {
     if (!tl)
         return;
+    if (tl->lazy) {
+        mp_cancel_trigger(tl->lazy->cancel);
+        lazy_join(tl);
+        lazy_install(tl);
+    }
     for (int n = 0; n < tl->num_sources; n++) {
         struct demuxer *d = tl->sources[n];
         if (d != tl->demuxer)
@@ -38,3 +70,218 @@ void timeline_destroy(struct timeline *tl)
     }
     talloc_free(tl);
 }
+
+static bool is_pinned(struct timeline *tl, int source)
+{
+    struct demuxer *d = tl->sources[source];
+    return d && (d == tl->demuxer || d == tl->track_layout);
+}
+
+static void set_source(struct timeline *tl, int source, struct demuxer *d)
+{
+    tl->sources[source] = d;
+    for (int n = 0; n < tl->num_parts; n++) {
+        if (tl->parts[n].source_index == source)
+            tl->parts[n].source = d;
+    }
+}
+
+static int count_open(struct timeline *tl)
+{
+    int count = 0;
+    for (int n = 0; n < tl->num_sources; n++)
+        count += tl->sources[n] && !is_pinned(tl, n);
+    return count;
+}
+
+// Close least recently used sources until the limit is met. Sources with a
+// last_used stamp >= keep_from (those that were just activated) are kept.
+static void close_unused(struct timeline *tl, uint64_t keep_from)
+{
+    struct timeline_lazy *lazy = tl->lazy;
+    while (count_open(tl) > lazy->max_open) {
+        int lru = -1;
+        for (int n = 0; n < tl->num_sources; n++) {
+            if (!tl->sources[n] || is_pinned(tl, n) ||
+                lazy->last_used[n] >= keep_from)
+                continue;
+            if (lru < 0 || lazy->last_used[n] < lazy->last_used[lru])
+                lru = n;
+        }
+        if (lru < 0)
+            break;
+        MP_VERBOSE(tl, "Closing timeline source %s\n", tl->source_urls[lru]);
+        free_demuxer_and_stream(tl->sources[lru]);
+        set_source(tl, lru, NULL);
+    }
+}
+
+static struct demuxer *open_lazy_source(struct timeline *tl, int source)
+{
+    MP_VERBOSE(tl, "Opening timeline source %s\n", tl->source_urls[source]);
+    struct demuxer *d = demux_open_url(tl->source_urls[source], NULL,
+                                       tl->lazy->cancel, tl->global);
+    if (!d)
+        MP_ERR(tl, "Could not open source file '%s'.\n", tl->source_urls[source]);
+    return d;
+}
+
+static void *open_thread(void *p)
+{
+    struct timeline *tl = p;
+    tl->lazy->open_result = open_lazy_source(tl, tl->lazy->open_source);
+    return NULL;
+}
+
+// Wait for the background open (if any). Doesn't touch the sources.
+static void lazy_join(struct timeline *tl)
+{
+    struct timeline_lazy *lazy = tl->lazy;
+    if (!lazy->opening)
+        return;
+    pthread_join(lazy->thread, NULL);
+    lazy->opening = false;
+}
+
+// Make the results of finished opens available.
+static void lazy_install(struct timeline *tl)
+{
+    struct timeline_lazy *lazy = tl->lazy;
+    assert(!lazy->opening);
+    if (lazy->open_result) {
+        assert(!tl->sources[lazy->open_source]);
+        set_source(tl, lazy->open_source, lazy->open_result);
+        lazy->open_result = NULL;
+    }
+    if (lazy->part_result) {
+        assert(!tl->sources[lazy->part_source]);
+        set_source(tl, lazy->part_source, lazy->part_result);
+        lazy->part_result = NULL;
+    }
+    lazy->part_source = -1;
+}
+
+// Return how many sources timeline_enable_lazy_sources() will leave open (not
+// counting the main demuxer and the track layout), or -1 if it won't enable
+// lazy sources. Timeline loaders can use this to avoid keeping all sources
+// open while loading. tl->source_urls and tl->num_sources must be set.
+int timeline_get_max_open_sources(struct timeline *tl)
+{
+    int max_open = tl->global->opts->edl_max_open_sources;
+    if (!tl->source_urls || max_open < 1 || tl->num_sources <= max_open + 1)
+        return -1;
+    return max_open;
+}
+
+// Switch the timeline to lazy source handling, if enabled by the options and
+// supported by the timeline loader. Must be called after the parts were set
+// up; closes sources exceeding the limit right away.
+void timeline_enable_lazy_sources(struct timeline *tl)
+{
+    int max_open = timeline_get_max_open_sources(tl);
+    if (max_open < 0)
+        return;
+
+    struct timeline_lazy *lazy = talloc_zero(tl, struct timeline_lazy);
+    lazy->max_open = max_open;
+    lazy->last_used = talloc_zero_array(lazy, uint64_t, tl->num_sources);
+    lazy->cancel = mp_cancel_new(lazy);
+    // Abort opening sources when playback is aborted.
+    if (tl->cancel)
+        mp_cancel_set_parent(lazy->cancel, tl->cancel);
+    lazy->part_source = -1;
+    tl->lazy = lazy;
+
+    // Keep the sources of the first parts.
+    uint64_t keep_from = ++lazy->use_counter;
+    for (int n = 0; n < MPMIN(tl->num_parts, 2); n++)
+        lazy->last_used[tl->parts[n].source_index] = keep_from;
+    close_unused(tl, keep_from);
+}
+
+// Do the blocking work of timeline_activate_part(part): wait for the
+// background open, and open the source of the part if needed. This doesn't
+// change the visible timeline state, so it can run on another thread while
+// the timeline is in use (but not concurrently with other timeline calls).
+// Optional; timeline_activate_part() does this itself if it wasn't called.
+void timeline_open_part(struct timeline *tl, int part)
+{
+    assert(part >= 0 && part < tl->num_parts);
+    struct timeline_lazy *lazy = tl->lazy;
+    if (!lazy)
+        return;
+
+    int cur = tl->parts[part].source_index;
+    lazy_join(tl);
+    if (lazy->part_source == cur)
+        return;
+    if (lazy->part_result) {
+        free_demuxer_and_stream(lazy->part_result);
+        lazy->part_result = NULL;
+    }
+    lazy->part_source = cur;
+    if (!tl->sources[cur] &&
+        !(lazy->open_result && lazy->open_source == cur))
+        lazy->part_result = open_lazy_source(tl, cur);
+}
+
+// Make sure the source of the given part is open, and return it. This also
+// starts opening the source of the following part in the background, and
+// closes sources which were not used recently. Returns NULL on failure.
+struct demuxer *timeline_activate_part(struct timeline *tl, int part)
+{
+    assert(part >= 0 && part < tl->num_parts);
+    struct timeline_lazy *lazy = tl->lazy;
+    if (!lazy)
+        return tl->parts[part].source;
+
+    int cur = tl->parts[part].source_index;
+    timeline_open_part(tl, part);
+    lazy_install(tl);
+
+    uint64_t keep_from = ++lazy->use_counter;
+    lazy->last_used[cur] = keep_from;
+
+    int next = part + 1 < tl->num_parts ? tl->parts[part + 1].source_index : -1;
+    if (next >= 0) {
+        lazy->last_used[next] = keep_from;
+        if (!tl->sources[next]) {
+            lazy->open_source = next;
+            lazy->open_result = NULL;
+            lazy->opening = !pthread_create(&lazy->thread, NULL, open_thread, tl);
+        }
+    }
+
+    close_unused(tl, keep_from);
+    return tl->sources[cur];
+}
+
+// Return a name for the given source, which works even if it's closed.
+char *timeline_get_source_url(struct timeline *tl, int source)
+{
+    if (tl->source_urls)
+        return tl->source_urls[source];
+    return tl->sources[source] ? tl->sources[source]->filename : "";
+}
+
+// Run fn on each of the num_items items (each item_size bytes large, starting
+// at items), using a bounded number of threads. Returns once all calls are
+// done. This is meant for opening timeline sources, which mostly waits on I/O.
+void timeline_run_parallel(void (*fn)(void *item), void *items,
+                           size_t item_size, int num_items)
+{
+    struct mp_thread_pool *pool = NULL;
+    if (num_items > 1) {
+        int threads = MPMIN(num_items, TIMELINE_MAX_OPEN_THREADS);
+        pool = mp_thread_pool_create(NULL, threads);
+    }
+    for (int n = 0; n < num_items; n++) {
+        void *item = (char *)items + n * item_size;
+        if (pool) {
+            mp_thread_pool_queue(pool, fn, item);
+        } else {
+            fn(item);
+        }
+    }
+    talloc_free(pool);
+}
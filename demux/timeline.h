@@ -1,12 +1,20 @@
 #ifndef MP_TIMELINE_H_
 #define MP_TIMELINE_H_
 
+#include <stddef.h>
+
+// Maximum number of sources opened concurrently.
+#define TIMELINE_MAX_OPEN_THREADS 8
+
 struct timeline_part {
     double start;
     double source_start;
-    struct demuxer *source;
+    struct demuxer *source; // NULL if currently closed (lazy sources only)
+    int source_index;       // index into timeline.sources (lazy sources only)
 };
 
+struct timeline_lazy;
+
 struct timeline {
     struct mpv_global *global;
     struct mp_log *log;
@@ -19,6 +27,13 @@ struct timeline {
     struct demuxer **sources;
     int num_sources;
 
+    // If set by the timeline loader, sources[n] can be reopened with
+    // demux_open_url(source_urls[n]), and sources which are not in use may be
+    // closed (then sources[n] and the parts referencing it are NULL). The
+    // main demuxer and the track layout source are never closed.
+    char **source_urls;
+    struct timeline_lazy *lazy;
+
     // Segments to play, ordered by time. parts[num_parts] must be valid; its
     // start field sets the duration, and source must be NULL.
     struct timeline_part *parts;
@@ -35,4 +50,13 @@ struct timeline *timeline_load(struct mpv_global *global, struct mp_log *log,
                                struct demuxer *demuxer);
 void timeline_destroy(struct timeline *tl);
 
+int timeline_get_max_open_sources(struct timeline *tl);
+void timeline_enable_lazy_sources(struct timeline *tl);
+void timeline_open_part(struct timeline *tl, int part);
+struct demuxer *timeline_activate_part(struct timeline *tl, int part);
+char *timeline_get_source_url(struct timeline *tl, int source);
+
+void timeline_run_parallel(void (*fn)(void *item), void *items,
+                           size_t item_size, int num_items);
+
 #endif
@@ -0,0 +1,217 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "common/common.h"
+#include "osdep/threads.h"
+
+#include "dec_queue.h"
+
+// Runs a decoder on a separate thread, which fills a bounded queue of output
+// frames. The user thread then only accesses the queue with dec_queue_work()
+// and dec_queue_get_frame(). Everything else that touches the decoder state
+// has to hold dec_lock (lock order: dec_lock, then lock).
+struct dec_queue {
+    struct dec_queue_params p;
+    pthread_t thread;
+    pthread_mutex_t dec_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    // --- protected by lock
+    void **frames;
+    int num_frames;
+    double size;            // sum of frame_size() of the queued frames
+    bool active;            // set by dec_queue_work(), cleared by reset
+    int state;              // DATA_* result of the last decoding step
+    uint64_t kicks;         // incremented by each dec_queue_work() call
+    bool terminate;
+};
+
+static void flush_queue(struct dec_queue *q)
+{
+    for (int n = 0; n < q->num_frames; n++)
+        talloc_free(q->frames[n]);
+    q->num_frames = 0;
+    q->size = 0;
+}
+
+static bool queue_full(struct dec_queue *q)
+{
+    if (q->p.max_frames > 0 && q->num_frames >= q->p.max_frames)
+        return true;
+    // Always allow at least 1 frame, no matter how large.
+    return q->p.max_size > 0 && q->num_frames && q->size >= q->p.max_size;
+}
+
+static void *dec_thread(void *arg)
+{
+    struct dec_queue *q = arg;
+
+    mpthread_set_name(q->p.name);
+
+    pthread_mutex_lock(&q->lock);
+    while (!q->terminate) {
+        if (!q->active || queue_full(q) || q->state == DATA_WAIT ||
+            q->state == DATA_EOF)
+        {
+            pthread_cond_wait(&q->wakeup, &q->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&q->lock);
+
+        pthread_mutex_lock(&q->dec_lock);
+        pthread_mutex_lock(&q->lock);
+        // dec_queue_reset() might have been called while dec_lock was not held.
+        bool run = q->active;
+        uint64_t kicks = q->kicks;
+        if (run && q->p.sync)
+            q->p.sync(q->p.ctx);
+        pthread_mutex_unlock(&q->lock);
+
+        void *frame = NULL;
+        int state = run ? q->p.decode(q->p.ctx, &frame) : DATA_AGAIN;
+
+        pthread_mutex_lock(&q->lock);
+        if (run) {
+            if (frame) {
+                MP_TARRAY_APPEND(q, q->frames, q->num_frames, frame);
+                q->size += q->p.frame_size(frame);
+            }
+            // dec_queue_work() might have been called while decoding, after
+            // the decoder saw no new packets. The wakeup would be lost if
+            // the thread went to sleep now.
+            if (state == DATA_WAIT && q->kicks != kicks)
+                state = DATA_AGAIN;
+            q->state = state;
+            if (q->p.sync)
+                q->p.sync(q->p.ctx);
+            if ((frame || q->state == DATA_EOF) && q->p.wakeup)
+                q->p.wakeup(q->p.wakeup_ctx);
+        }
+        pthread_mutex_unlock(&q->dec_lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+// Start the decoder thread. Returns NULL on failure. The thread doesn't
+// decode anything until dec_queue_work() is called.
+struct dec_queue *dec_queue_create(const struct dec_queue_params *params)
+{
+    struct dec_queue *q = talloc_zero(NULL, struct dec_queue);
+    q->p = *params;
+    q->state = DATA_AGAIN;
+    pthread_mutex_init(&q->dec_lock, NULL);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wakeup, NULL);
+    if (pthread_create(&q->thread, NULL, dec_thread, q)) {
+        pthread_cond_destroy(&q->wakeup);
+        pthread_mutex_destroy(&q->lock);
+        pthread_mutex_destroy(&q->dec_lock);
+        talloc_free(q);
+        return NULL;
+    }
+    return q;
+}
+
+void dec_queue_destroy(struct dec_queue *q)
+{
+    if (!q)
+        return;
+    pthread_mutex_lock(&q->lock);
+    q->terminate = true;
+    pthread_cond_broadcast(&q->wakeup);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+    flush_queue(q);
+    pthread_cond_destroy(&q->wakeup);
+    pthread_mutex_destroy(&q->lock);
+    pthread_mutex_destroy(&q->dec_lock);
+    talloc_free(q);
+}
+
+// Exclude the decoder thread from the decoder state.
+void dec_queue_lock_decoder(struct dec_queue *q)
+{
+    pthread_mutex_lock(&q->dec_lock);
+}
+
+void dec_queue_unlock_decoder(struct dec_queue *q)
+{
+    pthread_mutex_unlock(&q->dec_lock);
+}
+
+// Protects the state exchanged with the params.sync callback. Must not be
+// held while calling any other dec_queue function.
+void dec_queue_lock(struct dec_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+}
+
+void dec_queue_unlock(struct dec_queue *q)
+{
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Drop all queued frames, and stop decoding until the next dec_queue_work().
+// Must be called with the decoder lock held.
+void dec_queue_reset(struct dec_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    flush_queue(q);
+    q->active = false;
+    q->state = DATA_AGAIN;
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Let the decoder thread fill the queue.
+void dec_queue_work(struct dec_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->active = true;
+    q->kicks++;
+    // Likely woken up by the demuxer; retry reading packets.
+    if (q->state == DATA_WAIT)
+        q->state = DATA_AGAIN;
+    pthread_cond_signal(&q->wakeup);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Fetch a frame from the queue. Returns one of:
+//  DATA_OK:    *out_frame is set to a new frame
+//  DATA_WAIT:  waiting for demuxer or decoder thread; will receive a wakeup
+//  DATA_EOF:   end of file, no more frames to be expected
+int dec_queue_get_frame(struct dec_queue *q, void **out_frame)
+{
+    int res = DATA_WAIT;
+    *out_frame = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->num_frames) {
+        *out_frame = q->frames[0];
+        MP_TARRAY_REMOVE_AT(q->frames, q->num_frames, 0);
+        q->size -= q->p.frame_size(*out_frame);
+        pthread_cond_signal(&q->wakeup);
+        res = DATA_OK;
+    } else if (q->state == DATA_EOF) {
+        res = DATA_EOF;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return res;
+}
@@ -0,0 +1,43 @@
+#ifndef MP_DEC_QUEUE_H_
+#define MP_DEC_QUEUE_H_
+
+#include <stdbool.h>
+
+struct dec_queue;
+
+struct dec_queue_params {
+    const char *name;       // thread name
+    int max_frames;         // queue limit in frames (0: no limit)
+    double max_size;        // queue limit in frame_size() units (0: no limit)
+
+    // Run one decoding step. Returns a DATA_* value, and sets *out_frame to a
+    // talloc'ed frame if one was decoded. Called on the decoder thread, with
+    // the decoder lock held.
+    int (*decode)(void *ctx, void **out_frame);
+    // Exchange state with the user thread. Called on the decoder thread,
+    // before and after each step, with the decoder lock and the queue lock
+    // held. Optional.
+    void (*sync)(void *ctx);
+    // Size of a frame, as accounted against max_size.
+    double (*frame_size)(void *frame);
+    void *ctx;
+
+    // Called (with the queue lock held) when a frame was queued or EOF was
+    // reached. Optional.
+    void (*wakeup)(void *ctx);
+    void *wakeup_ctx;
+};
+
+struct dec_queue *dec_queue_create(const struct dec_queue_params *params);
+void dec_queue_destroy(struct dec_queue *q);
+
+void dec_queue_lock_decoder(struct dec_queue *q);
+void dec_queue_unlock_decoder(struct dec_queue *q);
+void dec_queue_lock(struct dec_queue *q);
+void dec_queue_unlock(struct dec_queue *q);
+
+void dec_queue_reset(struct dec_queue *q);
+void dec_queue_work(struct dec_queue *q);
+int dec_queue_get_frame(struct dec_queue *q, void **out_frame);
+
+#endif
@@ -281,6 +281,11 @@ void m_config_restore_backups(struct m_config *config)
     }
 }
 
+bool m_config_has_backups(struct m_config *config)
+{
+    return !!config->backup_opts;
+}
+
 void m_config_backup_opt(struct m_config *config, const char *opt)
 {
     struct m_config_option *co = m_config_get_co(config, bstr0(opt));
@@ -122,6 +122,10 @@ void m_config_backup_all_opts(struct m_config *config);
 // backups afterwards.
 void m_config_restore_backups(struct m_config *config);
 
+// Whether any option is currently backed up (i.e. set only for the current
+// file).
+bool m_config_has_backups(struct m_config *config);
+
 enum {
     M_SETOPT_PRE_PARSE_ONLY = 1,    // Silently ignore non-M_OPT_PRE_PARSE opt.
     M_SETOPT_CHECK_ONLY = 2,        // Don't set, just check name/value
@@ -158,6 +158,9 @@ const m_option_t mp_opts[] = {
     OPT_INTRANGE("cache-backbuffer", stream_cache.back_buffer, 0, 0, 0x7fffffff),
     OPT_STRING("cache-file", stream_cache.file, M_OPT_FILE),
     OPT_INTRANGE("cache-file-size", stream_cache.file_max, 0, 0, 0x7fffffff),
+    OPT_STRING("cache-dir", stream_cache.dir, M_OPT_FILE),
+    OPT_INTRANGE("cache-dir-size", stream_cache.dir_max, 0, 0, 0x7fffffff),
+    OPT_INTRANGE("cache-prefetch", stream_cache.prefetch, 0, 0, 16),
 
 #if HAVE_DVDREAD || HAVE_DVDNAV
     OPT_STRING("dvd-device", dvd_device, M_OPT_FILE),
@@ -250,6 +253,12 @@ const m_option_t mp_opts[] = {
     OPT_DOUBLE("demuxer-readahead-secs", demuxer_min_secs, M_OPT_MIN, .min = 0),
     OPT_INTRANGE("demuxer-max-packets", demuxer_max_packs, 0, 0, INT_MAX),
     OPT_INTRANGE("demuxer-max-bytes", demuxer_max_bytes, 0, 0, INT_MAX),
+    OPT_INTRANGE("demuxer-max-back-bytes", demuxer_max_back_bytes, 0, 0, INT_MAX),
+    OPT_INTRANGE("demuxer-max-passive-bytes", demuxer_max_passive_bytes, 0, 0, INT_MAX),
+    OPT_CHOICE("demuxer-seekable-cache", demuxer_seekable_cache, 0,
+               ({"auto", -1}, {"no", 0}, {"yes", 1})),
+    OPT_FLAG("demuxer-probe-cache", demuxer_probe_cache, 0),
+    OPT_STRING("demuxer-probe-cache-dir", demuxer_probe_cache_dir, M_OPT_FILE),
 
     OPT_FLAG("force-seekable", force_seekable, 0),
 
@@ -258,6 +267,8 @@ const m_option_t mp_opts[] = {
 
     OPT_DOUBLE("mf-fps", mf_fps, 0),
     OPT_STRING("mf-type", mf_type, 0),
+    OPT_INTRANGE("mf-prefetch", mf_prefetch, 0, 0, 256),
+    OPT_INTRANGE("mf-prefetch-max-bytes", mf_prefetch_max_bytes, 0, 0, INT_MAX),
 #if HAVE_TV
     OPT_SUBSTRUCT("tv", tv_params, tv_params_conf, 0),
 #endif /* HAVE_TV */
@@ -298,7 +309,14 @@ const m_option_t mp_opts[] = {
                 {"yes", 1})),
 
     OPT_STRING("ad", audio_decoders, 0),
+    OPT_DOUBLE("ad-queue-secs", ad_queue_secs, M_OPT_MIN, .min = 0),
     OPT_STRING("vd", video_decoders, 0),
+    OPT_INTRANGE("vd-queue-frames", vd_queue_frames, 0, 0, 1000),
+    OPT_INTRANGE("vd-queue-max-bytes", vd_queue_max_bytes, 0, 0, INT_MAX),
+    OPT_CHOICE("vd-keyframes-only", vd_keyframes_only, 0,
+               ({"no", 0}, {"yes", 1}, {"auto", 2})),
+    OPT_DOUBLE("vd-keyframes-only-speed", vd_keyframes_only_speed,
+               M_OPT_MIN, .min = 1),
 
     OPT_STRING("audio-spdif", audio_spdif, 0),
 
@@ -502,8 +520,10 @@ const m_option_t mp_opts[] = {
 
     OPT_STRING("stream-capture", stream_capture, M_OPT_FILE),
     OPT_STRING("stream-dump", stream_dump, M_OPT_FILE),
+    OPT_FLAG("stream-file-mmap", stream_file_mmap, 0),
 
     OPT_FLAG("stop-playback-on-init-failure", stop_playback_on_init_failure, 0),
+    OPT_FLAG("prefetch-playlist", prefetch_playlist, 0),
 
     OPT_CHOICE_OR_INT("loop", loop_times, 0, 1, 10000,
                       ({"no", 1},
@@ -522,6 +542,7 @@ const m_option_t mp_opts[] = {
     OPT_FLAG("ordered-chapters", ordered_chapters, 0),
     OPT_STRING("ordered-chapters-files", ordered_chapters_files, M_OPT_FILE),
     OPT_INTRANGE("chapter-merge-threshold", chapter_merge_threshold, 0, 0, 10000),
+    OPT_INTRANGE("edl-max-open-sources", edl_max_open_sources, 0, 0, INT_MAX),
 
     OPT_DOUBLE("chapter-seek-threshold", chapter_seek_threshold, 0),
 
@@ -552,6 +573,7 @@ const m_option_t mp_opts[] = {
                ({"no", -1}, {"absolute", 0}, {"yes", 1}, {"always", 1})),
     OPT_FLOAT("hr-seek-demuxer-offset", hr_seek_demuxer_offset, 0),
     OPT_FLAG("hr-seek-framedrop", hr_seek_framedrop, 0),
+    OPT_INTRANGE("backstep-cache-bytes", backstep_cache_bytes, 0, 0, INT_MAX),
     OPT_CHOICE_OR_INT("autosync", autosync, 0, 0, 10000,
                       ({"no", -1})),
 
@@ -684,6 +706,8 @@ const struct MPOpts mp_default_opts = {
     .audio_driver_list = NULL,
     .audio_decoders = "-spdif:*", // never select spdif by default
     .video_decoders = NULL,
+    .vd_queue_max_bytes = 512 * 1024 * 1024,
+    .vd_keyframes_only_speed = 8.0,
     .deinterlace = -1,
     .softvol = SOFTVOL_AUTO,
     .softvol_max = 130,
@@ -739,6 +763,7 @@ const struct MPOpts mp_default_opts = {
     .loop_times = 1,
     .ordered_chapters = 1,
     .chapter_merge_threshold = 100,
+    .edl_max_open_sources = 8,
     .chapter_seek_threshold = 5.0,
     .hr_seek_framedrop = 1,
     .sync_max_video_change = 1,
@@ -753,9 +778,13 @@ const struct MPOpts mp_default_opts = {
         .seek_min = 500,
         .back_buffer = 75000,
         .file_max = 1024 * 1024,
+        .dir_max = 4 * 1024 * 1024,
     },
     .demuxer_max_packs = 16000,
     .demuxer_max_bytes = 400 * 1024 * 1024,
+    .demuxer_max_back_bytes = 50 * 1024 * 1024,
+    .demuxer_max_passive_bytes = 32 * 1024 * 1024,
+    .demuxer_seekable_cache = -1,
     .demuxer_thread = 1,
     .demuxer_min_secs = 1.0,
     .network_rtsp_transport = 2,
@@ -821,6 +850,8 @@ const struct MPOpts mp_default_opts = {
     .dvd_angle = 1,
 
     .mf_fps = 1.0,
+    .mf_prefetch = 8,
+    .mf_prefetch_max_bytes = 128 * 1024 * 1024,
 
     .display_tags = (char **)(const char*[]){
         "Artist", "Album", "Album_Artist", "Comment", "Composer", "Genre",
@@ -59,6 +59,9 @@ struct mp_cache_opts {
     int back_buffer;
     char *file;
     int file_max;
+    char *dir;
+    int dir_max;
+    int prefetch;
 };
 
 typedef struct MPOpts {
@@ -117,7 +120,12 @@ typedef struct MPOpts {
     int video_stereo_mode;
 
     char *audio_decoders;
+    double ad_queue_secs;
     char *video_decoders;
+    int vd_queue_frames;
+    int vd_queue_max_bytes;
+    int vd_keyframes_only;
+    double vd_keyframes_only_speed;
     char *audio_spdif;
 
     int osd_level;
@@ -126,13 +134,16 @@ typedef struct MPOpts {
     int untimed;
     char *stream_capture;
     char *stream_dump;
+    int stream_file_mmap;
     int stop_playback_on_init_failure;
+    int prefetch_playlist;
     int loop_times;
     int loop_file;
     int shuffle;
     int ordered_chapters;
     char *ordered_chapters_files;
     int chapter_merge_threshold;
+    int edl_max_open_sources;
     double chapter_seek_threshold;
     char *chapter_file;
     int load_unsafe_playlists;
@@ -155,6 +166,7 @@ typedef struct MPOpts {
     int hr_seek;
     float hr_seek_demuxer_offset;
     int hr_seek_framedrop;
+    int backstep_cache_bytes;
     float audio_delay;
     float default_max_pts_correction;
     int autosync;
@@ -208,6 +220,11 @@ typedef struct MPOpts {
     char *demuxer_name;
     int demuxer_max_packs;
     int demuxer_max_bytes;
+    int demuxer_max_back_bytes;
+    int demuxer_max_passive_bytes;
+    int demuxer_seekable_cache;
+    int demuxer_probe_cache;
+    char *demuxer_probe_cache_dir;
     int demuxer_thread;
     double demuxer_min_secs;
     char *audio_demuxer_name;
@@ -305,6 +322,8 @@ typedef struct MPOpts {
 
     double mf_fps;
     char *mf_type;
+    int mf_prefetch;
+    int mf_prefetch_max_bytes;
 
     struct demux_rawaudio_opts *demux_rawaudio;
     struct demux_rawvideo_opts *demux_rawvideo;
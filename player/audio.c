@@ -374,6 +374,8 @@ int init_audio_decoder(struct MPContext *mpctx, struct track *track)
     d_audio->global = mpctx->global;
     d_audio->opts = mpctx->opts;
     d_audio->header = track->stream;
+    d_audio->wakeup = wakeup_playloop;
+    d_audio->wakeup_ctx = mpctx;
 
     d_audio->try_spdif = true;
 
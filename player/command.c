@@ -563,7 +563,8 @@ static int mp_property_drop_frame_cnt(void *ctx, struct m_property *prop,
      if (!mpctx->vo_chain)
         return M_PROPERTY_UNAVAILABLE;
 
-    return m_property_int_ro(action, arg, mpctx->vo_chain->video_src->dropped_frames);
+    struct dec_video *d_video = mpctx->vo_chain->video_src;
+    return m_property_int_ro(action, arg, video_get_dropped_frames(d_video));
 }
 
 static int mp_property_mistimed_frame_count(void *ctx, struct m_property *prop,
@@ -1489,6 +1490,44 @@ static int mp_property_demuxer_cache_idle(void *ctx, struct m_property *prop,
     return m_property_flag_ro(action, arg, s.idle);
 }
 
+static int mp_property_demuxer_cache_used(void *ctx, struct m_property *prop,
+                                          int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->demuxer)
+        return M_PROPERTY_UNAVAILABLE;
+
+    struct demux_ctrl_reader_state s;
+    if (demux_control(mpctx->demuxer, DEMUXER_CTRL_GET_READER_STATE, &s) < 1)
+        return M_PROPERTY_UNAVAILABLE;
+
+    return property_int_kb_size(s.fw_bytes / 1024, action, arg);
+}
+
+static int mp_property_demuxer_cache_back_used(void *ctx,
+                                               struct m_property *prop,
+                                               int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->demuxer)
+        return M_PROPERTY_UNAVAILABLE;
+
+    struct demux_ctrl_reader_state s;
+    if (demux_control(mpctx->demuxer, DEMUXER_CTRL_GET_READER_STATE, &s) < 1)
+        return M_PROPERTY_UNAVAILABLE;
+
+    return property_int_kb_size(s.bw_bytes / 1024, action, arg);
+}
+
+static int mp_property_backstep_cache_used(void *ctx, struct m_property *prop,
+                                           int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->vo_chain)
+        return M_PROPERTY_UNAVAILABLE;
+    return property_int_kb_size(mpctx->backstep_bytes / 1024, action, arg);
+}
+
 static int mp_property_paused_for_cache(void *ctx, struct m_property *prop,
                                         int action, void *arg)
 {
@@ -2147,6 +2186,21 @@ static int mp_property_hwdec_active(void *ctx, struct m_property *prop,
     return m_property_flag_ro(action, arg, active);
 }
 
+static int mp_property_decoder_threading(void *ctx, struct m_property *prop,
+                                         int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    struct track *track = mpctx->current_track[0][STREAM_VIDEO];
+    struct dec_video *vd = track ? track->d_video : NULL;
+    if (!vd)
+        return M_PROPERTY_UNAVAILABLE;
+
+    int threading = video_get_threading(vd);
+    const char *name = threading == THREADING_FRAME ? "frame" :
+                       threading == THREADING_SLICE ? "slice" : "no";
+    return m_property_strdup_ro(action, arg, name);
+}
+
 static int mp_property_detected_hwdec(void *ctx, struct m_property *prop,
                                       int action, void *arg)
 {
@@ -3538,6 +3592,9 @@ static const struct m_property mp_properties[] = {
     {"demuxer-cache-duration", mp_property_demuxer_cache_duration},
     {"demuxer-cache-time", mp_property_demuxer_cache_time},
     {"demuxer-cache-idle", mp_property_demuxer_cache_idle},
+    {"demuxer-cache-used", mp_property_demuxer_cache_used},
+    {"demuxer-cache-back-used", mp_property_demuxer_cache_back_used},
+    {"backstep-cache-used", mp_property_backstep_cache_used},
     {"cache-buffering-state", mp_property_cache_buffering},
     {"paused-for-cache", mp_property_paused_for_cache},
     {"hr-seek", mp_property_generic_option},
@@ -3616,6 +3673,7 @@ static const struct m_property mp_properties[] = {
     {"program", mp_property_program},
     {"hwdec", mp_property_hwdec},
     {"hwdec-active", mp_property_hwdec_active},
+    {"decoder-threading", mp_property_decoder_threading},
     {"hwdec-detected", mp_property_detected_hwdec},
 
     {"estimated-frame-count", mp_property_frame_count},
@@ -3730,23 +3788,25 @@ static const char *const *const mp_event_property_change[] = {
       "estimated-vf-fps", "drop-frame-count", "vo-drop-frame-count",
       "total-avsync-change", "audio-speed-correction", "video-speed-correction",
       "vo-delayed-frame-count", "mistimed-frame-count", "vsync-ratio",
-      "estimated-display-fps", "vsync-jitter"),
+      "estimated-display-fps", "vsync-jitter", "backstep-cache-used"),
     E(MPV_EVENT_VIDEO_RECONFIG, "video-out-params", "video-params",
       "video-format", "video-codec", "video-bitrate", "dwidth", "dheight",
       "width", "height", "fps", "aspect", "vo-configured", "current-vo",
-      "detected-hwdec", "colormatrix", "colormatrix-input-range",
-      "colormatrix-output-range", "colormatrix-primaries", "video-aspect"),
+      "detected-hwdec", "decoder-threading", "colormatrix",
+      "colormatrix-input-range", "colormatrix-output-range",
+      "colormatrix-primaries", "video-aspect"),
     E(MPV_EVENT_AUDIO_RECONFIG, "audio-format", "audio-codec", "audio-bitrate",
       "samplerate", "channels", "audio", "volume", "mute", "balance",
       "volume-restore-data", "current-ao", "audio-codec-name", "audio-params",
       "audio-out-params", "volume-max", "mixer-active"),
     E(MPV_EVENT_SEEK, "seeking", "core-idle", "eof-reached"),
-    E(MPV_EVENT_PLAYBACK_RESTART, "seeking", "core-idle", "eof-reached"),
+    E(MPV_EVENT_PLAYBACK_RESTART, "seeking", "core-idle", "eof-reached",
+      "decoder-threading"),
     E(MPV_EVENT_METADATA_UPDATE, "metadata", "filtered-metadata", "media-title"),
     E(MPV_EVENT_CHAPTER_CHANGE, "chapter", "chapter-metadata"),
     E(MP_EVENT_CACHE_UPDATE, "cache", "cache-free", "cache-used", "cache-idle",
       "demuxer-cache-duration", "demuxer-cache-idle", "paused-for-cache",
-      "demuxer-cache-time"),
+      "demuxer-cache-time", "demuxer-cache-used", "demuxer-cache-back-used"),
     E(MP_EVENT_WIN_RESIZE, "window-scale", "osd-width", "osd-height", "osd-par"),
     E(MP_EVENT_WIN_STATE, "window-minimized", "display-names", "display-fps", "fullscreen"),
 };
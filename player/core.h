@@ -238,6 +238,13 @@ typedef struct MPContext {
     struct mp_client_api *clients;
     struct mp_dispatch_queue *dispatch;
     struct mp_cancel *playback_abort;
+    // Next playlist entry being opened in the background (--prefetch-playlist).
+    struct demux_open_args *prefetch;
+    // If the current file was prefetched, the cancel handle its streams use
+    // (a slave of playback_abort, see mp_cancel_set_parent()).
+    struct mp_cancel *playing_cancel;
+    // Playlist file whose remaining entries are still being read.
+    struct playlist_loader *playlist_loader;
 
     struct mp_log *statusline;
     struct osd_state *osd;
@@ -325,6 +332,13 @@ typedef struct MPContext {
     struct mp_image *next_frames[VO_MAX_REQ_FRAMES + 1];
     int num_next_frames;
     struct mp_image *saved_frame;   // for hrseek_lastframe and hrseek_backstep
+    // Recently displayed frames, oldest first (--backstep-cache-bytes).
+    struct mp_image **backstep_frames;
+    int num_backstep_frames;
+    int64_t backstep_bytes;
+    // Index of the displayed frame if it was taken from backstep_frames[]
+    // (while paused), -1 if the newest frame is displayed.
+    int backstep_pos;
 
     enum playback_status video_status, audio_status;
     bool restart_complete;
@@ -358,6 +372,9 @@ typedef struct MPContext {
     double total_avsync_change;
     // Used to compute the number of frames dropped in a row.
     int dropped_frames_start;
+    // Playback speed at which --vd-keyframes-only=auto was enabled because
+    // video fell behind (0 if not).
+    double keyframes_only_speed;
     // A-V sync difference when last frame was displayed. Kept to display
     // the same value if the status line is updated at a time where no new
     // video frame is shown.
@@ -484,6 +501,9 @@ struct playlist_entry *mp_next_file(struct MPContext *mpctx, int direction,
 void mp_set_playlist_entry(struct MPContext *mpctx, struct playlist_entry *e);
 void mp_play_files(struct MPContext *mpctx);
 void update_demuxer_properties(struct MPContext *mpctx);
+void prefetch_next_file(struct MPContext *mpctx);
+void update_playlist_loader(struct MPContext *mpctx,
+                            struct playlist_entry *wait_after);
 void print_track_list(struct MPContext *mpctx, const char *msg);
 void reselect_demux_streams(struct MPContext *mpctx);
 void prepare_playlist(struct MPContext *mpctx, struct playlist *pl);
@@ -576,6 +596,9 @@ int reinit_video_chain(struct MPContext *mpctx);
 int reinit_video_chain_src(struct MPContext *mpctx, struct lavfi_pad *src);
 int reinit_video_filters(struct MPContext *mpctx);
 void write_video(struct MPContext *mpctx, double endpts);
+bool backstep_cache_seek(struct MPContext *mpctx, double pts, bool backstep);
+bool backstep_cache_step_forward(struct MPContext *mpctx);
+void backstep_cache_leave(struct MPContext *mpctx);
 void mp_force_video_refresh(struct MPContext *mpctx);
 void uninit_video_out(struct MPContext *mpctx);
 void uninit_video_chain(struct MPContext *mpctx);
@@ -3,6 +3,9 @@
 #include <strings.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "osdep/io.h"
 
@@ -84,6 +87,101 @@ static struct bstr guess_lang_from_filename(struct bstr name)
     return (struct bstr){name.start + i + 1, n};
 }
 
+// A directory entry that might be an external file.
+struct dir_entry {
+    char *name;
+    bstr name_trim;     // lower case, without extension, whitespace stripped
+    int type;           // STREAM_SUB/STREAM_AUDIO
+};
+
+// Cached listing of a directory, reduced to the files that might be
+// subtitle or audio files, sorted by name_trim.
+struct dir_index {
+    char *path;
+    time_t mtime;       // directory mtime when it was scanned
+    time_t scan_time;
+    struct dir_entry *entries;
+    int num_entries;
+};
+
+// Number of directories kept in memory.
+#define MAX_DIR_INDEXES 32
+
+// Shared by all mpv instances in the process, but the listing doesn't depend
+// on any options.
+static pthread_mutex_t dir_index_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dir_index *dir_indexes[MAX_DIR_INDEXES];
+static int dir_index_next_replace;
+
+static int compare_dir_entry(const void *a, const void *b)
+{
+    const struct dir_entry *e1 = a;
+    const struct dir_entry *e2 = b;
+    return bstrcmp(e1->name_trim, e2->name_trim);
+}
+
+static struct dir_index *scan_dir(const char *path, struct stat *st)
+{
+    DIR *d = opendir(path);
+    if (!d)
+        return NULL;
+    struct dir_index *index = talloc_zero(NULL, struct dir_index);
+    index->path = talloc_strdup(index, path);
+    index->mtime = st->st_mtime;
+    index->scan_time = time(NULL);
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        struct bstr dename = bstr0(de->d_name);
+        int type = test_ext(bstr_get_ext(dename));
+        if (type < 0)
+            continue;
+        struct dir_entry e = {
+            .name = talloc_strdup(index, de->d_name),
+            .type = type,
+        };
+        struct bstr noext = bstrdup(index, bstr_strip_ext(dename));
+        bstr_lower(noext);
+        e.name_trim = bstr_strip(noext);
+        MP_TARRAY_APPEND(index, index->entries, index->num_entries, e);
+    }
+    closedir(d);
+    if (index->num_entries) {
+        qsort(index->entries, index->num_entries, sizeof(index->entries[0]),
+              compare_dir_entry);
+    }
+    return index;
+}
+
+// Return the index of the given directory, scanning it if needed. The index is
+// reused as long as the directory's mtime doesn't change. Because the mtime
+// has only 1 second resolution, a scan done in the same second as the last
+// modification is not trusted. Must be called with dir_index_lock held.
+static struct dir_index *get_dir_index(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    int slot = -1;
+    for (int n = 0; n < MAX_DIR_INDEXES; n++) {
+        struct dir_index *index = dir_indexes[n];
+        if (index && strcmp(index->path, path) == 0) {
+            if (index->mtime == st.st_mtime && index->scan_time > st.st_mtime)
+                return index;
+            slot = n;
+            break;
+        }
+    }
+    if (slot < 0) {
+        slot = dir_index_next_replace;
+        dir_index_next_replace = (dir_index_next_replace + 1) % MAX_DIR_INDEXES;
+    }
+
+    talloc_free(dir_indexes[slot]);
+    dir_indexes[slot] = scan_dir(path, &st);
+    return dir_indexes[slot];
+}
+
 static void append_dir_subtitles(struct mpv_global *global,
                                  struct subfn **slist, int *nsub,
                                  struct bstr path, const char *fname,
@@ -101,43 +199,57 @@ static void append_dir_subtitles(struct mpv_global *global,
     bstr_lower(f_fname_noext);
     struct bstr f_fname_trim = bstr_strip(f_fname_noext);
 
+    int fuzz_for_type[STREAM_TYPE_COUNT];
+    for (int n = 0; n < STREAM_TYPE_COUNT; n++)
+        fuzz_for_type[n] = -1;
+    if (limit_type < 0 || limit_type == STREAM_SUB)
+        fuzz_for_type[STREAM_SUB] = opts->sub_auto;
+    if (limit_type < 0 || limit_type == STREAM_AUDIO)
+        fuzz_for_type[STREAM_AUDIO] = opts->audiofile_auto;
+
     // 0 = nothing
     // 1 = any subtitle file
     // 2 = any sub file containing movie name
     // 3 = sub file containing movie name and the lang extension
     char *path0 = bstrdup0(tmpmem, path);
-    DIR *d = opendir(path0);
-    if (!d)
+    pthread_mutex_lock(&dir_index_lock);
+    struct dir_index *index = get_dir_index(path0);
+    if (!index) {
+        pthread_mutex_unlock(&dir_index_lock);
         goto out;
+    }
     mp_verbose(log, "Loading external files in %.*s\n", BSTR_P(path));
-    struct dirent *de;
-    while ((de = readdir(d))) {
-        struct bstr dename = bstr0(de->d_name);
-        void *tmpmem2 = talloc_new(tmpmem);
 
-        // retrieve various parts of the filename
-        struct bstr tmp_fname_noext = bstrdup(tmpmem2, bstr_strip_ext(dename));
-        bstr_lower(tmp_fname_noext);
-        struct bstr tmp_fname_ext = bstr_get_ext(dename);
-        struct bstr tmp_fname_trim = bstr_strip(tmp_fname_noext);
+    // If only names starting with the movie name can match, look up the range
+    // of such names in the sorted index, instead of checking every entry.
+    int start = 0, end = index->num_entries;
+    if (MPMAX(fuzz_for_type[STREAM_SUB], fuzz_for_type[STREAM_AUDIO]) < 1) {
+        int lo = 0, hi = index->num_entries;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (bstrcmp(index->entries[mid].name_trim, f_fname_trim) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        start = end = lo;
+        while (end < index->num_entries &&
+               bstr_startswith(index->entries[end].name_trim, f_fname_trim))
+            end++;
+    }
+
+    for (int i = start; i < end; i++) {
+        struct dir_entry *e = &index->entries[i];
+        struct bstr tmp_fname_trim = e->name_trim;
 
         // check what it is (most likely)
-        int type = test_ext(tmp_fname_ext);
-        char **langs = NULL;
-        int fuzz = -1;
-        switch (type) {
-        case STREAM_SUB:
-            langs = opts->stream_lang[type];
-            fuzz = opts->sub_auto;
-            break;
-        case STREAM_AUDIO:
-            langs = opts->stream_lang[type];
-            fuzz = opts->audiofile_auto;
-            break;
-        }
+        int type = e->type;
+        char **langs = opts->stream_lang[type];
+        int fuzz = fuzz_for_type[type];
 
-        if (fuzz < 0 || (limit_type >= 0 && limit_type != type))
-            goto next_sub;
+        if (fuzz < 0)
+            continue;
 
         // we have a (likely) subtitle file
         int prio = 0;
@@ -169,11 +281,11 @@ static void append_dir_subtitles(struct mpv_global *global,
         }
 
         mp_dbg(log, "Potential external file: \"%s\"  Priority: %d\n",
-               de->d_name, prio);
+               e->name, prio);
 
         if (prio) {
             prio += prio;
-            char *subpath = mp_path_join_bstr(*slist, path, dename);
+            char *subpath = mp_path_join_bstr(*slist, path, bstr0(e->name));
             if (mp_path_exists(subpath)) {
                 MP_GROW_ARRAY(*slist, *nsub);
                 struct subfn *sub = *slist + (*nsub)++;
@@ -189,11 +301,8 @@ static void append_dir_subtitles(struct mpv_global *global,
             } else
                 talloc_free(subpath);
         }
-
-    next_sub:
-        talloc_free(tmpmem2);
     }
-    closedir(d);
+    pthread_mutex_unlock(&dir_index_lock);
 
  out:
     talloc_free(tmpmem);
@@ -20,6 +20,7 @@
 #include <strings.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavutil/avutil.h>
 
@@ -28,6 +29,7 @@
 
 #include "osdep/io.h"
 #include "osdep/terminal.h"
+#include "osdep/threads.h"
 #include "osdep/timer.h"
 
 #include "common/msg.h"
@@ -283,6 +285,17 @@ static void enable_demux_thread(struct MPContext *mpctx)
     }
 }
 
+struct timeline_open_args {
+    struct timeline *tl;
+    int part;
+};
+
+static void open_timeline_part_thread(void *pctx)
+{
+    struct timeline_open_args *args = pctx;
+    timeline_open_part(args->tl, args->part);
+}
+
 // Returns whether reinitialization is required (i.e. it switched to a new part)
 bool timeline_switch_to_time(struct MPContext *mpctx, double pts)
 {
@@ -318,7 +331,21 @@ bool timeline_switch_to_time(struct MPContext *mpctx, double pts)
         }
     }
 
-    mpctx->demuxer = n->source;
+    // Opening the source might block; don't lock out input and clients.
+    if (mpctx->tl->lazy) {
+        struct timeline_open_args args = {mpctx->tl, mpctx->timeline_part};
+        mpctx_run_reentrant(mpctx, open_timeline_part_thread, &args);
+    }
+
+    // Might close the previous source, so it must not be used after this.
+    mpctx->demuxer = timeline_activate_part(mpctx->tl, mpctx->timeline_part);
+    if (!mpctx->demuxer) {
+        MP_ERR(mpctx, "Could not open the source of timeline part %d.\n",
+               mpctx->timeline_part);
+        if (!mpctx->stop_play)
+            mpctx->stop_play = PT_ERROR;
+        mpctx->demuxer = mpctx->tl->track_layout;
+    }
     demux_set_ts_offset(mpctx->demuxer, n->start - n->source_start);
 
     // While another timeline was active, the selection of active tracks might
@@ -696,36 +723,17 @@ bool mp_remove_track(struct MPContext *mpctx, struct track *track)
     return true;
 }
 
-struct track *mp_add_external_file(struct MPContext *mpctx, char *filename,
-                                   enum stream_type filter)
+// Add the tracks of an already opened external file. Takes ownership of the
+// demuxer. Returns the last added track, or NULL on failure.
+static struct track *add_external_demuxer(struct MPContext *mpctx,
+                                          struct demuxer *demuxer,
+                                          char *filename,
+                                          enum stream_type filter)
 {
-    struct MPOpts *opts = mpctx->opts;
-    if (!filename)
-        return NULL;
-
     char *disp_filename = filename;
     if (strncmp(disp_filename, "memory://", 9) == 0)
         disp_filename = "memory://"; // avoid noise
 
-    struct demuxer_params params = {0};
-
-    switch (filter) {
-    case STREAM_SUB:
-        params.force_format = opts->sub_demuxer_name;
-        break;
-    case STREAM_AUDIO:
-        params.force_format = opts->audio_demuxer_name;
-        break;
-    }
-
-    struct demuxer *demuxer =
-        demux_open_url(filename, &params, mpctx->playback_abort, mpctx->global);
-    if (!demuxer)
-        goto err_out;
-
-    if (filter != STREAM_SUB && opts->rebase_start_time)
-        demux_set_ts_offset(demuxer, -demuxer->start_time);
-
     struct track *first = NULL;
     for (int n = 0; n < demux_get_num_stream(demuxer); n++) {
         struct sh_stream *sh = demux_get_stream(demuxer, n);
@@ -740,76 +748,244 @@ struct track *mp_add_external_file(struct MPContext *mpctx, char *filename,
     if (!first) {
         free_demuxer_and_stream(demuxer);
         MP_WARN(mpctx, "No streams added from file %s.\n", disp_filename);
-        goto err_out;
+        MP_ERR(mpctx, "Can not open external file %s.\n", disp_filename);
+        return NULL;
     }
 
     MP_TARRAY_APPEND(NULL, mpctx->sources, mpctx->num_sources, demuxer);
     if (mpctx->playback_initialized)
         enable_demux_thread(mpctx);
     return first;
+}
+
+static struct demuxer *open_external_demuxer(struct mpv_global *global,
+                                             char *filename,
+                                             enum stream_type filter,
+                                             struct mp_cancel *cancel)
+{
+    struct MPOpts *opts = global->opts;
+    struct demuxer_params params = {0};
+
+    switch (filter) {
+    case STREAM_SUB:
+        params.force_format = opts->sub_demuxer_name;
+        break;
+    case STREAM_AUDIO:
+        params.force_format = opts->audio_demuxer_name;
+        break;
+    }
+
+    struct demuxer *demuxer = demux_open_url(filename, &params, cancel, global);
+    if (demuxer && filter != STREAM_SUB && opts->rebase_start_time)
+        demux_set_ts_offset(demuxer, -demuxer->start_time);
+    return demuxer;
+}
+
+struct track *mp_add_external_file(struct MPContext *mpctx, char *filename,
+                                   enum stream_type filter)
+{
+    if (!filename)
+        return NULL;
+
+    struct demuxer *demuxer = open_external_demuxer(mpctx->global, filename,
+                                                    filter,
+                                                    mpctx->playback_abort);
+    if (!demuxer) {
+        if (strncmp(filename, "memory://", 9) == 0)
+            filename = "memory://"; // avoid noise
+        MP_ERR(mpctx, "Can not open external file %s.\n", filename);
+        return NULL;
+    }
+
+    return add_external_demuxer(mpctx, demuxer, filename, filter);
+}
+
+struct external_file {
+    char *filename;
+    enum stream_type type;
+    char *lang;
+    bool auto_loaded;
+    struct mpv_global *global; // owned by the demuxer if it could be opened
+    struct demuxer *demux; // result; NULL if opening failed
+};
+
+// Everything that is needed to locate and open external files without
+// touching the MPContext.
+struct external_open_args {
+    struct mpv_global *global;
+    struct mp_cancel *cancel;
+    char *base_filename;    // if NULL, don't autoload
+    char **source_urls;     // files that are already open
+    int num_source_urls;
+    bool has_video, has_audio;
+    // files from options, plus the autoloaded files after the scan
+    struct external_file *files;
+    int num_files;
+};
 
-err_out:
-    MP_ERR(mpctx, "Can not open external file %s.\n", disp_filename);
+static bool is_known_url(struct external_open_args *args, char *url)
+{
+    for (int n = 0; n < args->num_source_urls; n++) {
+        if (strcmp(args->source_urls[n], url) == 0)
+            return true;
+    }
+    for (int n = 0; n < args->num_files; n++) {
+        if (strcmp(args->files[n].filename, url) == 0)
+            return true;
+    }
     return false;
 }
 
-static void open_audiofiles_from_options(struct MPContext *mpctx)
+// Runs on the opener thread: scanning the directories can block for a long
+// time (e.g. on network filesystems).
+static void find_external_files_thread(void *pctx)
 {
-    struct MPOpts *opts = mpctx->opts;
-    for (int n = 0; opts->audio_files && opts->audio_files[n]; n++)
-        mp_add_external_file(mpctx, opts->audio_files[n], STREAM_AUDIO);
+    struct external_open_args *args = pctx;
+
+    struct subfn *list = find_external_files(args->global, args->base_filename);
+    talloc_steal(args, list);
+
+    for (int i = 0; list && list[i].fname; i++) {
+        if (is_known_url(args, list[i].fname))
+            continue;
+        if (list[i].type == STREAM_SUB && !args->has_video && !args->has_audio)
+            continue;
+        if (list[i].type == STREAM_AUDIO && !args->has_video)
+            continue;
+        struct external_file f = {
+            .filename = list[i].fname,
+            .type = list[i].type,
+            .lang = list[i].lang,
+            .auto_loaded = true,
+        };
+        MP_TARRAY_APPEND(args, args->files, args->num_files, f);
+    }
 }
 
-static void open_subtitles_from_options(struct MPContext *mpctx)
+// Runs on the opener thread; must not access the player state.
+static void open_external_files_thread(void *pctx)
 {
-    struct MPOpts *opts = mpctx->opts;
-    for (int i = 0; opts->sub_name && opts->sub_name[i] != NULL; i++)
-        mp_add_external_file(mpctx, opts->sub_name[i], STREAM_SUB);
+    struct external_open_args *args = pctx;
+
+    for (int n = 0; n < args->num_files; n++) {
+        struct external_file *f = &args->files[n];
+        if (mp_cancel_test(args->cancel))
+            break;
+        f->demux = open_external_demuxer(f->global, f->filename, f->type,
+                                         args->cancel);
+    }
 }
 
-void autoload_external_files(struct MPContext *mpctx)
+static void run_opener(struct MPContext *mpctx, bool reentrant,
+                       void (*fn)(void *), void *arg)
 {
-    if (mpctx->opts->sub_auto < 0 && mpctx->opts->audiofile_auto < 0)
-        return;
+    if (reentrant) {
+        mpctx_run_reentrant(mpctx, fn, arg);
+    } else {
+        fn(arg);
+    }
+}
 
-    void *tmp = talloc_new(NULL);
-    char *base_filename = mpctx->filename;
-    char *stream_filename = NULL;
-    if (mpctx->demuxer) {
-        if (demux_stream_control(mpctx->demuxer, STREAM_CTRL_GET_BASE_FILENAME,
-                                    &stream_filename) > 0)
-            base_filename = talloc_steal(tmp, stream_filename);
+// Open the external files given with options (if from_options is set), and
+// the automatically found ones (if enabled). If reentrant is set, the core
+// keeps processing input and commands while the files are searched and
+// opened, and stops as soon as playback is aborted.
+static void load_external_files(struct MPContext *mpctx, bool from_options,
+                                bool reentrant)
+{
+    struct MPOpts *opts = mpctx->opts;
+    struct external_open_args *args = talloc_ptrtype(NULL, args);
+    *args = (struct external_open_args){
+        .cancel = mpctx->playback_abort,
+    };
+
+    if (from_options) {
+        for (int n = 0; opts->sub_name && opts->sub_name[n]; n++) {
+            struct external_file f = {
+                .filename = talloc_strdup(args, opts->sub_name[n]),
+                .type = STREAM_SUB,
+            };
+            MP_TARRAY_APPEND(args, args->files, args->num_files, f);
+        }
+        for (int n = 0; opts->audio_files && opts->audio_files[n]; n++) {
+            struct external_file f = {
+                .filename = talloc_strdup(args, opts->audio_files[n]),
+                .type = STREAM_AUDIO,
+            };
+            MP_TARRAY_APPEND(args, args->files, args->num_files, f);
+            args->has_audio = true;
+        }
     }
-    struct subfn *list = find_external_files(mpctx->global, base_filename);
-    talloc_steal(tmp, list);
 
-    int sc[STREAM_TYPE_COUNT] = {0};
     for (int n = 0; n < mpctx->num_tracks; n++) {
-        if (!mpctx->tracks[n]->attached_picture)
-            sc[mpctx->tracks[n]->type]++;
+        struct track *t = mpctx->tracks[n];
+        if (!t->attached_picture) {
+            args->has_video |= t->type == STREAM_VIDEO;
+            args->has_audio |= t->type == STREAM_AUDIO;
+        }
     }
 
-    for (int i = 0; list && list[i].fname; i++) {
-        char *filename = list[i].fname;
-        char *lang = list[i].lang;
+    if (opts->sub_auto >= 0 || opts->audiofile_auto >= 0) {
+        char *base_filename = mpctx->filename;
+        char *stream_filename = NULL;
+        if (mpctx->demuxer) {
+            if (demux_stream_control(mpctx->demuxer,
+                                     STREAM_CTRL_GET_BASE_FILENAME,
+                                     &stream_filename) > 0)
+                base_filename = talloc_steal(args, stream_filename);
+        }
         for (int n = 0; n < mpctx->num_sources; n++) {
-            if (strcmp(mpctx->sources[n]->stream->url, filename) == 0)
-                goto skip;
+            char *url = talloc_strdup(args, mpctx->sources[n]->stream->url);
+            MP_TARRAY_APPEND(args, args->source_urls, args->num_source_urls,
+                             url);
+        }
+        for (int n = 0; mpctx->tl && mpctx->tl->source_urls &&
+                        n < mpctx->tl->num_sources; n++)
+        {
+            char *url = talloc_strdup(args, mpctx->tl->source_urls[n]);
+            MP_TARRAY_APPEND(args, args->source_urls, args->num_source_urls,
+                             url);
+        }
+        args->base_filename = talloc_strdup(args, base_filename);
+        args->global = create_sub_global(mpctx);
+        talloc_steal(args, args->global);
+        run_opener(mpctx, reentrant, find_external_files_thread, args);
+    }
+
+    for (int n = 0; n < args->num_files; n++)
+        args->files[n].global = create_sub_global(mpctx);
+
+    if (args->num_files && !mpctx->stop_play)
+        run_opener(mpctx, reentrant, open_external_files_thread, args);
+
+    for (int n = 0; n < args->num_files; n++) {
+        struct external_file *f = &args->files[n];
+        if (!f->demux) {
+            talloc_free(f->global);
+            if (!f->auto_loaded && !mpctx->stop_play)
+                MP_ERR(mpctx, "Can not open external file %s.\n", f->filename);
+            continue;
         }
-        if (list[i].type == STREAM_SUB && !sc[STREAM_VIDEO] && !sc[STREAM_AUDIO])
-            goto skip;
-        if (list[i].type == STREAM_AUDIO && !sc[STREAM_VIDEO])
-            goto skip;
-        struct track *track = mp_add_external_file(mpctx, filename, list[i].type);
-        if (track) {
+        talloc_steal(f->demux, f->global);
+        if (mpctx->stop_play) {
+            free_demuxer_and_stream(f->demux);
+            continue;
+        }
+        struct track *track =
+            add_external_demuxer(mpctx, f->demux, f->filename, f->type);
+        if (track && f->auto_loaded) {
             track->auto_loaded = true;
             if (!track->lang)
-                track->lang = talloc_strdup(track, lang);
+                track->lang = talloc_strdup(track, f->lang);
         }
-    skip:;
     }
 
-    talloc_free(tmp);
+    talloc_free(args);
+}
+
+void autoload_external_files(struct MPContext *mpctx)
+{
+    load_external_files(mpctx, false, false);
 }
 
 // Do stuff to a newly loaded playlist. This includes any processing that may
@@ -856,6 +1032,121 @@ static void transfer_playlist(struct MPContext *mpctx, struct playlist *pl)
     }
 }
 
+struct playlist_loader {
+    struct demuxer *demux;
+    struct mp_cancel *cancel;       // used by the demuxer's stream, if set
+    struct playlist_entry *last;    // reserved; new entries are added after it
+    int stream_flags;
+    char *redirect;
+};
+
+static void cancel_playlist_loader(struct MPContext *mpctx)
+{
+    struct playlist_loader *l = mpctx->playlist_loader;
+    if (!l)
+        return;
+    free_demuxer_and_stream(l->demux);
+    playlist_entry_unref(l->last);
+    talloc_free(l);
+    mpctx->playlist_loader = NULL;
+}
+
+// Called after the first entries of a playlist were transferred to the player
+// playlist (last being the last of them). If the playlist demuxer is still
+// reading the rest, keep it alive, and add the remaining entries as they
+// arrive (see update_playlist_loader()).
+static void start_playlist_loader(struct MPContext *mpctx,
+                                  struct playlist_entry *last,
+                                  int stream_flags, char *redirect)
+{
+    struct demuxer *demux = mpctx->master_demuxer;
+    struct demux_ctrl_playlist_update u = {
+        .wakeup_cb = wakeup_demux,
+        .wakeup_ctx = mpctx,
+    };
+    if (!last || demux_control(demux, DEMUXER_CTRL_PLAYLIST_UPDATE, &u) < 1 ||
+        u.done)
+        return;
+
+    // Only one playlist is read in the background at a time.
+    cancel_playlist_loader(mpctx);
+
+    struct playlist_loader *l = talloc_ptrtype(NULL, l);
+    *l = (struct playlist_loader){
+        .demux = demux,
+        .cancel = talloc_steal(l, mpctx->playing_cancel),
+        .last = last,
+        .stream_flags = stream_flags,
+        .redirect = talloc_strdup(l, redirect),
+    };
+    last->reserved += 1;
+    mpctx->playing_cancel = NULL;
+    // The loader outlives the current file.
+    if (l->cancel)
+        mp_cancel_set_parent(l->cancel, NULL);
+
+    // Detach the demuxer from the current file.
+    for (int n = 0; n < mpctx->num_sources; n++) {
+        if (mpctx->sources[n] == demux) {
+            MP_TARRAY_REMOVE_AT(mpctx->sources, mpctx->num_sources, n);
+            break;
+        }
+    }
+    mpctx->master_demuxer = mpctx->demuxer = mpctx->track_layout = NULL;
+
+    mpctx->playlist_loader = l;
+    MP_VERBOSE(mpctx, "Reading the rest of the playlist in the background.\n");
+}
+
+// Add the playlist entries that were read in the background since the last
+// call. If wait_after is the last entry added so far, wait until more entries
+// are available (or the playlist was read completely).
+void update_playlist_loader(struct MPContext *mpctx,
+                            struct playlist_entry *wait_after)
+{
+    struct playlist_loader *l;
+    while ((l = mpctx->playlist_loader)) {
+        // The user changed the playlist in a way that makes it unclear where
+        // the entries should go.
+        if (l->last->removed) {
+            MP_WARN(mpctx, "Playlist changed; not adding remaining entries.\n");
+            cancel_playlist_loader(mpctx);
+            return;
+        }
+
+        struct playlist *pl = talloc_zero(NULL, struct playlist);
+        struct demux_ctrl_playlist_update u = {
+            .pl = pl,
+            .wakeup_cb = wakeup_demux,
+            .wakeup_ctx = mpctx,
+        };
+        demux_control(l->demux, DEMUXER_CTRL_PLAYLIST_UPDATE, &u);
+        if (pl->first) {
+            for (struct playlist_entry *e = pl->first; e; e = e->next)
+                e->stream_flags |= l->stream_flags;
+            if (l->redirect)
+                playlist_add_redirect(pl, l->redirect);
+            struct playlist_entry *last = pl->last;
+            playlist_insert_entries(mpctx->playlist, l->last, pl);
+            playlist_entry_unref(l->last);
+            l->last = last;
+            l->last->reserved += 1;
+            mp_notify_property(mpctx, "playlist");
+        }
+        talloc_free(pl);
+
+        if (u.done) {
+            MP_VERBOSE(mpctx, "Playlist was read completely.\n");
+            cancel_playlist_loader(mpctx);
+            return;
+        }
+        if (!wait_after || wait_after != l->last ||
+            mpctx->stop_play == PT_QUIT)
+            return;
+        mp_idle(mpctx);
+    }
+}
+
 static int process_open_hooks(struct MPContext *mpctx)
 {
 
@@ -886,19 +1177,22 @@ static void print_timeline(struct MPContext *mpctx)
 {
     if (mpctx->timeline) {
         int part_count = mpctx->num_timeline_parts;
+        struct timeline *tl = mpctx->tl;
         MP_VERBOSE(mpctx, "Timeline contains %d parts from %d "
                    "sources. Total length %.3f seconds.\n", part_count,
-                   mpctx->num_sources, mpctx->timeline[part_count].start);
+                   tl->num_sources, mpctx->timeline[part_count].start);
         MP_VERBOSE(mpctx, "Source files:\n");
-        for (int i = 0; i < mpctx->num_sources; i++)
-            MP_VERBOSE(mpctx, "%d: %s\n", i,
-                       mpctx->sources[i]->filename);
+        for (int i = 0; i < tl->num_sources; i++)
+            MP_VERBOSE(mpctx, "%d: %s%s\n", i, timeline_get_source_url(tl, i),
+                       tl->sources[i] ? "" : " (closed)");
         MP_VERBOSE(mpctx, "Timeline parts: (number, start, "
                "source_start, source):\n");
         for (int i = 0; i < part_count; i++) {
             struct timeline_part *p = mpctx->timeline + i;
             MP_VERBOSE(mpctx, "%3d %9.3f %9.3f %p/%s\n", i, p->start,
-                       p->source_start, p->source, p->source->filename);
+                       p->source_start, p->source,
+                       p->source ? p->source->filename
+                                 : timeline_get_source_url(tl, p->source_index));
         }
         MP_VERBOSE(mpctx, "END %9.3f\n",
                    mpctx->timeline[part_count].start);
@@ -953,6 +1247,14 @@ struct demux_open_args {
     struct demuxer *demux;
     struct timeline *tl;
     int err;
+    // for prefetching only
+    struct input_ctx *input;
+    struct playlist_entry *entry; // only for comparing, may be dangling
+    char *open_opts;            // print_open_opts() at prefetch time
+    bool discard;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool done;
 };
 
 static void open_demux_thread(void *pctx)
@@ -963,6 +1265,12 @@ static void open_demux_thread(void *pctx)
         .force_format = global->opts->demuxer_name,
         .allow_capture = true,
         .stream_flags = args->stream_flags,
+        // Large playlists are read in the background, unless all entries are
+        // needed to pick the first one (see prepare_playlist()).
+        .playlist_async = !global->opts->shuffle &&
+                          !global->opts->merge_files &&
+                          !global->opts->position_resume &&
+                          global->opts->playlist_pos < 0,
     };
     args->demux = demux_open_url(args->url, &p, args->cancel, global);
     if (!args->demux) {
@@ -979,17 +1287,211 @@ static void open_demux_thread(void *pctx)
     }
 }
 
+static int get_entry_stream_flags(struct MPContext *mpctx,
+                                  struct playlist_entry *e)
+{
+    return mpctx->opts->load_unsafe_playlists ? 0 : e->stream_flags;
+}
+
+static void *prefetch_thread(void *pctx)
+{
+    struct demux_open_args *args = pctx;
+    mpthread_set_name("prefetch");
+    open_demux_thread(args);
+    // Let the stream cache (if any) fill while the current file plays.
+    if (args->demux) {
+        stream_control(args->demux->stream, STREAM_CTRL_SET_READAHEAD,
+                       &(int){true});
+    }
+    pthread_mutex_lock(&args->lock);
+    args->done = true;
+    pthread_mutex_unlock(&args->lock);
+    mp_input_wakeup(args->input);
+    return NULL;
+}
+
+static void cancel_prefetch(struct MPContext *mpctx);
+
+// Prefixes of the names of options which affect opening a file.
+static const char *const open_opt_prefixes[] = {
+    "demuxer", "cache", "stream-", "network-", "http-", "tls-", "user-agent",
+    "referrer", "cookies", "rebase-start-time", "load-unsafe-playlists",
+    "index", "mf-", "playlist-pos", "shuffle", "merge-files",
+    "resume-playback", NULL
+};
+
+// Return the values of all options which affect opening a file as a string,
+// so that a prefetched file can be checked for having been opened with the
+// same options.
+static char *print_open_opts(void *ta_ctx, struct m_config *config)
+{
+    char *res = talloc_strdup(ta_ctx, "");
+    for (int n = 0; n < config->num_opts; n++) {
+        struct m_config_option *co = &config->opts[n];
+        if (co->is_generated || !co->data)
+            continue;
+        bool match = false;
+        for (int i = 0; open_opt_prefixes[i]; i++)
+            match |= bstr_startswith0(bstr0(co->name), open_opt_prefixes[i]);
+        if (!match)
+            continue;
+        char *val = m_option_print(co->opt, co->data);
+        res = talloc_asprintf_append_buffer(res, "%s=%s\n", co->name,
+                                            val ? val : "");
+        talloc_free(val);
+    }
+    return res;
+}
+
+// Start opening the next playlist entry in the background, once the demuxer
+// of the current file has read everything (so that the two don't compete for
+// bandwidth).
+void prefetch_next_file(struct MPContext *mpctx)
+{
+    struct demux_open_args *pre = mpctx->prefetch;
+    if (pre && !pre->discard &&
+        pre->entry != playlist_get_next(mpctx->playlist, 1))
+    {
+        MP_VERBOSE(mpctx, "Playlist changed, discarding prefetched file.\n");
+        pre->discard = true;
+        mp_cancel_trigger(pre->cancel);
+    }
+    // Free a discarded prefetch once the thread is done (without blocking).
+    if (pre && pre->discard) {
+        pthread_mutex_lock(&pre->lock);
+        bool done = pre->done;
+        pthread_mutex_unlock(&pre->lock);
+        if (done)
+            cancel_prefetch(mpctx);
+    }
+
+    if (!mpctx->opts->prefetch_playlist || mpctx->prefetch ||
+        !mpctx->playback_initialized || !mpctx->demuxer)
+        return;
+    if (mpctx->timeline &&
+        mpctx->timeline_part + 1 < mpctx->num_timeline_parts)
+        return;
+
+    struct demux_ctrl_reader_state s;
+    if (demux_control(mpctx->demuxer, DEMUXER_CTRL_GET_READER_STATE, &s) < 1 ||
+        !s.eof)
+        return;
+
+    // Per-file options would have to be applied before opening the file.
+    // The options of the current file (including auto profiles and resume
+    // options) are still applied, and would leak into the next one.
+    struct playlist_entry *e = playlist_get_next(mpctx->playlist, 1);
+    if (!e || !e->filename || e->num_params ||
+        m_config_has_backups(mpctx->mconfig))
+        return;
+
+    struct demux_open_args *args = talloc_ptrtype(NULL, args);
+    *args = (struct demux_open_args){
+        .global = create_sub_global(mpctx),
+        .cancel = mp_cancel_new(args),
+        .log = mpctx->log,
+        .stream_flags = get_entry_stream_flags(mpctx, e),
+        .url = talloc_strdup(args, e->filename),
+        .input = mpctx->input,
+        .entry = e,
+    };
+    args->open_opts = print_open_opts(args, mpctx->mconfig);
+    pthread_mutex_init(&args->lock, NULL);
+    if (pthread_create(&args->thread, NULL, prefetch_thread, args)) {
+        pthread_mutex_destroy(&args->lock);
+        talloc_free(args->global);
+        talloc_free(args);
+        return;
+    }
+    MP_VERBOSE(mpctx, "Prefetching %s\n", args->url);
+    mpctx->prefetch = args;
+}
+
+// Wait until the prefetch thread is done, and detach the result from mpctx.
+// The caller owns the returned args.
+static struct demux_open_args *finish_prefetch(struct MPContext *mpctx)
+{
+    struct demux_open_args *args = mpctx->prefetch;
+    mpctx->prefetch = NULL;
+    for (;;) {
+        pthread_mutex_lock(&args->lock);
+        bool done = args->done;
+        pthread_mutex_unlock(&args->lock);
+        if (done)
+            break;
+        mp_idle(mpctx);
+        if (mpctx->stop_play)
+            mp_cancel_trigger(args->cancel);
+    }
+    pthread_join(args->thread, NULL);
+    pthread_mutex_destroy(&args->lock);
+    return args;
+}
+
+// Abort prefetching, and free the prefetched file, if any.
+static void cancel_prefetch(struct MPContext *mpctx)
+{
+    if (!mpctx->prefetch)
+        return;
+    mp_cancel_trigger(mpctx->prefetch->cancel);
+    struct demux_open_args *args = finish_prefetch(mpctx);
+    timeline_destroy(args->tl);
+    free_demuxer_and_stream(args->demux);
+    talloc_free(args->global);
+    talloc_free(args);
+}
+
+// Use the prefetched file, if it's the one that is supposed to be opened.
+static bool open_prefetched(struct MPContext *mpctx)
+{
+    struct demux_open_args *pre = mpctx->prefetch;
+    if (!pre)
+        return false;
+    // Options set for the new file (per-file options, auto profiles, resume
+    // options) were applied only now, and might differ.
+    char *opts = print_open_opts(NULL, mpctx->mconfig);
+    bool same_opts = strcmp(pre->open_opts, opts) == 0;
+    talloc_free(opts);
+    if (pre->discard || strcmp(pre->url, mpctx->stream_open_filename) != 0 ||
+        pre->stream_flags != get_entry_stream_flags(mpctx, mpctx->playing) ||
+        !same_opts)
+    {
+        if (!pre->discard && !same_opts)
+            MP_VERBOSE(mpctx, "Options changed, discarding prefetched file.\n");
+        cancel_prefetch(mpctx);
+        return false;
+    }
+
+    struct demux_open_args *args = finish_prefetch(mpctx);
+    if (args->demux) {
+        MP_VERBOSE(mpctx, "Using prefetched file.\n");
+        talloc_steal(args->demux, args->global);
+        mpctx->master_demuxer = args->demux;
+        mpctx->tl = args->tl;
+        // The streams keep using this for cancellation, so it must be
+        // triggered whenever playback is aborted.
+        mpctx->playing_cancel = talloc_steal(mpctx, args->cancel);
+        mp_cancel_set_parent(mpctx->playing_cancel, mpctx->playback_abort);
+    } else {
+        mpctx->error_playing = args->err;
+        talloc_free(args->global);
+    }
+    talloc_free(args);
+    return true;
+}
+
 static void open_demux_reentrant(struct MPContext *mpctx)
 {
+    if (open_prefetched(mpctx))
+        return;
+
     struct demux_open_args args = {
         .global = create_sub_global(mpctx),
         .cancel = mpctx->playback_abort,
         .log = mpctx->log,
-        .stream_flags = mpctx->playing->stream_flags,
+        .stream_flags = get_entry_stream_flags(mpctx, mpctx->playing),
         .url = talloc_strdup(NULL, mpctx->stream_open_filename),
     };
-    if (mpctx->opts->load_unsafe_playlists)
-        args.stream_flags = 0;
     mpctx_run_reentrant(mpctx, open_demux_thread, &args);
     if (args.demux) {
         talloc_steal(args.demux, args.global);
@@ -1016,11 +1518,12 @@ static void load_timeline(struct MPContext *mpctx)
         mpctx->chapters = demux_copy_chapter_data(mpctx->tl->chapters,
                                                   mpctx->tl->num_chapters);
         mpctx->track_layout = mpctx->tl->track_layout;
+        // With lazy sources, only the sources that stay open are listed.
         for (int n = 0; n < mpctx->tl->num_sources; n++) {
-            if (mpctx->tl->sources[n] != mpctx->master_demuxer) {
-                MP_TARRAY_APPEND(NULL, mpctx->sources, mpctx->num_sources,
-                                 mpctx->tl->sources[n]);
-            }
+            struct demuxer *d = mpctx->tl->sources[n];
+            if (d != mpctx->master_demuxer &&
+                (!mpctx->tl->lazy || d == mpctx->tl->track_layout))
+                MP_TARRAY_APPEND(NULL, mpctx->sources, mpctx->num_sources, d);
         }
     }
 
@@ -1235,6 +1738,9 @@ reopen_file:
         }
         for (struct playlist_entry *e = pl->first; e; e = e->next)
             e->stream_flags |= entry_stream_flags;
+        struct playlist_entry *cur = mpctx->playlist->current;
+        start_playlist_loader(mpctx, pl->last, entry_stream_flags,
+                              cur ? cur->filename : NULL);
         transfer_playlist(mpctx, pl);
         mp_notify_property(mpctx, "playlist");
         mpctx->error_playing = 2;
@@ -1247,9 +1753,9 @@ reopen_file:
     mpctx->timeline_part = mpctx->num_timeline_parts;
     timeline_switch_to_time(mpctx, 0);
 
-    open_subtitles_from_options(mpctx);
-    open_audiofiles_from_options(mpctx);
-    autoload_external_files(mpctx);
+    load_external_files(mpctx, true, true);
+    if (mpctx->stop_play)
+        goto terminate_playback;
 
     check_previous_track_selection(mpctx);
 
@@ -1376,6 +1882,8 @@ terminate_playback:
     uninit_sub_all(mpctx);
     uninit_demuxer(mpctx);
     uninit_stream(mpctx);
+    talloc_free(mpctx->playing_cancel);
+    mpctx->playing_cancel = NULL;
     if (!opts->gapless_audio && !mpctx->encode_lavc_ctx)
         uninit_audio_out(mpctx);
 
@@ -1508,6 +2016,10 @@ void mp_play_files(struct MPContext *mpctx)
         if (mpctx->stop_play == PT_QUIT)
             break;
 
+        // Don't stop at the end of a playlist that is still being read.
+        if (mpctx->stop_play != PT_CURRENT_ENTRY)
+            update_playlist_loader(mpctx, mpctx->playlist->current);
+
         struct playlist_entry *new_entry = mpctx->playlist->current;
         if (mpctx->stop_play == PT_NEXT_ENTRY || mpctx->stop_play == PT_ERROR ||
             mpctx->stop_play == AT_END_OF_FILE || !mpctx->stop_play)
@@ -1522,6 +2034,9 @@ void mp_play_files(struct MPContext *mpctx)
         if (!mpctx->playlist->current && mpctx->opts->player_idle_mode < 2)
             break;
     }
+
+    cancel_prefetch(mpctx);
+    cancel_playlist_loader(mpctx);
 }
 
 // Abort current playback and set the given entry to play next.
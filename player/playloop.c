@@ -122,6 +122,8 @@ void unpause_player(struct MPContext *mpctx)
     mpctx->osd_function = 0;
     mpctx->osd_force_update = true;
 
+    backstep_cache_leave(mpctx);
+
     if (mpctx->ao && mpctx->ao_chain)
         ao_resume(mpctx->ao);
     if (mpctx->video_out)
@@ -138,6 +140,8 @@ void add_step_frame(struct MPContext *mpctx, int dir)
     if (!mpctx->vo_chain)
         return;
     if (dir > 0) {
+        if (mpctx->paused && backstep_cache_step_forward(mpctx))
+            return;
         mpctx->step_frames += 1;
         unpause_player(mpctx);
     } else if (dir < 0) {
@@ -148,18 +152,23 @@ void add_step_frame(struct MPContext *mpctx, int dir)
     }
 }
 
-// Clear some playback-related fields on file loading or after seeks.
-void reset_playback_state(struct MPContext *mpctx)
+static void reset_decoders(struct MPContext *mpctx)
 {
-    if (mpctx->lavfi)
-        lavfi_seek_reset(mpctx->lavfi);
-
     for (int n = 0; n < mpctx->num_tracks; n++) {
         if (mpctx->tracks[n]->d_video)
             video_reset(mpctx->tracks[n]->d_video);
         if (mpctx->tracks[n]->d_audio)
             audio_reset_decoding(mpctx->tracks[n]->d_audio);
     }
+}
+
+// Clear some playback-related fields on file loading or after seeks.
+void reset_playback_state(struct MPContext *mpctx)
+{
+    if (mpctx->lavfi)
+        lavfi_seek_reset(mpctx->lavfi);
+
+    reset_decoders(mpctx);
 
     reset_video_state(mpctx);
     reset_audio_state(mpctx);
@@ -253,6 +262,10 @@ static int mp_seek(MPContext *mpctx, struct seek_params seek,
 
     hr_seek &= seek.type == MPSEEK_ABSOLUTE; // otherwise, no target PTS known
 
+    if (hr_seek && !timeline_fallthrough &&
+        backstep_cache_seek(mpctx, seek.amount, backstep))
+        return 0;
+
     double demuxer_amount = seek.amount;
     if (timeline_switch_to_time(mpctx, seek.amount)) {
         reinit_video_chain(mpctx);
@@ -279,6 +292,12 @@ static int mp_seek(MPContext *mpctx, struct seek_params seek,
 
     if (hr_seek)
         demuxer_amount -= hr_seek_offset;
+
+    // Decoder threads must stop reading packets before the seek, or they
+    // might take packets from the new position, which the reset below would
+    // throw away.
+    reset_decoders(mpctx);
+
     demux_seek(mpctx->demuxer, demuxer_amount, demuxer_style);
 
     // Seek external, extra files too:
@@ -458,8 +477,9 @@ double get_current_pos_ratio(struct MPContext *mpctx, bool use_range)
     if (ans < 0 || demuxer->ts_resets_possible) {
         int64_t size;
         if (demux_stream_control(demuxer, STREAM_CTRL_GET_SIZE, &size) > 0) {
-            if (size > 0 && demuxer->filepos >= 0)
-                ans = MPCLAMP(demuxer->filepos / (double)size, 0, 1);
+            int64_t filepos = demux_get_filepos(demuxer);
+            if (size > 0 && filepos >= 0)
+                ans = MPCLAMP(filepos / (double)size, 0, 1);
         }
     }
     if (use_range) {
@@ -980,6 +1000,10 @@ void run_playloop(struct MPContext *mpctx)
 
     update_demuxer_properties(mpctx);
 
+    prefetch_next_file(mpctx);
+
+    update_playlist_loader(mpctx, NULL);
+
     if (mpctx->timeline) {
         double end = mpctx->timeline[mpctx->timeline_part + 1].start;
         if (endpts == MP_NOPTS_VALUE || end < endpts) {
@@ -1079,5 +1103,6 @@ void idle_loop(struct MPContext *mpctx)
             need_reinit = false;
         }
         mp_idle(mpctx);
+        update_playlist_loader(mpctx, NULL);
     }
 }
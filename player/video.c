@@ -242,6 +242,15 @@ static void vo_chain_reset_state(struct vo_chain *vo_c)
         video_reset(vo_c->video_src);
 }
 
+static void clear_backstep_cache(struct MPContext *mpctx)
+{
+    for (int n = 0; n < mpctx->num_backstep_frames; n++)
+        talloc_free(mpctx->backstep_frames[n]);
+    mpctx->num_backstep_frames = 0;
+    mpctx->backstep_bytes = 0;
+    mpctx->backstep_pos = -1;
+}
+
 void reset_video_state(struct MPContext *mpctx)
 {
     if (mpctx->vo_chain)
@@ -251,6 +260,7 @@ void reset_video_state(struct MPContext *mpctx)
         mp_image_unrefp(&mpctx->next_frames[n]);
     mpctx->num_next_frames = 0;
     mp_image_unrefp(&mpctx->saved_frame);
+    clear_backstep_cache(mpctx);
 
     mpctx->delay = 0;
     mpctx->time_frame = 0;
@@ -259,6 +269,7 @@ void reset_video_state(struct MPContext *mpctx)
     mpctx->total_avsync_change = 0;
     mpctx->last_av_difference = 0;
     mpctx->dropped_frames_start = 0;
+    mpctx->keyframes_only_speed = 0;
     mpctx->mistimed_frames_total = 0;
     mpctx->drop_message_shown = 0;
     mpctx->display_sync_drift_dir = 0;
@@ -324,6 +335,8 @@ int init_video_decoder(struct MPContext *mpctx, struct track *track)
     d_video->opts = mpctx->opts;
     d_video->header = track->stream;
     d_video->fps = d_video->header->codec->fps;
+    d_video->wakeup = wakeup_playloop;
+    d_video->wakeup_ctx = mpctx;
     if (mpctx->vo_chain)
         d_video->hwdec_info = mpctx->vo_chain->hwdec_info;
 
@@ -473,13 +486,41 @@ static bool check_framedrop(struct MPContext *mpctx, struct vo_chain *vo_c)
         // we should avoid dropping too many frames in sequence unless we
         // are too late. and we allow 100ms A-V delay here:
         int dropped_frames =
-            vo_c->video_src->dropped_frames - mpctx->dropped_frames_start;
+            video_get_dropped_frames(vo_c->video_src) -
+            mpctx->dropped_frames_start;
         if (mpctx->last_av_difference - 0.100 > dropped_frames * frame_time)
             return !!(opts->frame_dropping & 2);
     }
     return false;
 }
 
+// Whether the decoder should decode keyframes only (--vd-keyframes-only).
+static bool check_keyframes_only(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = mpctx->opts;
+    double speed = opts->playback_speed;
+    switch (opts->vd_keyframes_only) {
+    case 0: return false;
+    case 1: return true;
+    }
+    if (speed >= opts->vd_keyframes_only_speed)
+        return true;
+    // Stay in this mode until the speed changes. Otherwise it would toggle
+    // each time video catches up.
+    if (mpctx->keyframes_only_speed != speed)
+        mpctx->keyframes_only_speed = 0;
+    // Faster than realtime, and video is far behind audio.
+    if (speed > 1 && mpctx->video_status == STATUS_PLAYING &&
+        mpctx->audio_status == STATUS_PLAYING && !mpctx->paused &&
+        mpctx->last_av_difference > 0.5)
+    {
+        if (!mpctx->keyframes_only_speed)
+            MP_VERBOSE(mpctx, "Video can't keep up, decoding keyframes only.\n");
+        mpctx->keyframes_only_speed = speed;
+    }
+    return mpctx->keyframes_only_speed > 0;
+}
+
 // Read a packet, store decoded image into d_video->waiting_decoded_mpi
 // returns VD_* code
 static int decode_image(struct MPContext *mpctx)
@@ -498,6 +539,7 @@ static int decode_image(struct MPContext *mpctx)
         video_set_start(d_video, hrseek ? mpctx->hrseek_pts : MP_NOPTS_VALUE);
 
         video_set_framedrop(d_video, check_framedrop(mpctx, vo_c));
+        video_set_keyframes_only(d_video, check_keyframes_only(mpctx));
 
         video_work(d_video);
         res = video_get_frame(d_video, &vo_c->input_mpi);
@@ -690,7 +732,7 @@ static void handle_new_frame(struct MPContext *mpctx)
     }
     struct dec_video *d_video = mpctx->vo_chain->video_src;
     if (d_video)
-        mpctx->dropped_frames_start = d_video->dropped_frames;
+        mpctx->dropped_frames_start = video_get_dropped_frames(d_video);
     MP_TRACE(mpctx, "frametime=%5.3f\n", frame_time);
 }
 
@@ -1239,6 +1281,117 @@ static void calculate_frame_duration(struct MPContext *mpctx)
     mpctx->past_frames[0].approx_duration = approx_duration;
 }
 
+// Remember a frame that is being displayed for backstepping.
+static void add_backstep_frame(struct MPContext *mpctx, struct mp_image *img)
+{
+    int64_t max_bytes = mpctx->opts->backstep_cache_bytes;
+    // Hardware surfaces are not added: holding references to them could
+    // starve the decoder's surface pool.
+    if (max_bytes <= 0 || mpctx->vo_chain->is_coverart ||
+        (img->fmt.flags & MP_IMGFLAG_HWACCEL))
+    {
+        clear_backstep_cache(mpctx);
+        return;
+    }
+    struct mp_image *ref = mp_image_new_ref(img);
+    if (!ref)
+        return;
+    MP_TARRAY_APPEND(mpctx, mpctx->backstep_frames, mpctx->num_backstep_frames,
+                     ref);
+    mpctx->backstep_bytes += mp_image_get_data_size(ref);
+    while (mpctx->num_backstep_frames > 1 && mpctx->backstep_bytes > max_bytes) {
+        mpctx->backstep_bytes -= mp_image_get_data_size(mpctx->backstep_frames[0]);
+        talloc_free(mpctx->backstep_frames[0]);
+        MP_TARRAY_REMOVE_AT(mpctx->backstep_frames,
+                            mpctx->num_backstep_frames, 0);
+    }
+}
+
+// Display backstep_frames[index] without touching the decoder.
+static bool show_backstep_frame(struct MPContext *mpctx, int index)
+{
+    struct vo *vo = mpctx->video_out;
+    struct mp_image *img = mpctx->backstep_frames[index];
+    if (!vo->params || !mp_image_params_equal(&img->params, vo->params))
+        return false;
+
+    struct vo_frame dummy = {
+        .pts = mp_time_us(),
+        .duration = -1,
+        .still = true,
+        .num_frames = 1,
+        .num_vsyncs = 1,
+        .frames = {img},
+    };
+    vo_seek_reset(vo);
+    vo_queue_frame(vo, vo_frame_ref(&dummy));
+
+    mpctx->backstep_pos = index == mpctx->num_backstep_frames - 1 ? -1 : index;
+    mpctx->video_pts = img->pts;
+    mpctx->last_vo_pts = img->pts;
+    mpctx->playback_pts = img->pts;
+    mpctx->osd_force_update = true;
+    update_osd_msg(mpctx);
+    mp_notify(mpctx, MPV_EVENT_TICK, NULL);
+    return true;
+}
+
+// Try to serve a precise seek to pts (or a backstep from pts) with the cached
+// frames. Only possible while paused, because the decoder and audio are left
+// at the newest frame.
+bool backstep_cache_seek(struct MPContext *mpctx, double pts, bool backstep)
+{
+    if (!mpctx->paused || !mpctx->vo_chain || !mpctx->num_backstep_frames ||
+        mpctx->video_status < STATUS_READY || pts == MP_NOPTS_VALUE)
+        return false;
+
+    // First frame that would be displayed by a hr-seek to pts.
+    int index = -1;
+    for (int n = 0; n < mpctx->num_backstep_frames; n++) {
+        if (mpctx->backstep_frames[n]->pts >= pts - .005) {
+            index = n;
+            break;
+        }
+    }
+    if (backstep)
+        index -= 1;
+    // If the target is before the first frame, the first frame is a guess.
+    if (index < 0 || (!backstep && index == 0 &&
+                      mpctx->backstep_frames[0]->pts > pts + .005))
+        return false;
+
+    if (!show_backstep_frame(mpctx, index))
+        return false;
+    MP_VERBOSE(mpctx, "seek to %f served from backstep cache\n",
+               mpctx->playback_pts);
+    mp_notify(mpctx, MPV_EVENT_SEEK, NULL);
+    mp_notify(mpctx, MPV_EVENT_PLAYBACK_RESTART, NULL);
+    return true;
+}
+
+// Frame-step forward through the cached frames after a cached backstep.
+bool backstep_cache_step_forward(struct MPContext *mpctx)
+{
+    if (mpctx->backstep_pos < 0)
+        return false;
+    if (!show_backstep_frame(mpctx, mpctx->backstep_pos + 1)) {
+        backstep_cache_leave(mpctx);
+        return false;
+    }
+    return true;
+}
+
+// Playback continues; if an older frame is displayed, the decoder has to be
+// moved back to it.
+void backstep_cache_leave(struct MPContext *mpctx)
+{
+    if (mpctx->backstep_pos < 0)
+        return;
+    double pts = mpctx->backstep_frames[mpctx->backstep_pos]->pts;
+    mpctx->backstep_pos = -1;
+    queue_seek(mpctx, MPSEEK_ABSOLUTE, pts, MPSEEK_VERY_EXACT, true);
+}
+
 void write_video(struct MPContext *mpctx, double endpts)
 {
     struct MPOpts *opts = mpctx->opts;
@@ -1355,6 +1508,7 @@ void write_video(struct MPContext *mpctx, double endpts)
     for (int n = 0; n < dummy.num_frames; n++)
         dummy.frames[n] = mpctx->next_frames[n];
     struct vo_frame *frame = vo_frame_ref(&dummy);
+    add_backstep_frame(mpctx, dummy.frames[0]);
 
     double diff = mpctx->past_frames[0].approx_duration;
     if (opts->untimed || vo->driver->untimed)
@@ -32,6 +32,17 @@
 // the cache is active.
 #define CACHE_UPDATE_CONTROLS_TIME 2.0
 
+// Granularity of the cache. The cache memory is split into blocks of this
+// size, each of which caches (a part of) an aligned range of the file. This
+// allows keeping multiple disjoint byte ranges of the file (e.g. header,
+// index, file end, and the currently played region) at the same time.
+// Data within a block can be returned without copying (see cache_read_ref()),
+// so this should be larger than typical packet sizes. Small caches use
+// smaller blocks (down to MIN_BLOCK_SIZE), so they don't allocate much more
+// memory than requested.
+#define MAX_BLOCK_SIZE (1024 * 1024)
+#define MIN_BLOCK_SIZE (16 * 1024)
+
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +56,8 @@
 #include <sys/time.h>
 
 #include <libavutil/common.h>
+#include <libavutil/buffer.h>
+#include <libavcodec/avcodec.h>
 
 #include "config.h"
 
@@ -59,17 +72,31 @@
 #include "common/common.h"
 
 
+// A prefetch thread, which reads whole blocks ahead of the cache thread using
+// its own connection to the source (see --cache-prefetch).
+struct prefetch_worker {
+    struct priv *s;
+    pthread_t thread;
+    int64_t pos;            // block currently being read, -1 if none
+};
+
 // Note: (struct priv*)(cache->priv)->cache == cache
 struct priv {
     pthread_t cache_thread;
     bool cache_thread_running;
     pthread_mutex_t mutex;
     pthread_cond_t wakeup;
+    pthread_cond_t prefetch_wakeup;
 
     // Constants (as long as cache thread is running)
     // Some of these might actually be changed by a synced cache resize.
-    unsigned char *buffer;  // base pointer of the allocated buffer memory
+    AVBufferPool *pool;     // for block memory
     int64_t buffer_size;    // size of the allocated buffer memory
+    struct cache_block *blocks;
+    int num_blocks;         // buffer_size / block_size
+    int block_size;         // fixed when the cache is created
+    int *buckets;           // hash table (block number -> index into blocks)
+    int num_buckets;        // power of 2
     int64_t back_size;      // keep back_size amount of old bytes for backward seek
     int64_t seek_limit;     // keep filling cache if distance is less that seek limit
     bool seekable;          // underlying stream is seekable
@@ -85,13 +112,9 @@ struct priv {
     // All the following members are shared between the threads.
     // You must lock the mutex to access them.
 
-    // Ringbuffer
-    int64_t min_filepos;    // range of file that is cached in the buffer
-    int64_t max_filepos;    // ... max_filepos being the last read position
-    bool eof;               // true if max_filepos = EOF
-    int64_t offset;         // buffer[WRAP(s->max_filepos - offset)] corresponds
-                            // to the byte at max_filepos (must be wrapped by
-                            // buffer_size)
+    uint64_t use_counter;   // incremented on each block access (for LRU)
+    int64_t stream_pos;     // mirrors stream_tell(s->stream)
+    bool eof;               // true if the last fill attempt hit EOF
 
     bool idle;              // cache thread has stopped reading
     int64_t reads;          // number of actual read attempts performed
@@ -103,6 +126,14 @@ struct priv {
 
     int64_t eof_pos;
 
+    struct prefetch_worker *workers;
+    int num_workers;
+    bool prefetch_quit;     // tell prefetch threads to exit
+    struct mp_cancel *prefetch_cancel; // slave of the cache's cancel
+    bool prefetch_wait;     // cache thread waits for a prefetch thread
+    uint64_t prefetch_gen;  // incremented when the cache contents are dropped
+    struct cache_block *fill_block; // block the cache thread is reading into
+
     int control;            // requested STREAM_CTRL_... or CACHE_CTRL_...
     void *control_arg;      // temporary for executing STREAM_CTRLs
     int control_res;
@@ -116,6 +147,21 @@ struct priv {
     bool has_avseek;
 };
 
+// Block n caches the file range starting at n * block_size. Only the
+// part [pos + start, pos + start + len) contains valid data.
+struct cache_block {
+    int64_t pos;            // file position of the block, -1 if unused
+    int start;              // offset of the first valid byte
+    int len;                // number of valid bytes
+    uint64_t last_use;      // value of use_counter on last access
+    bool was_read;          // data was ever returned to the reader
+    int next;               // next block in hash chain, -1 if none
+    // Block memory (block_size bytes + zeroed padding), allocated on
+    // first use. If the reader holds references to it, only the invalid part
+    // may be written to.
+    AVBufferRef *buf;
+};
+
 enum {
     CACHE_CTRL_NONE = 0,
     CACHE_CTRL_QUIT = -1,
@@ -144,14 +190,128 @@ static void cache_wakeup_and_wait(struct priv *s, double *retry_time)
         *retry_time += mp_time_sec() - start;
 }
 
+static int hash_block(struct priv *s, int64_t pos)
+{
+    uint64_t n = pos / s->block_size;
+    return (n * 0x9E3779B97F4A7C15ULL >> 32) & (s->num_buckets - 1);
+}
+
+// Return the block caching pos, or NULL if there is none.
+static struct cache_block *find_block(struct priv *s, int64_t pos)
+{
+    int64_t block_pos = pos - pos % s->block_size;
+    for (int i = s->buckets[hash_block(s, pos)]; i >= 0; i = s->blocks[i].next) {
+        if (s->blocks[i].pos == block_pos)
+            return &s->blocks[i];
+    }
+    return NULL;
+}
+
+static unsigned char *block_data(struct priv *s, struct cache_block *b)
+{
+    return b->buf->data;
+}
+
+// Make sure the block memory can be overwritten. If the reader still holds
+// references to it, use new memory instead; the old memory is freed once the
+// last reference is gone.
+static bool block_make_writable(struct priv *s, struct cache_block *b)
+{
+    if (b->buf && av_buffer_is_writable(b->buf))
+        return true;
+    av_buffer_unref(&b->buf);
+    b->buf = av_buffer_pool_get(s->pool);
+    return !!b->buf;
+}
+
+// Return whether the byte at pos is cached.
+static bool is_cached(struct priv *s, int64_t pos)
+{
+    struct cache_block *b = find_block(s, pos);
+    return b && pos >= b->pos + b->start && pos < b->pos + b->start + b->len;
+}
+
+// Return the first position >= pos that is not cached.
+static int64_t cached_until(struct priv *s, int64_t pos)
+{
+    while (is_cached(s, pos)) {
+        struct cache_block *b = find_block(s, pos);
+        pos = b->pos + b->start + b->len;
+    }
+    return pos;
+}
+
+static void unlink_block(struct priv *s, struct cache_block *b)
+{
+    if (b->pos < 0)
+        return;
+    int *link = &s->buckets[hash_block(s, b->pos)];
+    while (*link != b - s->blocks)
+        link = &s->blocks[*link].next;
+    *link = b->next;
+    b->next = -1;
+    b->pos = -1;
+    b->start = b->len = 0;
+    b->was_read = false;
+}
+
+static void link_block(struct priv *s, struct cache_block *b, int64_t pos)
+{
+    assert(b->pos < 0);
+    int *bucket = &s->buckets[hash_block(s, pos)];
+    b->pos = pos - pos % s->block_size;
+    b->start = b->len = 0;
+    b->last_use = s->use_counter++;
+    b->next = *bucket;
+    *bucket = b - s->blocks;
+}
+
 // Runs in the cache thread
 static void cache_drop_contents(struct priv *s)
 {
-    s->offset = s->min_filepos = s->max_filepos = s->read_filepos;
+    for (int n = 0; n < s->num_blocks; n++)
+        unlink_block(s, &s->blocks[n]);
+    s->prefetch_gen++;
     s->eof = false;
     s->start_pts = MP_NOPTS_VALUE;
 }
 
+// Pick a block that can be reused to cache new data. Blocks overlapping with
+// the given range (the back buffer and the readahead) are never evicted. Of
+// the others, blocks that were prefetched but never read go first, then the
+// least recently used. Returns NULL if the cache is full.
+static struct cache_block *evict_block(struct priv *s, int64_t keep_start,
+                                       int64_t keep_end)
+{
+    struct cache_block *best = NULL;
+    for (int n = 0; n < s->num_blocks; n++) {
+        struct cache_block *b = &s->blocks[n];
+        if (b->pos < 0)
+            return b;
+        if (b->pos + s->block_size > keep_start && b->pos < keep_end)
+            continue;
+        if (b == s->fill_block)
+            continue;
+        if (!best || (best->was_read && !b->was_read) ||
+            (best->was_read == b->was_read && b->last_use < best->last_use))
+            best = b;
+    }
+    if (best)
+        unlink_block(s, best);
+    return best;
+}
+
+// Return whether a prefetch thread is currently reading the block at pos.
+static bool is_prefetching(struct priv *s, int64_t pos)
+{
+    int64_t block_pos = pos - pos % s->block_size;
+    for (int n = 0; n < s->num_workers; n++) {
+        if (s->workers[n].pos == block_pos)
+            return true;
+    }
+    return false;
+}
+
 // Copy at most dst_size from the cache at the given absolute file position pos.
 // Return number of bytes that could actually be read.
 // Does not advance the file position, or change anything else.
@@ -161,25 +321,15 @@ static size_t read_buffer(struct priv *s, unsigned char *dst,
 {
     size_t read = 0;
     while (read < dst_size) {
-        if (pos >= s->max_filepos || pos < s->min_filepos)
+        if (!is_cached(s, pos))
             break;
-        int64_t newb = s->max_filepos - pos; // new bytes in the buffer
-
-        int64_t bpos = pos - s->offset; // file pos to buffer memory pos
-        if (bpos < 0) {
-            bpos += s->buffer_size;
-        } else if (bpos >= s->buffer_size) {
-            bpos -= s->buffer_size;
-        }
-
-        if (newb > s->buffer_size - bpos)
-            newb = s->buffer_size - bpos; // handle wrap...
-
-        newb = MPMIN(newb, dst_size - read);
-
-        assert(newb >= 0 && read + newb <= dst_size);
-        assert(bpos >= 0 && bpos + newb <= s->buffer_size);
-        memcpy(&dst[read], &s->buffer[bpos], newb);
+        struct cache_block *b = find_block(s, pos);
+        int64_t offset = pos - b->pos;
+        int64_t newb = MPMIN(b->start + b->len - offset, dst_size - read);
+        assert(newb > 0 && offset + newb <= s->block_size);
+        memcpy(&dst[read], block_data(s, b) + offset, newb);
+        b->last_use = s->use_counter++;
+        b->was_read = true;
         read += newb;
         pos += newb;
     }
@@ -192,26 +342,57 @@ static void cache_fill(struct priv *s)
     int64_t read = s->read_filepos;
     int len = 0;
 
-    // drop cache contents only if seeking backward or too much fwd.
-    // This is also done for on-disk files, since it loses the backseek cache.
-    // That in turn can cause major bandwidth increase and performance
-    // issues with e.g. mov or badly interleaved files
-    if (read < s->min_filepos || read > s->max_filepos + s->seek_limit) {
-        MP_VERBOSE(s, "Dropping cache at pos %"PRId64", "
-                   "cached range: %"PRId64"-%"PRId64".\n", read,
-                   s->min_filepos, s->max_filepos);
-        cache_drop_contents(s);
+    // Fill the first hole after the read position. If the stream is already
+    // positioned shortly before it, read up to it instead of seeking.
+    int64_t ahead_end = cached_until(s, read);
+    int64_t fill_pos = ahead_end;
+
+    // A prefetch thread is already reading the data we need next.
+    if (is_prefetching(s, ahead_end)) {
+        s->prefetch_wait = true;
+        return;
+    }
+    s->stream_pos = stream_tell(s->stream);
+    if (s->stream_pos < fill_pos && fill_pos - s->stream_pos <= s->seek_limit &&
+        !is_cached(s, s->stream_pos))
+        fill_pos = s->stream_pos;
+
+    // A block holds a single range of valid data. If the block at fill_pos
+    // has valid data before fill_pos, fill the gap after it instead, so that
+    // the ranges can be merged (unseekable streams can't go back, though).
+    struct cache_block *gap_b = find_block(s, fill_pos);
+    if (gap_b && gap_b->len && s->seekable) {
+        int64_t valid_end = gap_b->pos + gap_b->start + gap_b->len;
+        if (fill_pos > valid_end)
+            fill_pos = valid_end;
     }
 
-    if (stream_tell(s->stream) != s->max_filepos && s->seekable) {
+    if (s->stream_pos != fill_pos && s->seekable) {
         MP_VERBOSE(s, "Seeking underlying stream: %"PRId64" -> %"PRId64"\n",
-                   stream_tell(s->stream), s->max_filepos);
-        stream_seek(s->stream, s->max_filepos);
-        if (stream_tell(s->stream) != s->max_filepos)
+                   s->stream_pos, fill_pos);
+        stream_seek(s->stream, fill_pos);
+        s->stream_pos = stream_tell(s->stream);
+        if (s->stream_pos != fill_pos)
+            goto done;
+    } else if (s->stream_pos != fill_pos) {
+        // Unseekable: data before the stream position can't be recovered,
+        // data after it can be reached by reading.
+        if (s->stream_pos > fill_pos) {
+            // Nothing to do until the reader gets to the lost data, which
+            // really is the end of what can be read.
+            if (fill_pos > read) {
+                s->idle = true;
+                s->reads++; // don't stuck main thread
+                return;
+            }
+            MP_ERR(s, "Data at %"PRId64" was lost, and the stream can't "
+                   "seek back.\n", fill_pos);
             goto done;
+        }
+        fill_pos = s->stream_pos;
     }
 
-    if (!s->enable_readahead && s->read_min <= s->max_filepos) {
+    if (!s->enable_readahead && s->read_min <= fill_pos) {
         s->idle = true;
         return;
     }
@@ -219,49 +400,59 @@ static void cache_fill(struct priv *s)
     if (mp_cancel_test(s->cache->cancel))
         goto done;
 
-    // number of buffer bytes which should be preserved in backwards direction
-    int64_t back = MPCLAMP(read - s->min_filepos, 0, s->back_size);
-
-    // limit maximum readahead so that the backbuffer space is reserved, even
-    // if the backbuffer is not used. limit it to ensure that we don't stall the
-    // network when starting a file, or we wouldn't download new data until we
-    // get new free space again. (unless everything fits in the cache.)
-    if (s->stream_size > s->buffer_size)
-        back = MPMAX(back, s->back_size);
-
-    // number of buffer bytes that are valid and can be read
-    int64_t newb = FFMAX(s->max_filepos - read, 0);
-
-    // max. number of bytes that can be written (starting from max_filepos)
-    int64_t space = s->buffer_size - (newb + back);
-
-    // offset into the buffer that maps to max_filepos
-    int64_t pos = s->max_filepos - s->offset;
-    if (pos >= s->buffer_size)
-        pos -= s->buffer_size; // wrap-around
-
-    if (space < FILL_LIMIT) {
+    // Limit the readahead, so that the back buffer space is reserved.
+    if (fill_pos - read >= s->buffer_size - s->back_size) {
         s->idle = true;
         s->reads++; // don't stuck main thread
         return;
     }
 
-    // limit to end of buffer (without wrapping)
-    if (pos + space >= s->buffer_size)
-        space = s->buffer_size - pos;
+    struct cache_block *b = find_block(s, fill_pos);
+    if (!b) {
+        b = evict_block(s, read - s->back_size, MPMAX(ahead_end, fill_pos + 1));
+        if (!b || !block_make_writable(s, b)) {
+            s->idle = true;
+            s->reads++; // don't stuck main thread
+            return;
+        }
+        link_block(s, b, fill_pos);
+    }
+    int offset = fill_pos - b->pos;
+    // Filling the gap before the valid data: it's merged only once the gap is
+    // read completely, so read it in one go. (Writing to the invalid part of
+    // the block is fine even if it's referenced.)
+    bool fill_gap = b->len && offset < b->start;
+    if (!fill_gap && offset != b->start + b->len) {
+        // Not contiguous with the valid data in the block, and the gap can't
+        // be filled (unseekable stream); start over.
+        b->start = offset;
+        b->len = 0;
+        if (!block_make_writable(s, b)) {
+            unlink_block(s, b);
+            s->idle = true;
+            s->reads++; // don't stuck main thread
+            return;
+        }
+    }
 
     // limit read size (or else would block and read the entire buffer in 1 call)
-    space = FFMIN(space, s->stream->read_chunk);
-
-    // back+newb+space <= buffer_size
-    int64_t back2 = s->buffer_size - (space + newb); // max back size
-    if (s->min_filepos < (read - back2))
-        s->min_filepos = read - back2;
-
-    // The read call might take a long time and block, so drop the lock.
+    int space = MPMIN(s->block_size - offset, s->stream->read_chunk);
+    if (fill_gap)
+        space = b->start - offset;
+
+    // The read call might take a long time and block, so drop the lock. The
+    // block can't be changed by other threads (only the reader accesses it,
+    // and only the parts which are already valid; prefetch threads don't
+    // evict fill_block).
+    s->fill_block = b;
     pthread_mutex_unlock(&s->mutex);
-    len = stream_read_partial(s->stream, &s->buffer[pos], space);
+    if (fill_gap) {
+        len = stream_read(s->stream, block_data(s, b) + offset, space);
+    } else {
+        len = stream_read_partial(s->stream, block_data(s, b) + offset, space);
+    }
     pthread_mutex_lock(&s->mutex);
+    s->fill_block = NULL;
 
     // Do this after reading a block, because at least libdvdnav updates the
     // stream position only after actually reading something after a seek.
@@ -271,9 +462,19 @@ static void cache_fill(struct priv *s)
             s->start_pts = pts;
     }
 
-    s->max_filepos += len;
-    if (pos + len == s->buffer_size)
-        s->offset += s->buffer_size; // wrap...
+    s->stream_pos = fill_pos + MPMAX(len, 0);
+    if (fill_gap) {
+        // A short read means EOF or an error; the partial gap data is dropped.
+        if (len == space) {
+            b->start = offset;
+            b->len += len;
+        } else {
+            len = 0;
+        }
+    } else {
+        b->len += MPMAX(len, 0);
+    }
+    b->last_use = s->use_counter++;
 
 done:
     s->eof = len <= 0;
@@ -285,6 +486,117 @@ done:
     }
 
     pthread_cond_signal(&s->wakeup);
+    pthread_cond_broadcast(&s->prefetch_wakeup);
+}
+
+// Return the position of the next block a prefetch thread should read, or -1
+// if there is nothing to do. The block containing the first missing byte after
+// the read position is left to the cache thread, which will usually read it
+// sequentially anyway.
+static int64_t find_prefetch_target(struct priv *s)
+{
+    if (!s->enable_readahead || s->stream_size < 0)
+        return -1;
+    int64_t read = s->read_filepos;
+    int64_t first = cached_until(s, read);
+    int64_t limit = MPMIN(read + s->buffer_size - s->back_size, s->stream_size);
+    for (int64_t pos = first - first % s->block_size + s->block_size;
+         pos < limit; pos += s->block_size)
+    {
+        if (pos + s->block_size > limit && limit < s->stream_size)
+            break; // wait until the whole block fits into the readahead
+        if (!find_block(s, pos) && !is_prefetching(s, pos))
+            return pos;
+    }
+    return -1;
+}
+
+// Add a block read by a prefetch thread to the cache. Takes over buf.
+static void add_prefetched_block(struct priv *s, int64_t pos,
+                                 AVBufferRef **buf, int len)
+{
+    int64_t read = s->read_filepos;
+    int64_t ahead_limit = read + s->buffer_size - s->back_size;
+    // Drop it if the reader has seeked away in the meantime.
+    if (len <= 0 || find_block(s, pos) || pos + len <= read || pos >= ahead_limit)
+        return;
+    struct cache_block *b = evict_block(s, read - s->back_size, ahead_limit);
+    if (!b)
+        return;
+    link_block(s, b, pos);
+    av_buffer_unref(&b->buf);
+    b->buf = *buf;
+    *buf = NULL;
+    b->len = len;
+}
+
+static void *prefetch_thread(void *arg)
+{
+    struct prefetch_worker *w = arg;
+    struct priv *s = w->s;
+    mpthread_set_name("cache-prefetch");
+
+    // Open a separate connection; this can take a while for network streams.
+    stream_t *stream = stream_create(s->stream->url, STREAM_READ,
+                                     s->prefetch_cancel, s->stream->global);
+    if (stream && !stream->seekable) {
+        free_stream(stream);
+        stream = NULL;
+    }
+    if (!stream)
+        MP_WARN(s, "Could not open prefetch connection.\n");
+
+    pthread_mutex_lock(&s->mutex);
+    while (stream && !s->prefetch_quit) {
+        int64_t pos = find_prefetch_target(s);
+        if (pos < 0) {
+            struct timespec ts = mp_rel_time_to_timespec(CACHE_IDLE_SLEEP_TIME);
+            pthread_cond_timedwait(&s->prefetch_wakeup, &s->mutex, &ts);
+            continue;
+        }
+
+        w->pos = pos;
+        uint64_t gen = s->prefetch_gen;
+        AVBufferRef *buf = av_buffer_pool_get(s->pool);
+        pthread_mutex_unlock(&s->mutex);
+
+        int len = 0;
+        if (buf && stream_seek(stream, pos)) {
+            while (len < s->block_size && !mp_cancel_test(s->prefetch_cancel)) {
+                int r = stream_read_partial(stream, buf->data + len,
+                                            s->block_size - len);
+                if (r <= 0)
+                    break;
+                len += r;
+            }
+        }
+        MP_TRACE(s, "Prefetched %d bytes at %"PRId64".\n", len, pos);
+
+        pthread_mutex_lock(&s->mutex);
+        if (gen == s->prefetch_gen)
+            add_prefetched_block(s, pos, &buf, len);
+        av_buffer_unref(&buf);
+        w->pos = -1;
+        // Wakeup both the cache thread and a possibly waiting reader.
+        pthread_cond_broadcast(&s->wakeup);
+        if (len <= 0 && !s->prefetch_quit) {
+            // Broken connection or cancellation. Don't retry right away (the
+            // cache thread reads the block itself in the meantime).
+            struct timespec ts = mp_rel_time_to_timespec(CACHE_IDLE_SLEEP_TIME);
+            pthread_cond_timedwait(&s->prefetch_wakeup, &s->mutex, &ts);
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    free_stream(stream);
+    return NULL;
+}
+
+static int compare_block_use(const void *pa, const void *pb)
+{
+    const struct cache_block *a = *(struct cache_block **)pa;
+    const struct cache_block *b = *(struct cache_block **)pb;
+    return a->last_use < b->last_use ? 1 : (a->last_use > b->last_use ? -1 : 0);
 }
 
 // This is called both during init and at runtime.
@@ -298,42 +610,60 @@ static int resize_cache(struct priv *s, int64_t size)
     s->back_size = MPCLAMP(s->back_size, min_size, max_size);
     buffer_size += s->back_size;
 
-    unsigned char *buffer = malloc(buffer_size);
-    if (!buffer) {
-        free(buffer);
+    // Round up, and add slack for partially filled blocks at range borders.
+    int64_t num_blocks64 = (buffer_size + s->block_size - 1) / s->block_size;
+    if (num_blocks64 > INT_MAX / 4)
         return STREAM_ERROR;
-    }
-
-    if (s->buffer) {
-        // Copy & free the old ringbuffer data.
-        // If the buffer is too small, prefer to copy these regions:
-        // 1. Data starting from read_filepos, until cache end
-        size_t read_1 = read_buffer(s, buffer, buffer_size, s->read_filepos);
-        // 2. then data from before read_filepos until cache start
-        //    (this one needs to be copied to the end of the ringbuffer)
-        size_t read_2 = 0;
-        if (s->min_filepos < s->read_filepos) {
-            size_t copy_len = buffer_size - read_1;
-            copy_len = MPMIN(copy_len, s->read_filepos - s->min_filepos);
-            assert(copy_len + read_1 <= buffer_size);
-            read_2 = read_buffer(s, buffer + buffer_size - copy_len, copy_len,
-                                 s->read_filepos - copy_len);
-            // This shouldn't happen, unless copy_len was computed incorrectly.
-            assert(read_2 == copy_len);
+    int num_blocks = num_blocks64 + 2;
+    int num_buckets = 1;
+    while (num_buckets < num_blocks)
+        num_buckets *= 2;
+
+    struct cache_block *blocks = talloc_array(NULL, struct cache_block, num_blocks);
+    int *buckets = talloc_array(blocks, int, num_buckets);
+    for (int n = 0; n < num_blocks; n++)
+        blocks[n] = (struct cache_block){ .pos = -1, .next = -1 };
+    for (int n = 0; n < num_buckets; n++)
+        buckets[n] = -1;
+
+    struct cache_block *old_blocks = s->blocks;
+    int num_old_blocks = s->num_blocks;
+    s->blocks = blocks;
+    s->num_blocks = num_blocks;
+    s->buckets = buckets;
+    s->num_buckets = num_buckets;
+
+    if (old_blocks) {
+        // Take over the old blocks, preferring the most recently used blocks
+        // if the new cache is smaller.
+        struct cache_block **list =
+            talloc_array(NULL, struct cache_block *, num_old_blocks);
+        int num_list = 0;
+        for (int n = 0; n < num_old_blocks; n++) {
+            if (old_blocks[n].pos >= 0)
+                list[num_list++] = &old_blocks[n];
         }
-        // Set it up such that read_1 is at buffer pos 0, and read_2 wraps
-        // around below it, so that it is located at the end of the buffer.
-        s->min_filepos = s->read_filepos - read_2;
-        s->max_filepos = s->read_filepos + read_1;
-        s->offset = s->max_filepos - read_1;
+        qsort(list, num_list, sizeof(list[0]), compare_block_use);
+        for (int n = 0; n < MPMIN(num_list, num_blocks); n++) {
+            struct cache_block *ob = list[n];
+            struct cache_block *b = &s->blocks[n];
+            link_block(s, b, ob->pos);
+            b->start = ob->start;
+            b->len = ob->len;
+            b->last_use = ob->last_use;
+            b->was_read = ob->was_read;
+            b->buf = ob->buf;
+            ob->buf = NULL;
+        }
+        talloc_free(list);
+        for (int n = 0; n < num_old_blocks; n++)
+            av_buffer_unref(&old_blocks[n].buf);
+        talloc_free(old_blocks);
     } else {
         cache_drop_contents(s);
     }
 
-    free(s->buffer);
-
     s->buffer_size = buffer_size;
-    s->buffer = buffer;
     s->idle = false;
     s->eof = false;
 
@@ -375,7 +705,7 @@ static int cache_get_cached_control(stream_t *cache, int cmd, void *arg)
         *(int64_t *)arg = s->buffer_size - s->back_size;
         return STREAM_OK;
     case STREAM_CTRL_GET_CACHE_FILL:
-        *(int64_t *)arg = s->max_filepos - s->read_filepos;
+        *(int64_t *)arg = cached_until(s, s->read_filepos) - s->read_filepos;
         return STREAM_OK;
     case STREAM_CTRL_GET_CACHE_IDLE:
         *(int *)arg = s->idle;
@@ -477,6 +807,7 @@ static void *cache_thread(void *arg)
     update_cached_controls(s);
     double last = mp_time_sec();
     while (s->control != CACHE_CTRL_QUIT) {
+        s->prefetch_wait = false;
         if (mp_time_sec() - last > CACHE_UPDATE_CONTROLS_TIME) {
             update_cached_controls(s);
             last = mp_time_sec();
@@ -490,7 +821,7 @@ static void *cache_thread(void *arg)
             pthread_cond_signal(&s->wakeup);
             s->control = CACHE_CTRL_NONE;
         }
-        if (s->idle && s->control == CACHE_CTRL_NONE) {
+        if ((s->idle || s->prefetch_wait) && s->control == CACHE_CTRL_NONE) {
             struct timespec ts = mp_rel_time_to_timespec(CACHE_IDLE_SLEEP_TIME);
             pthread_cond_timedwait(&s->wakeup, &s->mutex, &ts);
         }
@@ -521,7 +852,7 @@ static int cache_fill_buffer(struct stream *cache, char *buffer, int max_len)
             s->read_filepos += readb;
             if (readb > 0)
                 break;
-            if (s->eof && s->read_filepos >= s->max_filepos && s->reads >= retry)
+            if (s->eof && s->reads >= retry)
                 break;
             s->idle = false;
             if (mp_cancel_test(s->cache->cancel))
@@ -536,6 +867,50 @@ static int cache_fill_buffer(struct stream *cache, char *buffer, int max_len)
     return readb;
 }
 
+// Return a reference to len bytes of cache memory at pos, and continue
+// reading after them. This works only if the data is cached in a single block.
+// The FF_INPUT_BUFFER_PADDING_SIZE bytes after the data are either more valid
+// data or the zeroed padding at the block end. Valid block data is never
+// written to while it's referenced, so the padding is never written to either.
+// (The bytes after the last valid byte are written by the cache thread.)
+// Small reads are copied instead: the reference keeps the whole block alive,
+// which the packet memory accounting in the demuxer doesn't see.
+static struct AVBufferRef *cache_read_ref(struct stream *cache, int64_t pos,
+                                          int len)
+{
+    struct priv *s = cache->priv;
+    assert(s->cache_thread_running);
+
+    if (len < s->block_size / 8)
+        return NULL;
+
+    pthread_mutex_lock(&s->mutex);
+
+    AVBufferRef *ref = NULL;
+    struct cache_block *b = find_block(s, pos);
+    int64_t end = pos + len;
+    int64_t valid_end = b ? b->pos + b->start + b->len : -1;
+    if (len > 0 && is_cached(s, pos) && end <= valid_end &&
+        (end + FF_INPUT_BUFFER_PADDING_SIZE <= valid_end ||
+         end == b->pos + s->block_size))
+    {
+        ref = av_buffer_ref(b->buf);
+        if (ref) {
+            ref->data += pos - b->pos;
+            ref->size = len;
+            b->last_use = s->use_counter++;
+            b->was_read = true;
+            s->read_filepos = end;
+            s->read_min = s->read_filepos + 64 * 1024;
+        }
+    }
+
+    // wakeup the cache thread, possibly make it read more data ahead
+    pthread_cond_signal(&s->wakeup);
+    pthread_mutex_unlock(&s->mutex);
+    return ref;
+}
+
 static int cache_seek(stream_t *cache, int64_t pos)
 {
     struct priv *s = cache->priv;
@@ -544,14 +919,13 @@ static int cache_seek(stream_t *cache, int64_t pos)
 
     pthread_mutex_lock(&s->mutex);
 
-    MP_DBG(s, "request seek: %" PRId64 " <= to=%" PRId64
-           " (cur=%" PRId64 ") <= %" PRId64 "  \n",
-           s->min_filepos, pos, s->read_filepos, s->max_filepos);
+    MP_DBG(s, "request seek: to=%" PRId64 " (cur=%" PRId64 ") cached=%d\n",
+           pos, s->read_filepos, is_cached(s, pos));
 
-    if (!s->seekable && pos > s->max_filepos) {
+    if (!s->seekable && !is_cached(s, pos) && pos > s->stream_pos) {
         MP_ERR(s, "Attempting to seek past cached data in unseekable stream.\n");
         r = 0;
-    } else if (!s->seekable && pos < s->min_filepos) {
+    } else if (!s->seekable && !is_cached(s, pos) && pos < s->stream_pos) {
         MP_ERR(s, "Attempting to seek before cached data in unseekable stream.\n");
         r = 0;
     } else {
@@ -605,6 +979,16 @@ done:
 static void cache_uninit(stream_t *cache)
 {
     struct priv *s = cache->priv;
+    if (s->num_workers) {
+        pthread_mutex_lock(&s->mutex);
+        s->prefetch_quit = true;
+        pthread_cond_broadcast(&s->prefetch_wakeup);
+        pthread_mutex_unlock(&s->mutex);
+        // Abort reads (and opens) in progress.
+        mp_cancel_trigger(s->prefetch_cancel);
+        for (int n = 0; n < s->num_workers; n++)
+            pthread_join(s->workers[n].thread, NULL);
+    }
     if (s->cache_thread_running) {
         MP_VERBOSE(s, "Terminating cache...\n");
         pthread_mutex_lock(&s->mutex);
@@ -615,7 +999,12 @@ static void cache_uninit(stream_t *cache)
     }
     pthread_mutex_destroy(&s->mutex);
     pthread_cond_destroy(&s->wakeup);
-    free(s->buffer);
+    pthread_cond_destroy(&s->prefetch_wakeup);
+    for (int n = 0; n < s->num_blocks; n++)
+        av_buffer_unref(&s->blocks[n].buf);
+    talloc_free(s->blocks);
+    // Memory still referenced by packets is freed when they are freed.
+    av_buffer_pool_uninit(&s->pool);
     talloc_free(s);
 }
 
@@ -631,8 +1020,7 @@ int stream_cache_init(stream_t *cache, stream_t *stream,
     s->log = cache->log;
     s->eof_pos = -1;
     s->enable_readahead = true;
-
-    cache_drop_contents(s);
+    s->stream_pos = stream_tell(stream);
 
     s->seek_limit = opts->seek_min * 1024ULL;
     s->back_size = opts->back_buffer * 1024ULL;
@@ -643,8 +1031,19 @@ int stream_cache_init(stream_t *cache, stream_t *stream,
     if (file_size >= 0)
         cache_size = MPMIN(cache_size, file_size);
 
-    if (resize_cache(s, cache_size) != STREAM_OK) {
+    // The block size can't change later, so it's based on the initial size.
+    s->block_size = MAX_BLOCK_SIZE;
+    while (s->block_size > MIN_BLOCK_SIZE &&
+           s->block_size * 8LL > cache_size + s->back_size)
+        s->block_size /= 2;
+
+    if (resize_cache(s, cache_size) == STREAM_OK) {
+        int alloc_size = s->block_size + FF_INPUT_BUFFER_PADDING_SIZE;
+        s->pool = av_buffer_pool_init(alloc_size, av_buffer_allocz);
+    }
+    if (!s->pool) {
         MP_ERR(s, "Failed to allocate cache buffer.\n");
+        talloc_free(s->blocks);
         talloc_free(s);
         return -1;
     }
@@ -655,6 +1054,7 @@ int stream_cache_init(stream_t *cache, stream_t *stream,
 
     pthread_mutex_init(&s->mutex, NULL);
     pthread_cond_init(&s->wakeup, NULL);
+    pthread_cond_init(&s->prefetch_wakeup, NULL);
 
     cache->priv = s;
     s->cache = cache;
@@ -662,6 +1062,7 @@ int stream_cache_init(stream_t *cache, stream_t *stream,
 
     cache->seek = cache_seek;
     cache->fill_buffer = cache_fill_buffer;
+    cache->read_ref = cache_read_ref;
     cache->control = cache_control;
     cache->close = cache_uninit;
 
@@ -671,6 +1072,25 @@ int stream_cache_init(stream_t *cache, stream_t *stream,
 
     s->seekable = stream->seekable;
 
+    // Prefetching requires reopening the source with the same URL, and
+    // requests for arbitrary byte ranges.
+    if (opts->prefetch > 0 && stream->seekable && stream->allow_reopen &&
+        !stream->uncached_stream && file_size >= 0)
+    {
+        MP_VERBOSE(s, "Using %d prefetch connections.\n", opts->prefetch);
+        s->prefetch_cancel = mp_cancel_new(s);
+        if (cache->cancel)
+            mp_cancel_set_parent(s->prefetch_cancel, cache->cancel);
+        s->workers = talloc_zero_array(s, struct prefetch_worker, opts->prefetch);
+        for (int n = 0; n < opts->prefetch; n++) {
+            struct prefetch_worker *w = &s->workers[s->num_workers];
+            *w = (struct prefetch_worker){ .s = s, .pos = -1 };
+            if (pthread_create(&w->thread, NULL, prefetch_thread, w) != 0)
+                break;
+            s->num_workers++;
+        }
+    }
+
     if (pthread_create(&s->cache_thread, NULL, cache_thread, s) != 0) {
         MP_ERR(s, "Starting cache thread failed.\n");
         return -1;
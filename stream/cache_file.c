@@ -17,6 +17,23 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <libavutil/common.h>
+#include <libavutil/md5.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <dirent.h>
+#include <utime.h>
+#include <sys/mman.h>
+#endif
 
 #include "osdep/io.h"
 
@@ -24,16 +41,43 @@
 #include "common/msg.h"
 
 #include "options/options.h"
+#include "options/path.h"
 
 #include "stream.h"
 
 #define BLOCK_SIZE 1024LL
 #define BLOCK_ALIGN(p) ((p) & ~(BLOCK_SIZE - 1))
 
+// Layout of a mapped cache file: header, block bitmap, cached data. The header
+// and the bitmap are padded to PAGE_ALIGN, so that each part can be accessed
+// through the mapping without unaligned page boundaries. If the file can't be
+// mapped (only for --cache-file), it contains just the data, and is accessed
+// with fread()/fwrite().
+#define PAGE_ALIGN 4096LL
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+
+#define CACHE_FILE_MAGIC "mpvcach2"
+
+struct cache_file_header {
+    char magic[8];
+    int64_t block_size;
+    int64_t data_size;      // size of the data part (max. size that is cached)
+    // Identifies the source. The cache contents are discarded if these don't
+    // match on reopening.
+    uint8_t url_md5[16];
+    int64_t stream_size;
+    int64_t mtime;          // STREAM_CTRL_GET_MTIME, 0 if unknown
+    char mime_type[128];
+};
+
 struct priv {
     struct stream *original;
     FILE *cache_file;
+    void *map;              // mapping of the whole cache file, or NULL
+    size_t map_size;
     uint8_t *block_bits;    // 1 bit for each BLOCK_SIZE, whether block was read
+    uint8_t *data;          // cached data (file position 0 is data[0]), or
+                            // NULL if the file is accessed with stdio
     int64_t size;           // currently known size
     int64_t max_size;       // max. size for block_bits and cache_file
 };
@@ -75,9 +119,11 @@ static int fill_buffer(stream_t *s, char *buffer, int max_len)
     int64_t aligned = BLOCK_ALIGN(s->pos);
     if (!test_bit(p, aligned)) {
         char tmp[BLOCK_SIZE];
+        char *dst = p->data ? (char *)p->data + aligned : tmp;
+        int64_t len = MPMIN(BLOCK_SIZE, p->max_size - aligned);
         stream_seek(p->original, aligned);
-        int r = stream_read(p->original, tmp, BLOCK_SIZE);
-        if (r < BLOCK_SIZE) {
+        int r = stream_read(p->original, dst, len);
+        if (r < len) {
             if (p->size < 0) {
                 MP_WARN(s, "suspected EOF\n");
             } else if (aligned + r < p->size) {
@@ -85,20 +131,29 @@ static int fill_buffer(stream_t *s, char *buffer, int max_len)
                 return -1;
             }
         }
-        if (fseeko(p->cache_file, aligned, SEEK_SET))
-            return -1;
-        if (fwrite(tmp, r, 1, p->cache_file) != 1)
+        if (r <= 0)
             return -1;
+        if (!p->data) {
+            if (fseeko(p->cache_file, aligned, SEEK_SET))
+                return -1;
+            if (fwrite(tmp, r, 1, p->cache_file) != 1)
+                return -1;
+        }
         set_bit(p, aligned, 1);
     }
-    if (fseeko(p->cache_file, s->pos, SEEK_SET))
-        return -1;
     // align/limit to blocks
     max_len = MPMIN(max_len, BLOCK_SIZE - (s->pos % BLOCK_SIZE));
     // Limit to max. known file size
     if (p->size >= 0)
         max_len = MPMIN(max_len, p->size - s->pos);
-    return fread(buffer, 1, max_len, p->cache_file);
+    max_len = MPMAX(max_len, 0);
+    if (!p->data) {
+        if (fseeko(p->cache_file, s->pos, SEEK_SET))
+            return -1;
+        return fread(buffer, 1, max_len, p->cache_file);
+    }
+    memcpy(buffer, p->data + s->pos, max_len);
+    return max_len;
 }
 
 static int seek(stream_t *s, int64_t newpos)
@@ -112,42 +167,251 @@ static int control(stream_t *s, int cmd, void *arg)
     return stream_control(p->original, cmd, arg);
 }
 
+#if HAVE_POSIX
+static bool map_cache_file(struct priv *p)
+{
+    p->map = mmap(NULL, p->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fileno(p->cache_file), 0);
+    if (p->map != MAP_FAILED)
+        return true;
+    p->map = NULL;
+    return false;
+}
+#endif
+
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
+#if HAVE_POSIX
+    if (p->map)
+        munmap(p->map, p->map_size);
+#endif
     if (p->cache_file)
         fclose(p->cache_file);
     talloc_free(p);
 }
 
+#if HAVE_POSIX
+
+struct dir_entry {
+    char *path;
+    int64_t size;
+    time_t mtime;
+};
+
+static int compare_mtime(const void *a, const void *b)
+{
+    const struct dir_entry *ea = a, *eb = b;
+    return ea->mtime > eb->mtime ? 1 : (ea->mtime < eb->mtime ? -1 : 0);
+}
+
+// Delete the least recently used cache files in dir (except keep), until the
+// disk space used by the remaining ones is at most max_bytes.
+static void prune_cache_dir(stream_t *cache, const char *dir, const char *keep,
+                            int64_t max_bytes)
+{
+    void *tmp = talloc_new(NULL);
+    struct dir_entry *entries = NULL;
+    int num_entries = 0;
+    int64_t total = 0;
+
+    DIR *d = opendir(dir);
+    if (!d)
+        goto done;
+    struct dirent *ep;
+    while ((ep = readdir(d))) {
+        // Only touch files that look like cache files (see below).
+        if (strlen(ep->d_name) != 32 || strspn(ep->d_name, "0123456789ABCDEF") != 32)
+            continue;
+        char *path = mp_path_join(tmp, dir, ep->d_name);
+        struct stat st;
+        if (strcmp(path, keep) == 0 || stat(path, &st) || !S_ISREG(st.st_mode))
+            continue;
+        // The files are sparse; count the space actually used.
+        struct dir_entry e = {path, (int64_t)st.st_blocks * 512, st.st_mtime};
+        MP_TARRAY_APPEND(tmp, entries, num_entries, e);
+        total += e.size;
+    }
+    closedir(d);
+
+    qsort(entries, num_entries, sizeof(entries[0]), compare_mtime);
+    for (int n = 0; n < num_entries && total > max_bytes; n++) {
+        MP_VERBOSE(cache, "removing old cache file '%s'\n", entries[n].path);
+        if (unlink(entries[n].path) == 0)
+            total -= entries[n].size;
+    }
+
+done:
+    talloc_free(tmp);
+}
+
+// Open the persistent cache file for the stream's URL in the given directory.
+// hdr is the header the file must have for its contents to be reused.
+// max_total is the size limit for the directory.
+static FILE *open_persistent_file(stream_t *cache, stream_t *stream,
+                                  const char *dir, int64_t max_total,
+                                  struct cache_file_header *hdr)
+{
+    void *tmp = talloc_new(NULL);
+    FILE *file = NULL;
+
+    av_md5_sum(hdr->url_md5, stream->url, strlen(stream->url));
+    if (stream->mime_type)
+        snprintf(hdr->mime_type, sizeof(hdr->mime_type), "%s", stream->mime_type);
+    int64_t mtime = 0;
+    if (stream_control(stream, STREAM_CTRL_GET_MTIME, &mtime) == STREAM_OK)
+        hdr->mtime = mtime;
+
+    if (hdr->stream_size < 0) {
+        MP_WARN(cache, "stream size unknown, not using persistent cache\n");
+        goto done;
+    }
+
+    char *path = mp_get_user_path(tmp, cache->global, dir);
+    mp_mkdirp(path);
+    char *name = talloc_strdup(tmp, "");
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02X", hdr->url_md5[i]);
+    char *file_path = mp_path_join(tmp, path, name);
+
+    if (max_total > 0)
+        prune_cache_dir(cache, path, file_path, MPMAX(max_total - hdr->data_size, 0));
+
+    int fd = open(file_path, O_RDWR | O_BINARY | O_CLOEXEC);
+    if (fd >= 0 && (file = fdopen(fd, "rb+"))) {
+        struct cache_file_header old = {0};
+        if (fread(&old, sizeof(old), 1, file) != 1 ||
+            memcmp(&old, hdr, sizeof(old)) != 0)
+        {
+            fclose(file);
+            file = NULL;
+        }
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    if (!file) {
+        // Other processes might have the old file mapped, so it must not be
+        // truncated. Create a new file, and replace the old one atomically.
+        MP_VERBOSE(cache, "discarding old cache file contents\n");
+        char *tmp_path = talloc_asprintf(tmp, "%s.%d.tmp", file_path,
+                                         (int)getpid());
+        fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_BINARY | O_CLOEXEC,
+                  0666);
+        if (fd >= 0 && !(file = fdopen(fd, "rb+")))
+            close(fd);
+        if (file && (fwrite(hdr, sizeof(*hdr), 1, file) != 1 ||
+                     fflush(file) || rename(tmp_path, file_path)))
+        {
+            fclose(file);
+            file = NULL;
+        }
+        if (!file) {
+            unlink(tmp_path);
+            MP_ERR(cache, "can't create cache file '%s'\n", file_path);
+            goto done;
+        }
+    }
+
+    // Mark as recently used for prune_cache_dir().
+    utime(file_path, NULL);
+
+    MP_VERBOSE(cache, "using persistent cache file '%s'\n", file_path);
+
+done:
+    talloc_free(tmp);
+    return file;
+}
+
+#endif
+
 // return 1 on success, 0 if disabled, -1 on error
 int stream_file_cache_init(stream_t *cache, stream_t *stream,
                            struct mp_cache_opts *opts)
 {
-    if (!opts->file || !opts->file[0] || opts->file_max < 1)
+    bool persistent = opts->dir && opts->dir[0];
+    if ((!persistent && (!opts->file || !opts->file[0])) || opts->file_max < 1)
         return 0;
 
+#if !HAVE_POSIX
+    if (persistent) {
+        MP_ERR(cache, "persistent file cache not available on this platform\n");
+        return -1;
+    }
+#endif
+
     if (!stream->seekable) {
         MP_ERR(cache, "can't cache unseekable stream\n");
         return -1;
     }
 
-    bool use_anon_file = strcmp(opts->file, "TMP") == 0;
-    FILE *file = use_anon_file ? tmpfile() : fopen(opts->file, "wb+");
-    if (!file) {
-        MP_ERR(cache, "can't open cache file '%s'\n", opts->file);
-        return -1;
+    int64_t stream_size = stream_get_size(stream);
+    int64_t max_size = opts->file_max * 1024LL;
+    if (stream_size > 0)
+        max_size = MPMIN(max_size, stream_size);
+
+    struct cache_file_header hdr = {
+        .magic = CACHE_FILE_MAGIC,
+        .block_size = BLOCK_SIZE,
+        .data_size = max_size,
+        .stream_size = stream_size,
+    };
+
+    FILE *file = NULL;
+    if (persistent) {
+#if HAVE_POSIX
+        file = open_persistent_file(cache, stream, opts->dir,
+                                    opts->dir_max * 1024LL, &hdr);
+#endif
+    } else {
+        bool use_anon_file = strcmp(opts->file, "TMP") == 0;
+        file = use_anon_file ? tmpfile() : fopen(opts->file, "wb+");
+        if (!file)
+            MP_ERR(cache, "can't open cache file '%s'\n", opts->file);
     }
+    if (!file)
+        return -1;
 
     struct priv *p = talloc_zero(NULL, struct priv);
 
     cache->priv = p;
     p->original = stream;
     p->cache_file = file;
-    p->max_size = opts->file_max * 1024LL;
+    p->max_size = max_size;
+
+    // file_max can be INT_MAX (2 TiB), so the bitmap can be up to 256 MiB
+    int64_t bits_size = (p->max_size / BLOCK_SIZE + 1) / 8 + 1;
+    int64_t bits_offset = ALIGN_UP(sizeof(hdr), PAGE_ALIGN);
+    int64_t data_offset = bits_offset + ALIGN_UP(bits_size, PAGE_ALIGN);
+
+#if HAVE_POSIX
+    int64_t file_size = data_offset + ALIGN_UP(p->max_size, PAGE_ALIGN);
+    // The file is sparse; only blocks that are actually read use disk space.
+    // Growing the file is safe even if other processes have it mapped.
+    if ((uint64_t)file_size <= SIZE_MAX && !ftruncate(fileno(file), file_size)) {
+        p->map_size = file_size;
+        map_cache_file(p);
+    }
+#endif
+    if (p->map) {
+        p->block_bits = (uint8_t *)p->map + bits_offset;
+        p->data = (uint8_t *)p->map + data_offset;
+    } else if (persistent) {
+        MP_ERR(cache, "can't map cache file\n");
+        goto error;
+    } else {
+        p->block_bits = talloc_zero_size(p, bits_size);
+    }
 
-    // file_max can be INT_MAX, so this is at most about 256MB
-    p->block_bits = talloc_zero_size(p, (p->max_size / BLOCK_SIZE + 1) / 8 + 1);
+    if (persistent) {
+        // If the file was (re)created, the bitmap is all-zero, i.e. empty.
+        memcpy(p->map, &hdr, sizeof(hdr));
+        int64_t cached = 0;
+        for (int64_t n = 0; n < bits_size; n++)
+            cached += av_popcount(p->block_bits[n]);
+        if (cached)
+            MP_INFO(cache, "reusing %"PRId64" KiB of cached data\n", cached);
+    }
 
     cache->seek = seek;
     cache->fill_buffer = fill_buffer;
@@ -155,4 +419,10 @@ int stream_file_cache_init(stream_t *cache, stream_t *stream,
     cache->close = s_close;
 
     return 1;
+
+error:
+    cache->priv = NULL;
+    fclose(file);
+    talloc_free(p);
+    return -1;
 }
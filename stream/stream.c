@@ -24,8 +24,11 @@
 
 #include <strings.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavutil/common.h>
+#include <libavutil/buffer.h>
+#include <libavcodec/avcodec.h>
 #include "osdep/atomics.h"
 #include "osdep/io.h"
 
@@ -538,6 +541,44 @@ int stream_read(stream_t *s, char *mem, int total)
     return total;
 }
 
+// Read up to len bytes (less only on EOF or error), and return them as
+// refcounted buffer. The data is followed by FF_INPUT_BUFFER_PADDING_SIZE
+// readable bytes. If the stream supports it, the buffer references stream
+// memory without copying; in this case the padding contains whatever follows
+// the data in stream memory (but is never written to).
+// Returns NULL on EOF or error.
+struct AVBufferRef *stream_read_ref(stream_t *s, int len)
+{
+    if (len <= 0)
+        return NULL;
+    // If the data is fully buffered, copying it is cheaper. Otherwise, the
+    // buffered data is a prefix of the requested data, and can be skipped.
+    int buffered = s->buf_len - s->buf_pos;
+    if (s->read_ref && s->seekable && !s->sector_size && !s->capture_file &&
+        buffered < len)
+    {
+        int64_t pos = stream_tell(s);
+        AVBufferRef *ref = s->read_ref(s, pos, len);
+        if (ref) {
+            s->buf_pos = s->buf_len = 0;
+            s->pos = pos + len;
+            s->eof = 0;
+            return ref;
+        }
+    }
+    AVBufferRef *buf = av_buffer_alloc(len + FF_INPUT_BUFFER_PADDING_SIZE);
+    if (!buf)
+        return NULL;
+    int read = stream_read(s, buf->data, len);
+    if (read <= 0) {
+        av_buffer_unref(&buf);
+        return NULL;
+    }
+    memset(buf->data + read, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    buf->size = read;
+    return buf;
+}
+
 // Read ahead at most len bytes without changing the read position. Return a
 // pointer to the internal buffer, starting from the current read position.
 // Can read ahead at most STREAM_MAX_BUFFER_SIZE bytes.
@@ -953,21 +994,35 @@ struct bstr stream_read_file(const char *filename, void *talloc_ctx,
 }
 
 struct mp_cancel {
+    pthread_mutex_t lock;
     atomic_bool triggered;
 #ifdef __MINGW32__
     HANDLE event;
 #endif
     int wakeup_pipe[2];
+
+    // Set with mp_cancel_set_parent(). slaves is protected by lock, parent by
+    // parent->lock.
+    struct mp_cancel *parent;
+    struct mp_cancel **slaves;
+    int num_slaves;
 };
 
 static void cancel_destroy(void *p)
 {
     struct mp_cancel *c = p;
+    pthread_mutex_lock(&c->lock);
+    for (int n = 0; n < c->num_slaves; n++)
+        c->slaves[n]->parent = NULL;
+    c->num_slaves = 0;
+    pthread_mutex_unlock(&c->lock);
+    mp_cancel_set_parent(c, NULL);
 #ifdef __MINGW32__
     CloseHandle(c->event);
 #endif
     close(c->wakeup_pipe[0]);
     close(c->wakeup_pipe[1]);
+    pthread_mutex_destroy(&c->lock);
 }
 
 struct mp_cancel *mp_cancel_new(void *talloc_ctx)
@@ -975,6 +1030,7 @@ struct mp_cancel *mp_cancel_new(void *talloc_ctx)
     struct mp_cancel *c = talloc_ptrtype(talloc_ctx, c);
     talloc_set_destructor(c, cancel_destroy);
     *c = (struct mp_cancel){.triggered = ATOMIC_VAR_INIT(false)};
+    pthread_mutex_init(&c->lock, NULL);
 #ifdef __MINGW32__
     c->event = CreateEventW(NULL, TRUE, FALSE, NULL);
 #endif
@@ -982,14 +1038,49 @@ struct mp_cancel *mp_cancel_new(void *talloc_ctx)
     return c;
 }
 
-// Request abort.
+// Request abort. This also triggers all slaves (see mp_cancel_set_parent()).
 void mp_cancel_trigger(struct mp_cancel *c)
 {
+    pthread_mutex_lock(&c->lock);
     atomic_store(&c->triggered, true);
 #ifdef __MINGW32__
     SetEvent(c->event);
 #endif
     write(c->wakeup_pipe[1], &(char){0}, 1);
+    for (int n = 0; n < c->num_slaves; n++)
+        mp_cancel_trigger(c->slaves[n]);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Make slave get triggered whenever parent is triggered (and right away if
+// parent is already triggered). Triggering or resetting slave doesn't affect
+// parent. parent==NULL removes the link. Must not be called concurrently for
+// the same slave, and the link must not form a cycle. If either is destroyed,
+// the link is removed.
+void mp_cancel_set_parent(struct mp_cancel *slave, struct mp_cancel *parent)
+{
+    if (slave->parent == parent)
+        return;
+    if (slave->parent) {
+        struct mp_cancel *old = slave->parent;
+        pthread_mutex_lock(&old->lock);
+        for (int n = 0; n < old->num_slaves; n++) {
+            if (old->slaves[n] == slave) {
+                MP_TARRAY_REMOVE_AT(old->slaves, old->num_slaves, n);
+                break;
+            }
+        }
+        slave->parent = NULL;
+        pthread_mutex_unlock(&old->lock);
+    }
+    if (parent) {
+        pthread_mutex_lock(&parent->lock);
+        MP_TARRAY_APPEND(parent, parent->slaves, parent->num_slaves, slave);
+        slave->parent = parent;
+        if (mp_cancel_test(parent))
+            mp_cancel_trigger(slave);
+        pthread_mutex_unlock(&parent->lock);
+    }
 }
 
 // Restore original state. (Allows reusing a mp_cancel.)
@@ -65,6 +65,7 @@ enum streamtype {
 
 enum stream_ctrl {
     STREAM_CTRL_GET_SIZE = 1,
+    STREAM_CTRL_GET_MTIME,      // int64_t*, modification time (Unix time)
 
     // Cache
     STREAM_CTRL_GET_CACHE_SIZE,
@@ -167,6 +168,12 @@ typedef struct stream {
 
     // Read
     int (*fill_buffer)(struct stream *s, char *buffer, int max_len);
+    // Read exactly len bytes at pos by referencing internal memory, and
+    // continue reading after them (optional). The data must be followed by
+    // FF_INPUT_BUFFER_PADDING_SIZE bytes that are never written to while the
+    // reference exists. Returns NULL if this is not possible, in which case
+    // nothing is read.
+    struct AVBufferRef *(*read_ref)(struct stream *s, int64_t pos, int len);
     // Write
     int (*write_buffer)(struct stream *s, char *buffer, int len);
     // Seek
@@ -197,6 +204,7 @@ typedef struct stream {
     bool fast_skip : 1; // consider stream fast enough to fw-seek by skipping
     bool is_network : 1; // original stream_info_t.is_network flag
     bool allow_caching : 1; // stream cache makes sense
+    bool allow_reopen : 1; // opening url again gives independent random access
     struct mp_log *log;
     struct MPOpts *opts;
     struct mpv_global *global;
@@ -251,6 +259,7 @@ inline static int64_t stream_tell(stream_t *s)
 bool stream_skip(stream_t *s, int64_t len);
 bool stream_seek(stream_t *s, int64_t pos);
 int stream_read(stream_t *s, char *mem, int total);
+struct AVBufferRef *stream_read_ref(stream_t *s, int len);
 int stream_read_partial(stream_t *s, char *buf, int buf_size);
 struct bstr stream_peek(stream_t *s, int len);
 void stream_drop_buffers(stream_t *s);
@@ -278,6 +287,7 @@ void mp_cancel_trigger(struct mp_cancel *c);
 bool mp_cancel_test(struct mp_cancel *c);
 bool mp_cancel_wait(struct mp_cancel *c, double timeout);
 void mp_cancel_reset(struct mp_cancel *c);
+void mp_cancel_set_parent(struct mp_cancel *slave, struct mp_cancel *parent);
 void *mp_cancel_get_event(struct mp_cancel *c); // win32 HANDLE
 int mp_cancel_get_fd(struct mp_cancel *c);
 
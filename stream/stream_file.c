@@ -25,15 +25,24 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+
+#include <libavutil/buffer.h>
+#include <libavcodec/avcodec.h>
 
 #ifndef __MINGW32__
 #include <poll.h>
 #endif
 
+#if HAVE_POSIX
+#include <sys/mman.h>
+#endif
+
 #include "osdep/io.h"
 
 #include "common/common.h"
 #include "common/msg.h"
+#include "options/options.h"
 #include "stream.h"
 #include "options/m_option.h"
 #include "options/path.h"
@@ -57,10 +66,25 @@
 #endif
 #endif
 
+// Size of the range ahead of the read position which the kernel is asked to
+// read in mmap mode. (Also used as alignment, so must be a multiple of the
+// page size.)
+#define MMAP_READAHEAD (8 * 1024 * 1024)
+
+// Files modified less than this many seconds before opening are likely still
+// being written, and are read with read() instead of being mapped.
+#define MMAP_MIN_AGE 10
+
 struct priv {
     int fd;
     bool close;
     bool regular;
+
+    // mmap mode (only for regular files)
+    AVBufferRef *map;       // the whole file
+    int64_t map_size;
+    int64_t map_pos;        // read position
+    int64_t advised_start, advised_end;
 };
 
 static int fill_buffer(stream_t *s, char *buffer, int max_len)
@@ -82,6 +106,132 @@ static int fill_buffer(stream_t *s, char *buffer, int max_len)
     return (r <= 0) ? -1 : r;
 }
 
+static int seek(stream_t *s, int64_t newpos)
+{
+    struct priv *p = s->priv;
+    return lseek(p->fd, newpos, SEEK_SET) != (off_t)-1;
+}
+
+#if HAVE_POSIX
+
+static void unmap_file(void *opaque, uint8_t *data)
+{
+    munmap(data, (size_t)(uintptr_t)opaque);
+}
+
+static void disable_mmap(stream_t *s)
+{
+    struct priv *p = s->priv;
+    lseek(p->fd, p->map_pos, SEEK_SET);
+    av_buffer_unref(&p->map);
+    s->seek = seek;
+    s->fill_buffer = fill_buffer;
+    s->read_ref = NULL;
+}
+
+// Tie the kernel's readahead to the read position: once it gets near the end
+// of the previously advised range (or jumps out of it due to a seek), request
+// the next MMAP_READAHEAD bytes. Also check whether the file was truncated,
+// since accessing mapped pages past the file end raises SIGBUS. In this case,
+// switch to read() calls, and return false.
+static bool mmap_advise(stream_t *s, int64_t pos)
+{
+    struct priv *p = s->priv;
+    if (pos >= p->advised_start && pos + MMAP_READAHEAD / 2 < p->advised_end)
+        return true;
+    struct stat st;
+    if (fstat(p->fd, &st) || st.st_size < p->map_size) {
+        MP_WARN(s, "File was truncated, not using mmap anymore.\n");
+        disable_mmap(s);
+        return false;
+    }
+    if (pos >= p->map_size)
+        return true;
+    int64_t start = MP_ALIGN_DOWN(pos, MMAP_READAHEAD);
+    int64_t end = MPMIN(start + 2 * MMAP_READAHEAD, p->map_size);
+    madvise(p->map->data + start, end - start, MADV_WILLNEED);
+    p->advised_start = start;
+    p->advised_end = end;
+    return true;
+}
+
+static int fill_buffer_mmap(stream_t *s, char *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+    int len = MPMIN(max_len, MPMAX(p->map_size - p->map_pos, 0));
+    if (len <= 0)
+        return -1;
+    if (!mmap_advise(s, p->map_pos + len))
+        return fill_buffer(s, buffer, max_len);
+    memcpy(buffer, p->map->data + p->map_pos, len);
+    p->map_pos += len;
+    return len;
+}
+
+// Return a reference to the mapped file data. The padding is the file data
+// following the packet, which is never written to. Packets near the file end
+// are not returned this way, because the padding would not be mapped; they are
+// copied into a zero-padded buffer instead.
+static struct AVBufferRef *read_ref_mmap(stream_t *s, int64_t pos, int len)
+{
+    struct priv *p = s->priv;
+    int64_t end = pos + len + FF_INPUT_BUFFER_PADDING_SIZE;
+    if (pos < 0 || end > p->map_size || !mmap_advise(s, end))
+        return NULL;
+    AVBufferRef *ref = av_buffer_ref(p->map);
+    if (!ref)
+        return NULL;
+    ref->data += pos;
+    ref->size = len;
+    p->map_pos = pos + len;
+    return ref;
+}
+
+static int seek_mmap(stream_t *s, int64_t newpos)
+{
+    struct priv *p = s->priv;
+    p->map_pos = newpos;
+    if (!mmap_advise(s, newpos))
+        return seek(s, newpos);
+    return 1;
+}
+
+// Map the whole file. The mapping stays valid as long as any reference
+// returned by read_ref_mmap() exists, even after the stream is closed.
+static bool init_mmap(stream_t *s)
+{
+    struct priv *p = s->priv;
+    struct stat st;
+    if (fstat(p->fd, &st))
+        return false;
+    if (st.st_mtime > time(NULL) - MMAP_MIN_AGE) {
+        MP_VERBOSE(s, "File was modified recently, not using mmap.\n");
+        return false;
+    }
+    off_t size = st.st_size;
+    if (size <= 0 || (uint64_t)size > SIZE_MAX)
+        return false;
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, p->fd, 0);
+    if (ptr == MAP_FAILED) {
+        MP_VERBOSE(s, "mmap failed: %s\n", mp_strerror(errno));
+        return false;
+    }
+    p->map = av_buffer_create(ptr, MPMIN(size, INT_MAX), unmap_file,
+                              (void *)(uintptr_t)size, AV_BUFFER_FLAG_READONLY);
+    if (!p->map) {
+        munmap(ptr, size);
+        return false;
+    }
+    p->map_size = size;
+    p->advised_start = p->advised_end = -1;
+    if (!mmap_advise(s, 0))
+        return false;
+    MP_VERBOSE(s, "File is memory mapped.\n");
+    return true;
+}
+
+#endif
+
 static int write_buffer(stream_t *s, char *buffer, int len)
 {
     struct priv *p = s->priv;
@@ -97,17 +247,15 @@ static int write_buffer(stream_t *s, char *buffer, int len)
     return len;
 }
 
-static int seek(stream_t *s, int64_t newpos)
-{
-    struct priv *p = s->priv;
-    return lseek(p->fd, newpos, SEEK_SET) != (off_t)-1;
-}
-
 static int control(stream_t *s, int cmd, void *arg)
 {
     struct priv *p = s->priv;
     switch (cmd) {
     case STREAM_CTRL_GET_SIZE: {
+        if (p->map) {
+            *(int64_t *)arg = p->map_size;
+            return 1;
+        }
         off_t size = lseek(p->fd, 0, SEEK_END);
         lseek(p->fd, s->pos, SEEK_SET);
         if (size != (off_t)-1) {
@@ -116,6 +264,14 @@ static int control(stream_t *s, int cmd, void *arg)
         }
         break;
     }
+    case STREAM_CTRL_GET_MTIME: {
+        struct stat st;
+        if (fstat(p->fd, &st) == 0) {
+            *(int64_t *)arg = st.st_mtime;
+            return 1;
+        }
+        break;
+    }
     }
     return STREAM_UNSUPPORTED;
 }
@@ -123,6 +279,7 @@ static int control(stream_t *s, int cmd, void *arg)
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
+    av_buffer_unref(&p->map);
     if (p->close && p->fd >= 0)
         close(p->fd);
 }
@@ -293,6 +450,7 @@ static int open_f(stream_t *stream)
 #endif
         }
         p->close = true;
+        stream->allow_reopen = true;
     }
 
 #ifdef __MINGW32__
@@ -316,6 +474,17 @@ static int open_f(stream_t *stream)
     if (check_stream_network(p->fd))
         stream->streaming = true;
 
+#if HAVE_POSIX
+    if (p->regular && !write && !stream->streaming &&
+        stream->opts->stream_file_mmap && init_mmap(stream))
+    {
+        stream->seek = seek_mmap;
+        stream->seekable = true;
+        stream->fill_buffer = fill_buffer_mmap;
+        stream->read_ref = read_ref_mmap;
+    }
+#endif
+
     return STREAM_OK;
 }
 
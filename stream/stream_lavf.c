@@ -198,18 +198,25 @@ void mp_setup_av_network_options(AVDictionary **dict, struct mpv_global *global,
     talloc_free(temp);
 }
 
-// Escape http URLs with unescaped, invalid characters in them.
-// libavformat's http protocol does not do this, and a patch to add this
-// in a 100% safe case (spaces only) was rejected.
-static char *normalize_url(void *ta_parent, const char *filename)
+static bool is_http_like(const char *filename)
 {
     bstr proto = mp_split_proto(bstr0(filename), NULL);
     for (int n = 0; http_like[n]; n++) {
         if (bstr_equals0(proto, http_like[n]))
-            // Escape everything but reserved characters.
-            // Also don't double-scape, so include '%'.
-            return mp_url_escape(ta_parent, filename, ":/?#[]@!$&'()*+,;=%");
+            return true;
     }
+    return false;
+}
+
+// Escape http URLs with unescaped, invalid characters in them.
+// libavformat's http protocol does not do this, and a patch to add this
+// in a 100% safe case (spaces only) was rejected.
+static char *normalize_url(void *ta_parent, const char *filename)
+{
+    // Escape everything but reserved characters.
+    // Also don't double-scape, so include '%'.
+    if (is_http_like(filename))
+        return mp_url_escape(ta_parent, filename, ":/?#[]@!$&'()*+,;=%");
     return (char *)filename;
 }
 
@@ -292,6 +299,8 @@ static int open_f(stream_t *stream)
     stream->priv = avio;
     stream->seekable = avio->seekable;
     stream->seek = stream->seekable ? seek : NULL;
+    // Seekable HTTP means range requests work, so more connections can be made.
+    stream->allow_reopen = stream->seekable && is_http_like(stream->url);
     stream->fill_buffer = fill_buffer;
     stream->write_buffer = write_buffer;
     stream->control = control;
@@ -15,11 +15,14 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
+
 #include <archive.h>
 #include <archive_entry.h>
 
 #include "misc/bstr.h"
 #include "common/common.h"
+#include "osdep/threads.h"
 #include "stream.h"
 
 #include "stream_libarchive.h"
@@ -265,34 +268,82 @@ err:
     return NULL;
 }
 
-struct priv {
+// Number of archive readers (each with its own decompressor state) kept open.
+// Readers left behind by seeks act as checkpoints: a later seek resumes from
+// the nearest reader before the target, instead of decompressing everything
+// from the start of the archive.
+#define MAX_READERS 3
+// Decompressed data buffered by the reader thread.
+#define BUFFER_SIZE (16 * 1024 * 1024)
+// Data kept before the current position, so that short backward seeks don't
+// need to decompress anything.
+#define BUFFER_BACK (4 * 1024 * 1024)
+#define READ_CHUNK (64 * 1024)
+
+struct reader {
     struct mp_archive *mpa;
     struct stream *src;
+    int64_t pos;            // position within the entry
+    uint64_t last_used;
+};
+
+struct priv {
+    char *src_url;
     int64_t entry_size;
     char *entry_name;
+
+    // Owned by the reader thread (after opening).
+    struct reader readers[MAX_READERS];
+    struct reader *cur;
+    uint64_t use_counter;
+    char scratch[READ_CHUNK];
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // --- protected by lock
+    char *buffer;           // BUFFER_SIZE bytes
+    int64_t buffer_pos;     // entry position of buffer[0]
+    int buffer_len;
+    int64_t read_pos;       // position of the stream user
+    bool seek_request;      // reader thread must continue at read_pos
+    bool eof, error;
+    bool terminate;
 };
 
-static int reopen_archive(stream_t *s)
+static void close_reader(struct reader *r)
+{
+    mp_archive_free(r->mpa);
+    free_stream(r->src);
+    *r = (struct reader){0};
+}
+
+// Open the archive, and position the reader at the start of the entry.
+static bool open_reader(stream_t *s, struct reader *r)
 {
     struct priv *p = s->priv;
-    mp_archive_free(p->mpa);
-    p->mpa = mp_archive_new(s->log, p->src, MP_ARCHIVE_FLAG_UNSAFE);
-    if (!p->mpa)
-        return STREAM_ERROR;
+    close_reader(r);
+    r->src = stream_create(p->src_url, STREAM_READ | STREAM_SAFE_ONLY,
+                           s->cancel, s->global);
+    if (!r->src)
+        goto error;
+    r->mpa = mp_archive_new(s->log, r->src, MP_ARCHIVE_FLAG_UNSAFE);
+    if (!r->mpa)
+        goto error;
 
     // Follows the same logic as demux_libarchive.c.
-    struct mp_archive *mpa = p->mpa;
+    struct mp_archive *mpa = r->mpa;
     int num_files = 0;
     for (;;) {
         struct archive_entry *entry;
-        int r = archive_read_next_header(mpa->arch, &entry);
-        if (r == ARCHIVE_EOF) {
+        int res = archive_read_next_header(mpa->arch, &entry);
+        if (res == ARCHIVE_EOF) {
             MP_ERR(s, "archive entry not found. '%s'\n", p->entry_name);
             goto error;
         }
-        if (r < ARCHIVE_OK)
+        if (res < ARCHIVE_OK)
             MP_ERR(s, "%s\n", archive_error_string(mpa->arch));
-        if (r < ARCHIVE_WARN)
+        if (res < ARCHIVE_WARN)
             goto error;
         if (archive_entry_filetype(entry) != AE_IFREG)
             continue;
@@ -306,67 +357,194 @@ static int reopen_archive(stream_t *s)
             p->entry_size = -1;
             if (archive_entry_size_is_set(entry))
                 p->entry_size = archive_entry_size(entry);
-            return STREAM_OK;
+            r->pos = 0;
+            return true;
         }
         num_files++;
     }
 
 error:
-    mp_archive_free(p->mpa);
-    p->mpa = NULL;
+    close_reader(r);
     MP_ERR(s, "could not open archive\n");
-    return STREAM_ERROR;
+    return false;
 }
 
-static int archive_entry_fill_buffer(stream_t *s, char *buffer, int max_len)
+static bool seek_interrupted(struct priv *p)
 {
-    struct priv *p = s->priv;
-    if (!p->mpa)
-        return 0;
-    int r = archive_read_data(p->mpa->arch, buffer, max_len);
-    if (r < 0)
-        MP_ERR(s, "%s\n", archive_error_string(p->mpa->arch));
+    pthread_mutex_lock(&p->lock);
+    bool r = p->seek_request || p->terminate;
+    pthread_mutex_unlock(&p->lock);
     return r;
 }
 
-static int archive_entry_seek(stream_t *s, int64_t newpos)
+// Make p->cur a reader positioned at target. Called on the reader thread.
+static bool seek_reader(stream_t *s, int64_t target)
 {
     struct priv *p = s->priv;
-    if (!p->mpa)
-        return -1;
-    if (archive_seek_data(p->mpa->arch, newpos, SEEK_SET) >= 0)
-        return 1;
-    // libarchive can't seek in most formats.
-    if (newpos < s->pos) {
-        // Hack seeking backwards into working by reopening the archive and
-        // starting over.
-        MP_VERBOSE(s, "trying to reopen archive for performing seek\n");
-        if (reopen_archive(s) < STREAM_OK)
-            return -1;
-        s->pos = 0;
+
+    if (p->cur && archive_seek_data(p->cur->mpa->arch, target, SEEK_SET) >= 0) {
+        p->cur->pos = target;
+        return true;
+    }
+
+    // libarchive can't seek in most formats. Use the reader closest to the
+    // target, or start over with a new one.
+    struct reader *best = NULL;
+    for (int n = 0; n < MAX_READERS; n++) {
+        struct reader *r = &p->readers[n];
+        if (r->mpa && r->pos <= target && (!best || r->pos > best->pos))
+            best = r;
     }
-    if (newpos > s->pos) {
-        // For seeking forwards, just keep reading data (there's no libarchive
-        // skip function either).
-        char buffer[4096];
-        while (newpos > s->pos) {
-            int size = MPMIN(newpos - s->pos, sizeof(buffer));
-            int r = archive_read_data(p->mpa->arch, buffer, size);
-            if (r < 0) {
-                MP_ERR(s, "%s\n", archive_error_string(p->mpa->arch));
-                return -1;
-            }
-            s->pos += r;
+    if (!best) {
+        for (int n = 0; n < MAX_READERS; n++) {
+            struct reader *r = &p->readers[n];
+            if (!best || !r->mpa || (best->mpa && r->last_used < best->last_used))
+                best = r;
         }
+        MP_VERBOSE(s, "reopening archive for performing seek\n");
+        if (!open_reader(s, best)) {
+            p->cur = NULL;
+            return false;
+        }
+    }
+    best->last_used = ++p->use_counter;
+    p->cur = best;
+
+    // Just keep reading data (there's no libarchive skip function).
+    while (target > best->pos) {
+        if (seek_interrupted(p))
+            return false;
+        int size = MPMIN(target - best->pos, sizeof(p->scratch));
+        int r = archive_read_data(best->mpa->arch, p->scratch, size);
+        if (r <= 0) {
+            if (r < 0)
+                MP_ERR(s, "%s\n", archive_error_string(best->mpa->arch));
+            return false;
+        }
+        best->pos += r;
     }
-    return 1;
+    return true;
+}
+
+// Decompresses the entry ahead of the stream user.
+static void *reader_thread(void *arg)
+{
+    stream_t *s = arg;
+    struct priv *p = s->priv;
+    mpthread_set_name("archive");
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->terminate) {
+        if (p->seek_request) {
+            int64_t target = p->read_pos;
+            p->seek_request = false;
+            p->buffer_pos = target;
+            p->buffer_len = 0;
+            p->eof = p->error = false;
+            pthread_mutex_unlock(&p->lock);
+            bool ok = seek_reader(s, target);
+            pthread_mutex_lock(&p->lock);
+            if (!p->seek_request)
+                p->error = !ok;
+            pthread_cond_broadcast(&p->wakeup);
+            continue;
+        }
+
+        // Drop old data, but keep some for seeking back.
+        int64_t back = p->read_pos - p->buffer_pos;
+        if (back > BUFFER_BACK + READ_CHUNK) {
+            int drop = back - BUFFER_BACK;
+            memmove(p->buffer, p->buffer + drop, p->buffer_len - drop);
+            p->buffer_pos += drop;
+            p->buffer_len -= drop;
+        }
+
+        if (p->eof || p->error || !p->cur || p->buffer_len == BUFFER_SIZE) {
+            pthread_cond_wait(&p->wakeup, &p->lock);
+            continue;
+        }
+
+        // Only this thread changes the buffer, so the free part can be written
+        // without holding the lock.
+        char *dst = p->buffer + p->buffer_len;
+        int size = MPMIN(BUFFER_SIZE - p->buffer_len, READ_CHUNK);
+        pthread_mutex_unlock(&p->lock);
+        int r = archive_read_data(p->cur->mpa->arch, dst, size);
+        if (r < 0)
+            MP_ERR(s, "%s\n", archive_error_string(p->cur->mpa->arch));
+        if (r > 0)
+            p->cur->pos += r;
+        pthread_mutex_lock(&p->lock);
+        if (r < 0) {
+            p->error = true;
+        } else if (r == 0) {
+            p->eof = true;
+        } else if (!p->seek_request) {
+            p->buffer_len += r;
+        }
+        pthread_cond_broadcast(&p->wakeup);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static int archive_entry_fill_buffer(stream_t *s, char *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+    int res = 0;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        int64_t avail = p->buffer_pos + p->buffer_len - p->read_pos;
+        if (!p->seek_request && p->read_pos >= p->buffer_pos && avail > 0) {
+            res = MPMIN(avail, max_len);
+            memcpy(buffer, p->buffer + (p->read_pos - p->buffer_pos), res);
+            p->read_pos += res;
+            pthread_cond_broadcast(&p->wakeup);
+            break;
+        }
+        if (!p->seek_request && (p->eof || p->error))
+            break;
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return res;
+}
+
+static int archive_entry_seek(stream_t *s, int64_t newpos)
+{
+    struct priv *p = s->priv;
+    pthread_mutex_lock(&p->lock);
+    p->read_pos = newpos;
+    // Seeks within the buffered data are free.
+    if (p->seek_request || newpos < p->buffer_pos ||
+        newpos > p->buffer_pos + p->buffer_len)
+    {
+        p->seek_request = true;
+        pthread_cond_broadcast(&p->wakeup);
+        while (p->seek_request ||
+               (!p->buffer_len && !p->eof && !p->error && p->cur))
+            pthread_cond_wait(&p->wakeup, &p->lock);
+    }
+    pthread_cond_broadcast(&p->wakeup);
+    bool ok = !p->error;
+    pthread_mutex_unlock(&p->lock);
+    return ok ? 1 : -1;
 }
 
 static void archive_entry_close(stream_t *s)
 {
     struct priv *p = s->priv;
-    mp_archive_free(p->mpa);
-    free_stream(p->src);
+    if (p->buffer) {
+        pthread_mutex_lock(&p->lock);
+        p->terminate = true;
+        pthread_cond_broadcast(&p->wakeup);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->thread, NULL);
+        pthread_cond_destroy(&p->wakeup);
+        pthread_mutex_destroy(&p->lock);
+    }
+    for (int n = 0; n < MAX_READERS; n++)
+        close_reader(&p->readers[n]);
 }
 
 static int archive_entry_control(stream_t *s, int cmd, void *arg)
@@ -374,7 +552,7 @@ static int archive_entry_control(stream_t *s, int cmd, void *arg)
     struct priv *p = s->priv;
     switch (cmd) {
     case STREAM_CTRL_GET_BASE_FILENAME:
-        *(char **)arg = talloc_strdup(NULL, p->src->url);
+        *(char **)arg = talloc_strdup(NULL, p->src_url);
         return STREAM_OK;
     case STREAM_CTRL_GET_SIZE:
         if (p->entry_size < 0)
@@ -399,21 +577,32 @@ static int archive_entry_open(stream_t *stream)
     p->entry_name = name;
     mp_url_unescape_inplace(base);
 
-    p->src = stream_create(base, STREAM_READ | STREAM_SAFE_ONLY,
-                           stream->cancel, stream->global);
-    if (!p->src) {
-        archive_entry_close(stream);
+    struct stream *src = stream_create(base, STREAM_READ | STREAM_SAFE_ONLY,
+                                       stream->cancel, stream->global);
+    if (!src)
         return STREAM_ERROR;
-    }
+    p->src_url = talloc_strdup(p, src->url);
+    bool seekable = src->seekable;
+    free_stream(src);
 
-    int r = reopen_archive(stream);
-    if (r < STREAM_OK) {
+    p->cur = &p->readers[0];
+    if (!open_reader(stream, p->cur))
+        return STREAM_ERROR;
+    p->cur->last_used = ++p->use_counter;
+
+    p->buffer = talloc_size(p, BUFFER_SIZE);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
+    if (pthread_create(&p->thread, NULL, reader_thread, stream)) {
+        pthread_cond_destroy(&p->wakeup);
+        pthread_mutex_destroy(&p->lock);
+        p->buffer = NULL;
         archive_entry_close(stream);
-        return r;
+        return STREAM_ERROR;
     }
 
     stream->fill_buffer = archive_entry_fill_buffer;
-    if (p->src->seekable) {
+    if (seekable) {
         stream->seek = archive_entry_seek;
         stream->seekable = true;
     }
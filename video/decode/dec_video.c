@@ -27,6 +27,7 @@
 #include "common/msg.h"
 
 #include "osdep/timer.h"
+#include "misc/dec_queue.h"
 
 #include "stream/stream.h"
 #include "demux/demux.h"
@@ -42,6 +43,10 @@
 
 #include "video/decode/dec_video.h"
 
+// With keyframes_only set, give up skipping packets after this many packets
+// without keyframe flag.
+#define MAX_NONKEY_PACKETS 1000
+
 extern const vd_functions_t mpcodecs_vd_ffmpeg;
 
 /* Please do not add any new decoders here. If you want to implement a new
@@ -56,9 +61,36 @@ const vd_functions_t * const mpcodecs_vd_drivers[] = {
     NULL
 };
 
-void video_reset(struct dec_video *d_video)
+static void lock_decoder(struct dec_video *d_video)
+{
+    if (d_video->queue)
+        dec_queue_lock_decoder(d_video->queue);
+}
+
+static void unlock_decoder(struct dec_video *d_video)
+{
+    if (d_video->queue)
+        dec_queue_unlock_decoder(d_video->queue);
+}
+
+static int vd_control(struct dec_video *d_video, int cmd, void *arg)
+{
+    const struct vd_functions *vd = d_video->vd_driver;
+    if (vd)
+        return vd->control(d_video, cmd, arg);
+    return CONTROL_UNKNOWN;
+}
+
+static int query_threading(struct dec_video *d_video)
+{
+    int threading = THREADING_NONE;
+    vd_control(d_video, VDCTRL_GET_THREADING, &threading);
+    return threading;
+}
+
+static void reset_decoder(struct dec_video *d_video)
 {
-    video_vd_control(d_video, VDCTRL_RESET, NULL);
+    vd_control(d_video, VDCTRL_RESET, NULL);
     d_video->num_buffered_pts = 0;
     d_video->first_packet_pdts = MP_NOPTS_VALUE;
     d_video->start_pts = MP_NOPTS_VALUE;
@@ -67,20 +99,47 @@ void video_reset(struct dec_video *d_video)
     d_video->codec_dts = MP_NOPTS_VALUE;
     d_video->last_format = d_video->fixed_format = (struct mp_image_params){0};
     d_video->dropped_frames = 0;
+    d_video->num_nonkey_packets = 0;
+    d_video->skip_nonkey = false;
     d_video->current_state = DATA_AGAIN;
     mp_image_unrefp(&d_video->current_mpi);
 }
 
+void video_reset(struct dec_video *d_video)
+{
+    struct dec_queue *q = d_video->queue;
+    if (q) {
+        dec_queue_lock_decoder(q);
+        dec_queue_reset(q);
+        dec_queue_lock(q);
+        d_video->req_framedrop = false;
+        d_video->req_keyframes_only = false;
+        d_video->req_start_pts = MP_NOPTS_VALUE;
+        d_video->pub_dropped_frames = 0;
+        dec_queue_unlock(q);
+    }
+    reset_decoder(d_video);
+    if (q) {
+        // The decoder might have switched its threading mode on reset.
+        dec_queue_lock(q);
+        d_video->pub_threading = query_threading(d_video);
+        dec_queue_unlock(q);
+    }
+    unlock_decoder(d_video);
+}
+
 int video_vd_control(struct dec_video *d_video, int cmd, void *arg)
 {
-    const struct vd_functions *vd = d_video->vd_driver;
-    if (vd)
-        return vd->control(d_video, cmd, arg);
-    return CONTROL_UNKNOWN;
+    lock_decoder(d_video);
+    int r = vd_control(d_video, cmd, arg);
+    unlock_decoder(d_video);
+    return r;
 }
 
 void video_uninit(struct dec_video *d_video)
 {
+    dec_queue_destroy(d_video->queue);
+    d_video->queue = NULL;
     mp_image_unrefp(&d_video->current_mpi);
     mp_image_unrefp(&d_video->cover_art_mpi);
     if (d_video->vd_driver) {
@@ -125,6 +184,8 @@ static const struct vd_functions *find_driver(const char *name)
     return NULL;
 }
 
+static void start_thread(struct dec_video *d_video);
+
 bool video_init_best_codec(struct dec_video *d_video, char* video_decoders)
 {
     assert(!d_video->vd_driver);
@@ -171,6 +232,11 @@ bool video_init_best_codec(struct dec_video *d_video, char* video_decoders)
     }
 
     talloc_free(list);
+
+    if (d_video->vd_driver && d_video->opts->vd_queue_frames > 0 &&
+        !d_video->header->attached_picture)
+        start_thread(d_video);
+
     return !!d_video->vd_driver;
 }
 
@@ -237,7 +303,7 @@ static void add_avi_pts(struct dec_video *d_video, double pts)
 {
     if (pts != MP_NOPTS_VALUE) {
         int delay = -1;
-        video_vd_control(d_video, VDCTRL_QUERY_UNSEEN_FRAMES, &delay);
+        vd_control(d_video, VDCTRL_QUERY_UNSEEN_FRAMES, &delay);
         if (delay >= 0 && delay < d_video->num_buffered_pts)
             d_video->num_buffered_pts = delay;
         if (d_video->num_buffered_pts == MP_ARRAY_SIZE(d_video->buffered_pts)) {
@@ -366,21 +432,75 @@ static struct mp_image *decode_packet(struct dec_video *d_video,
 
 void video_reset_aspect(struct dec_video *d_video)
 {
+    lock_decoder(d_video);
     d_video->last_format = (struct mp_image_params){0};
+    unlock_decoder(d_video);
 }
 
 void video_set_framedrop(struct dec_video *d_video, bool enabled)
 {
-    d_video->framedrop_enabled = enabled;
+    struct dec_queue *q = d_video->queue;
+    if (q) {
+        dec_queue_lock(q);
+        d_video->req_framedrop = enabled;
+        dec_queue_unlock(q);
+    } else {
+        d_video->framedrop_enabled = enabled;
+    }
+}
+
+// Current THREADING_* mode of the decoder. Doesn't wait for the decoder.
+int video_get_threading(struct dec_video *d_video)
+{
+    struct dec_queue *q = d_video->queue;
+    if (!q)
+        return query_threading(d_video);
+    dec_queue_lock(q);
+    int r = d_video->pub_threading;
+    dec_queue_unlock(q);
+    return r;
+}
+
+// Number of frames dropped by decoder framedrop since the last reset.
+int video_get_dropped_frames(struct dec_video *d_video)
+{
+    struct dec_queue *q = d_video->queue;
+    if (!q)
+        return d_video->dropped_frames;
+    dec_queue_lock(q);
+    int r = d_video->pub_dropped_frames;
+    dec_queue_unlock(q);
+    return r;
+}
+
+// Decode keyframes only (trick-play at high speed). Other packets are skipped
+// without decoding them.
+void video_set_keyframes_only(struct dec_video *d_video, bool enabled)
+{
+    struct dec_queue *q = d_video->queue;
+    if (q) {
+        dec_queue_lock(q);
+        d_video->req_keyframes_only = enabled;
+        dec_queue_unlock(q);
+    } else {
+        d_video->keyframes_only = enabled;
+    }
 }
 
 // Frames before the start timestamp can be dropped. (Used for hr-seek.)
 void video_set_start(struct dec_video *d_video, double start_pts)
 {
-    d_video->start_pts = start_pts;
+    struct dec_queue *q = d_video->queue;
+    if (q) {
+        dec_queue_lock(q);
+        d_video->req_start_pts = start_pts;
+        dec_queue_unlock(q);
+    } else {
+        d_video->start_pts = start_pts;
+    }
 }
 
-void video_work(struct dec_video *d_video)
+static void decode_step(struct dec_video *d_video)
 {
     if (d_video->current_mpi)
         return;
@@ -407,7 +527,29 @@ void video_work(struct dec_video *d_video)
         return;
     }
 
-    int framedrop_type = d_video->framedrop_enabled ? 1 : 0;
+    // Skip non-keyframe packets, unless the demuxer doesn't seem to set
+    // keyframe flags at all. (AVI-style timestamps need all packets.) Skipping
+    // starts and ends at keyframes only, since the decoder can't pick up in
+    // the middle of a GOP.
+    if (pkt && !d_video->header->codec->avi_dts) {
+        if (pkt->keyframe) {
+            d_video->num_nonkey_packets = 0;
+            d_video->skip_nonkey = d_video->keyframes_only;
+        } else if (d_video->skip_nonkey) {
+            if (++d_video->num_nonkey_packets <= MAX_NONKEY_PACKETS) {
+                talloc_free(pkt);
+                d_video->current_state = DATA_AGAIN;
+                return;
+            }
+            // Decode everything; also makes vd_lavc stop discarding frames.
+            d_video->skip_nonkey = false;
+        }
+    }
+
+    // Dropping decoded frames in addition to skipping packets would leave
+    // nothing to display.
+    int framedrop_type =
+        d_video->framedrop_enabled && !d_video->skip_nonkey ? 1 : 0;
     if (d_video->start_pts != MP_NOPTS_VALUE && pkt &&
         pkt->pts < d_video->start_pts - .005 &&
         !d_video->has_broken_packet_pts)
@@ -429,14 +571,73 @@ void video_work(struct dec_video *d_video)
     }
 }
 
+static double image_bytes(void *frame)
+{
+    return mp_image_get_data_size(frame);
+}
+
+static int thread_decode(void *ctx, void **out_frame)
+{
+    struct dec_video *d_video = ctx;
+    decode_step(d_video);
+    *out_frame = d_video->current_mpi;
+    d_video->current_mpi = NULL;
+    return d_video->current_state;
+}
+
+static void thread_sync(void *ctx)
+{
+    struct dec_video *d_video = ctx;
+    d_video->framedrop_enabled = d_video->req_framedrop;
+    d_video->keyframes_only = d_video->req_keyframes_only;
+    d_video->start_pts = d_video->req_start_pts;
+    d_video->pub_dropped_frames = d_video->dropped_frames;
+    d_video->pub_threading = query_threading(d_video);
+}
+
+static void start_thread(struct dec_video *d_video)
+{
+    struct MPOpts *opts = d_video->opts;
+    d_video->req_start_pts = MP_NOPTS_VALUE;
+    d_video->pub_threading = query_threading(d_video);
+    d_video->queue = dec_queue_create(&(struct dec_queue_params){
+        .name = "vd",
+        .max_frames = opts->vd_queue_frames,
+        .max_size = opts->vd_queue_max_bytes,
+        .decode = thread_decode,
+        .sync = thread_sync,
+        .frame_size = image_bytes,
+        .ctx = d_video,
+        .wakeup = d_video->wakeup,
+        .wakeup_ctx = d_video->wakeup_ctx,
+    });
+    if (!d_video->queue) {
+        MP_WARN(d_video, "Could not start decoder thread.\n");
+        return;
+    }
+    MP_VERBOSE(d_video, "Decoding on a separate thread (queue: %d frames).\n",
+               opts->vd_queue_frames);
+}
+
+void video_work(struct dec_video *d_video)
+{
+    if (d_video->queue) {
+        dec_queue_work(d_video->queue);
+    } else {
+        decode_step(d_video);
+    }
+}
+
 // Fetch an image decoded with video_work(). Returns one of:
 //  DATA_OK:    *out_mpi is set to a new image
-//  DATA_WAIT:  waiting for demuxer; will receive a wakeup signal
+//  DATA_WAIT:  waiting for demuxer or decoder thread; will receive a wakeup
 //  DATA_EOF:   end of file, no more frames to be expected
 //  DATA_AGAIN: dropped frame or something similar
 int video_get_frame(struct dec_video *d_video, struct mp_image **out_mpi)
 {
     *out_mpi = NULL;
+    if (d_video->queue)
+        return dec_queue_get_frame(d_video->queue, (void **)out_mpi);
     if (d_video->current_mpi) {
         *out_mpi = d_video->current_mpi;
         d_video->current_mpi = NULL;
@@ -39,7 +39,10 @@ struct dec_video {
 
     float fps;            // FPS from demuxer or from user override
 
-    int dropped_frames;
+    // Called (from any thread) when the decoder thread has a new frame or
+    // reached EOF. Must be set before video_init_best_codec().
+    void (*wakeup)(void *ctx);
+    void *wakeup_ctx;
 
     // Internal (shared with vd_lavc.c).
 
@@ -73,9 +76,22 @@ struct dec_video {
 
     double start_pts;
     bool framedrop_enabled;
+    int dropped_frames;   // use video_get_dropped_frames()
+    bool keyframes_only;
+    bool skip_nonkey;       // skipping packets until the next keyframe
+    int num_nonkey_packets; // consecutive non-keyframe packets
     struct mp_image *cover_art_mpi;
     struct mp_image *current_mpi;
     int current_state;
+
+    // Decoder thread and its output queue (NULL if decoding synchronously).
+    struct dec_queue *queue;
+    // Settings for, and state published by the decoder thread (protected by
+    // the queue lock).
+    bool req_framedrop, req_keyframes_only;
+    double req_start_pts;
+    int pub_dropped_frames;
+    int pub_threading;
 };
 
 struct mp_decoder_list *video_decoder_list(void);
@@ -87,6 +103,9 @@ void video_work(struct dec_video *d_video);
 int video_get_frame(struct dec_video *d_video, struct mp_image **out_mpi);
 
 void video_set_framedrop(struct dec_video *d_video, bool enabled);
+int video_get_dropped_frames(struct dec_video *d_video);
+int video_get_threading(struct dec_video *d_video);
+void video_set_keyframes_only(struct dec_video *d_video, bool enabled);
 void video_set_start(struct dec_video *d_video, double start_pts);
 
 int video_vd_control(struct dec_video *d_video, int cmd, void *arg);
@@ -42,6 +42,15 @@ typedef struct lavc_ctx {
 
     bool hwdec_request_reinit;
     int hwdec_fail_count;
+
+    // Adaptive threading (--vd-lavc-threads-adaptive)
+    bool frame_threading;       // use frame threading on next open
+    int threads;                // thread count on next open (0: option)
+    int max_threads;            // thread count requested by the option
+    int pending_threading;      // -1, or new frame_threading value
+    int pending_threads;        // new threads value (if pending_threading)
+    int64_t decode_time;        // in us, sum over the current window
+    int decode_count;           // frames in the current window
 } vd_ffmpeg_ctx;
 
 struct vd_lavc_hwdec {
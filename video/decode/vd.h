@@ -46,6 +46,13 @@ enum vd_ctrl {
     VDCTRL_FORCE_HWDEC_FALLBACK, // force software decoding fallback
     VDCTRL_GET_HWDEC,
     VDCTRL_REINIT,
+    VDCTRL_GET_THREADING, // int*: THREADING_* value
+};
+
+enum {
+    THREADING_NONE = 0,
+    THREADING_SLICE,
+    THREADING_FRAME,
 };
 
 #endif /* MPLAYER_VD_H */
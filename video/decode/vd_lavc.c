@@ -20,6 +20,7 @@
 #include <assert.h>
 #include <time.h>
 #include <stdbool.h>
+#include <math.h>
 #include <sys/types.h>
 
 #include <libavutil/common.h>
@@ -31,6 +32,7 @@
 #include "config.h"
 #include "common/msg.h"
 #include "options/options.h"
+#include "osdep/timer.h"
 #include "misc/bstr.h"
 #include "common/av_common.h"
 #include "common/codecs.h"
@@ -63,6 +65,11 @@ static int get_buffer2_hwdec(AVCodecContext *avctx, AVFrame *pic, int flags);
 static enum AVPixelFormat get_format_hwdec(struct AVCodecContext *avctx,
                                            const enum AVPixelFormat *pix_fmt);
 
+// Adaptive threading decisions are made over this many decoded frames.
+#define ADAPTIVE_WINDOW 64
+// Start with frame threading above this many pixels per second (1080p30).
+#define ADAPTIVE_FRAME_THREADING_PIXELS (1920.0 * 1080 * 30)
+
 #define OPT_BASE_STRUCT struct vd_lavc_params
 
 struct vd_lavc_params {
@@ -73,6 +80,7 @@ struct vd_lavc_params {
     int skip_frame;
     int framedrop;
     int threads;
+    int threads_adaptive;
     int bitexact;
     int check_hw_profile;
     int software_fallback;
@@ -101,6 +109,7 @@ const struct m_sub_options vd_lavc_conf = {
         OPT_DISCARD("skipframe", skip_frame, 0),
         OPT_DISCARD("framedrop", framedrop, 0),
         OPT_INT("threads", threads, M_OPT_MIN, .min = 0),
+        OPT_FLAG("threads-adaptive", threads_adaptive, 0),
         OPT_FLAG("bitexact", bitexact, 0),
         OPT_FLAG("check-hw-profile", check_hw_profile, 0),
         OPT_CHOICE_OR_INT("software-fallback", software_fallback, 0, 1, INT_MAX,
@@ -332,6 +341,7 @@ static int init(struct dec_video *vd, const char *decoder)
     ctx->log = vd->log;
     ctx->opts = vd->opts;
     ctx->decoder = talloc_strdup(ctx, decoder);
+    ctx->pending_threading = -1;
 
     if (bstr_endswith0(bstr0(decoder), "_vdpau")) {
         MP_WARN(vd, "VDPAU decoder '%s' was requested. "
@@ -344,6 +354,13 @@ static int init(struct dec_video *vd, const char *decoder)
         return 0;
     }
 
+    // Initial guess for adaptive threading: frame threading adds latency,
+    // so use it only for content that is likely too heavy to decode without.
+    struct mp_codec_params *c = vd->header->codec;
+    double fps = vd->fps > 0 ? vd->fps : 25;
+    ctx->frame_threading = (double)c->disp_w * c->disp_h * fps >
+                           ADAPTIVE_FRAME_THREADING_PIXELS;
+
     reinit(vd);
 
     if (!ctx->avctx) {
@@ -408,7 +425,20 @@ static void init_avctx(struct dec_video *vd, const char *decoder,
             ctx->max_delay_queue = HWDEC_DELAY_QUEUE_COUNT;
     } else {
         mp_set_avcodec_threads(vd->log, avctx, lavc_param->threads);
+        if (lavc_param->threads_adaptive) {
+            ctx->max_threads = avctx->thread_count;
+            if (ctx->threads > 0)
+                avctx->thread_count = MPMIN(ctx->threads, ctx->max_threads);
+            avctx->thread_type = ctx->frame_threading
+                               ? FF_THREAD_FRAME | FF_THREAD_SLICE
+                               : FF_THREAD_SLICE;
+            MP_VERBOSE(vd, "Using %s threading with %d threads.\n",
+                       ctx->frame_threading ? "frame" : "slice",
+                       avctx->thread_count);
+        }
     }
+    ctx->decode_time = 0;
+    ctx->decode_count = 0;
 
     avctx->flags |= lavc_param->bitexact ? CODEC_FLAG_BITEXACT : 0;
     avctx->flags2 |= lavc_param->fast ? CODEC_FLAG2_FAST : 0;
@@ -648,6 +678,9 @@ static struct mp_image *read_output(struct dec_video *vd)
     return mp_img_swap_to_native(res);
 }
 
+static void update_adaptive_threading(struct dec_video *vd, int64_t time);
+static void switch_threading(struct dec_video *vd);
+
 static void decode(struct dec_video *vd, struct demux_packet *packet,
                    int flags, struct mp_image **out_image)
 {
@@ -662,9 +695,20 @@ static void decode(struct dec_video *vd, struct demux_packet *packet,
     if (!avctx)
         return;
 
+    bool adaptive = opts->threads_adaptive && !ctx->hwdec;
+    if (adaptive && ctx->pending_threading >= 0 && packet && packet->keyframe) {
+        switch_threading(vd);
+        avctx = ctx->avctx;
+        if (!avctx)
+            return;
+    }
+
     if (flags) {
         // hr-seek framedrop vs. normal framedrop
         avctx->skip_frame = flags == 2 ? AVDISCARD_NONREF : opts->framedrop;
+    } else if (vd->skip_nonkey) {
+        // in case the demuxer sets keyframe flags on some non-keyframes
+        avctx->skip_frame = AVDISCARD_NONKEY;
     } else {
         // normal playback
         avctx->skip_frame = ctx->skip_frame;
@@ -677,10 +721,15 @@ static void decode(struct dec_video *vd, struct demux_packet *packet,
     if (ctx->hwdec_request_reinit || (pkt.data && ctx->flushing))
         reset_avctx(vd);
 
+    int64_t start_time = mp_time_us();
     hwdec_lock(ctx);
     ret = avcodec_decode_video2(avctx, ctx->pic, &got_picture, &pkt);
     hwdec_unlock(ctx);
 
+    // Only measure normal decoding; frames dropped by the decoder are cheaper.
+    if (adaptive && pkt.data && !flags && ret >= 0)
+        update_adaptive_threading(vd, mp_time_us() - start_time);
+
     // Reset decoder if it was fully flushed. Caller might send more flush
     // packets, or even new actual packets.
     if (ctx->flushing && (ret < 0 || !got_picture))
@@ -740,6 +789,89 @@ static void decode(struct dec_video *vd, struct demux_packet *packet,
         *out_image = read_output(vd);
 }
 
+// Compare the average decoding time over the last window with the frame
+// duration, and decide whether the decoder should be reopened with a
+// different threading mode or thread count.
+static void update_adaptive_threading(struct dec_video *vd, int64_t time)
+{
+    vd_ffmpeg_ctx *ctx = vd->priv;
+    AVCodecContext *avctx = ctx->avctx;
+
+    ctx->decode_time += time;
+    ctx->decode_count += 1;
+    if (ctx->decode_count < ADAPTIVE_WINDOW)
+        return;
+
+    double avg = ctx->decode_time / (double)ctx->decode_count / 1e6;
+    double budget = 1.0 / (vd->fps > 0 ? vd->fps : 25);
+    ctx->decode_time = 0;
+    ctx->decode_count = 0;
+
+    int threading = -1;
+    int threads = ctx->max_threads;
+    if (!ctx->frame_threading) {
+        // Not keeping up (with some margin for filtering and rendering).
+        if (avg > budget * 0.8 && ctx->max_threads > 1)
+            threading = 1;
+    } else {
+        // With frame threading, each call roughly takes the single-threaded
+        // decoding time divided by the thread count. If even the single-
+        // threaded time is comfortably within the budget, drop the latency.
+        // Otherwise use just enough threads (each one adds a frame of delay).
+        double single = avg * avctx->thread_count;
+        int need = MPCLAMP((int)ceil(single / (budget * 0.7)), 2,
+                           ctx->max_threads);
+        if (single < budget * 0.5) {
+            threading = 0;
+        } else if (need > avctx->thread_count ||
+                   need < avctx->thread_count - 1)
+        {
+            threading = 1;
+            threads = need;
+        }
+    }
+    if (threading >= 0 && (threading != ctx->pending_threading ||
+                           threads != ctx->pending_threads))
+    {
+        MP_VERBOSE(vd, "Average decoding time %f ms (frame duration %f ms), "
+                   "switching to %s threading with %d threads.\n",
+                   avg * 1e3, budget * 1e3, threading ? "frame" : "slice",
+                   threads);
+        ctx->pending_threading = threading;
+        ctx->pending_threads = threads;
+    }
+}
+
+// Reopen the decoder with the pending threading mode. Must be called on a
+// keyframe (or on reset). Frames still buffered in the old decoder are
+// drained into the delay queue, and returned before the new decoder's output.
+static void switch_threading(struct dec_video *vd)
+{
+    vd_ffmpeg_ctx *ctx = vd->priv;
+
+    struct mp_image **frames = NULL;
+    int num_frames = 0;
+    for (;;) {
+        struct mp_image *mpi = NULL;
+        decode(vd, NULL, 0, &mpi);
+        if (!mpi)
+            break;
+        MP_TARRAY_APPEND(NULL, frames, num_frames, mpi);
+    }
+
+    ctx->frame_threading = ctx->pending_threading;
+    ctx->threads = ctx->pending_threads;
+    ctx->pending_threading = -1;
+    uninit_avctx(vd);
+    init_avctx(vd, ctx->decoder, NULL);
+
+    for (int n = 0; n < num_frames; n++) {
+        MP_TARRAY_APPEND(ctx, ctx->delay_queue, ctx->num_delay_queue,
+                         frames[n]);
+    }
+    talloc_free(frames);
+}
+
 static struct mp_image *decode_with_fallback(struct dec_video *vd,
                                 struct demux_packet *packet, int flags)
 {
@@ -774,7 +906,23 @@ static int control(struct dec_video *vd, int cmd, void *arg)
     switch (cmd) {
     case VDCTRL_RESET:
         flush_all(vd);
+        // The decoder is empty, so this doesn't need to wait for a keyframe.
+        if (ctx->pending_threading >= 0 && ctx->avctx)
+            switch_threading(vd);
         return CONTROL_TRUE;
+    case VDCTRL_GET_THREADING: {
+        AVCodecContext *avctx = ctx->avctx;
+        int threading = THREADING_NONE;
+        if (avctx && avctx->thread_count > 1) {
+            if (avctx->active_thread_type & FF_THREAD_FRAME) {
+                threading = THREADING_FRAME;
+            } else if (avctx->active_thread_type & FF_THREAD_SLICE) {
+                threading = THREADING_SLICE;
+            }
+        }
+        *(int *)arg = threading;
+        return CONTROL_TRUE;
+    }
     case VDCTRL_QUERY_UNSEEN_FRAMES: {
         AVCodecContext *avctx = ctx->avctx;
         if (!avctx)
@@ -113,6 +113,18 @@ int mp_image_plane_h(struct mp_image *mpi, int plane)
     return mp_chroma_div_up(mpi->h, mpi->fmt.ys[plane]);
 }
 
+// Return the approximate number of bytes of memory the image data occupies.
+// Hardware surfaces are not in system memory, and return 0.
+int64_t mp_image_get_data_size(struct mp_image *mpi)
+{
+    if (mpi->fmt.flags & MP_IMGFLAG_HWACCEL)
+        return 0;
+    int64_t size = 0;
+    for (int n = 0; n < mpi->num_planes; n++)
+        size += (int64_t)abs(mpi->stride[n]) * mp_image_plane_h(mpi, n);
+    return size;
+}
+
 // Caller has to make sure this doesn't exceed the allocated plane data/strides.
 void mp_image_set_size(struct mp_image *mpi, int w, int h)
 {
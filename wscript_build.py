@@ -180,6 +180,7 @@ def build(ctx):
         ( "demux/demux_tv.c",                    "tv" ),
         ( "demux/ebml.c" ),
         ( "demux/packet.c" ),
+        ( "demux/probe_cache.c" ),
         ( "demux/timeline.c" ),
 
         ## Input
@@ -194,10 +195,12 @@ def build(ctx):
         ## Misc
         ( "misc/bstr.c" ),
         ( "misc/charset_conv.c" ),
+        ( "misc/dec_queue.c" ),
         ( "misc/dispatch.c" ),
         ( "misc/json.c" ),
         ( "misc/ring.c" ),
         ( "misc/rendezvous.c" ),
+        ( "misc/thread_pool.c" ),
 
         ## Options
         ( "options/m_config.c" ),